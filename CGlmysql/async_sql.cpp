@@ -0,0 +1,453 @@
+#define LOG_MODULE LOG_MOD_SQL // 本文件的日志属于sql模块，要在包含log.h之前定义
+#include <sys/epoll.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "async_sql.h"
+
+async_sql::async_sql(sql_callback callback, void *owner)
+{
+    m_callback = callback;
+    m_owner = owner;
+    m_epollfd = -1;
+    m_busy = 0;
+    m_close_log = 0;
+}
+
+async_sql::~async_sql()
+{
+    // 回调不再调用，正在执行和排队的查询直接丢弃
+    for (sql_conn &c : m_conns)
+    {
+        if (c.mysql)
+            drop(c);
+    }
+}
+
+// 关闭一个连接并从epoll中移除，不会再分配新的查询
+void async_sql::drop(sql_conn &c)
+{
+    for (int i = 0; i < STMT_COUNT; i++)
+    {
+        if (c.stmts[i])
+            mysql_stmt_close(c.stmts[i]);
+        c.stmts[i] = nullptr;
+    }
+    if (c.fd != -1)
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, c.fd, 0);
+    mysql_close(c.mysql);
+    c.mysql = nullptr;
+    c.fd = -1;
+    c.stage = IDLE;
+}
+
+bool async_sql::handle_event(int fd, uint32_t events)
+{
+    for (sql_conn &c : m_conns)
+    {
+        if (c.fd != fd)
+            continue;
+#if ASYNC_SQL_ENABLED
+        if (c.stage == IDLE)
+        {
+            // 空闲连接上只可能是服务端断开，不再使用这个连接
+            if (events & (EPOLLHUP | EPOLLERR | EPOLLIN))
+            {
+                LOG_ERROR("async sql connection %d closed by server", fd);
+                drop(c);
+            }
+            return true;
+        }
+
+        // 把epoll事件换算成客户端库等待的条件，出错时让库自己读写以得到错误码
+        int wait = 0;
+        if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            wait |= MYSQL_WAIT_READ;
+        if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+            wait |= MYSQL_WAIT_WRITE;
+        if (events & EPOLLPRI)
+            wait |= MYSQL_WAIT_EXCEPT;
+        step(c, wait);
+#endif
+        return true;
+    }
+    return false;
+}
+
+void async_sql::cancel(void *arg)
+{
+    for (sql_conn &c : m_conns)
+    {
+        if (c.stage != IDLE && c.req.arg == arg)
+            c.cancelled = true;
+    }
+    for (auto it = m_waiting.begin(); it != m_waiting.end();)
+    {
+        if (it->arg == arg)
+            it = m_waiting.erase(it);
+        else
+            ++it;
+    }
+}
+
+#if ASYNC_SQL_ENABLED
+
+bool async_sql::init(int epollfd, const string &url, const string &user, const string &passwd,
+                     const string &db_name, int port, int conn_num, int close_log)
+{
+    m_epollfd = epollfd;
+    m_close_log = close_log;
+    m_conns.reserve(conn_num); // 之后不再扩容，sql_conn的引用始终有效
+
+    for (int i = 0; i < conn_num; i++)
+    {
+        MYSQL *mysql = mysql_init(nullptr);
+        if (!mysql)
+        {
+            LOG_ERROR("async sql: mysql_init failed");
+            return false;
+        }
+        // 开启非阻塞模式后才能使用*_start/*_cont接口，建立连接本身仍然同步完成
+        mysql_options(mysql, MYSQL_OPT_NONBLOCK, 0);
+        if (!mysql_real_connect(mysql, url.c_str(), user.c_str(), passwd.c_str(),
+                                db_name.c_str(), port, NULL, 0))
+        {
+            LOG_ERROR("async sql: connect failed: %s", mysql_error(mysql));
+            mysql_close(mysql);
+            return false;
+        }
+
+        sql_conn c;
+        c.mysql = mysql;
+        c.fd = mysql_get_socket(mysql);
+        c.stage = IDLE;
+        c.events = 0;
+        c.req.arg = nullptr;
+        c.req.result = nullptr;
+        c.req.result_len = 0;
+        c.cancelled = false;
+
+        // 预处理语句在启动时同步创建，之后只需要非阻塞地执行
+        for (int j = 0; j < STMT_COUNT; j++)
+        {
+            c.stmts[j] = sql_prepare(mysql, (SQL_STATEMENT)j);
+            if (!c.stmts[j])
+            {
+                LOG_ERROR("async sql: prepare \"%s\" failed: %s", sql_statements[j], mysql_error(mysql));
+                for (int k = 0; k < j; k++)
+                    mysql_stmt_close(c.stmts[k]);
+                mysql_close(mysql);
+                return false;
+            }
+        }
+
+        // 空闲时不关注任何事件，EPOLLHUP、EPOLLERR仍会报告，用来发现服务端断开
+        epoll_event event;
+        event.data.fd = c.fd;
+        event.events = 0;
+        if (epoll_ctl(m_epollfd, EPOLL_CTL_ADD, c.fd, &event) < 0)
+        {
+            LOG_ERROR("async sql: epoll_ctl failed, errno is:%d", errno);
+            c.fd = -1;
+            drop(c);
+            return false;
+        }
+        m_conns.push_back(c);
+    }
+    return true;
+}
+
+bool async_sql::query(const char *sql, unsigned long len, void *arg)
+{
+    sql_request req;
+    req.stmt = -1;
+    req.sql.assign(sql, len);
+    req.arg = arg;
+    req.result = nullptr;
+    req.result_len = 0;
+    return submit(req);
+}
+
+bool async_sql::execute(SQL_STATEMENT id, const char *const *params, int count, void *arg,
+                        char *result, size_t result_len)
+{
+    if (count > MAX_PARAMS || (result && result_len == 0))
+        return false;
+    sql_request req;
+    req.stmt = id;
+    req.params.assign(params, params + count);
+    req.arg = arg;
+    req.result = result;
+    req.result_len = result_len;
+    return submit(req);
+}
+
+bool async_sql::submit(sql_request &req)
+{
+    sql_conn *idle = nullptr;
+    bool alive = false;
+    for (sql_conn &c : m_conns)
+    {
+        if (!c.mysql)
+            continue;
+        alive = true;
+        if (c.stage == IDLE)
+        {
+            idle = &c;
+            break;
+        }
+    }
+    if (!alive)
+        return false;
+
+    if (idle)
+        start(*idle, req);
+    else
+        m_waiting.push_back(std::move(req));
+    return true;
+}
+
+void async_sql::start(sql_conn &c, sql_request &req)
+{
+    c.req = std::move(req);
+    c.cancelled = false;
+    m_busy++;
+
+    int ret = 0;
+    int status;
+    if (c.req.stmt < 0)
+    {
+        c.stage = QUERY;
+        status = mysql_real_query_start(&ret, c.mysql, c.req.sql.c_str(), c.req.sql.size());
+        after_query(c, status, ret);
+        return;
+    }
+
+    // 参数指向c.req.params中的字符串，执行结束前不会改变
+    MYSQL_STMT *stmt = c.stmts[c.req.stmt];
+    const char *values[MAX_PARAMS];
+    int count = (int)c.req.params.size();
+    for (int i = 0; i < count; i++)
+        values[i] = c.req.params[i].c_str();
+    c.stage = EXECUTE;
+    if (!sql_bind_strings(stmt, c.bind, c.lengths, values, count))
+    {
+        finish(c, mysql_stmt_errno(stmt));
+        return;
+    }
+    if (c.req.result)
+    {
+        // m_conns不再扩容，绑定的地址在查询过程中不变
+        memset(&c.result, 0, sizeof(c.result));
+        c.result.buffer_type = MYSQL_TYPE_STRING;
+        c.result.buffer = c.result_buf;
+        c.result.buffer_length = sizeof(c.result_buf) - 1;
+        c.result.length = &c.result_len;
+        c.result.is_null = &c.result_null;
+        if (mysql_stmt_bind_result(stmt, &c.result) != 0)
+        {
+            finish(c, mysql_stmt_errno(stmt));
+            return;
+        }
+    }
+    status = mysql_stmt_execute_start(&ret, stmt);
+    after_execute(c, status, ret);
+}
+
+// socket就绪后继续当前阶段
+void async_sql::step(sql_conn &c, int wait)
+{
+    if (c.stage == QUERY)
+    {
+        int ret = 0;
+        int status = mysql_real_query_cont(&ret, c.mysql, wait);
+        after_query(c, status, ret);
+    }
+    else if (c.stage == STORE)
+    {
+        MYSQL_RES *res = nullptr;
+        int status = mysql_store_result_cont(&res, c.mysql, wait);
+        after_store(c, status, res);
+    }
+    else if (c.stage == EXECUTE)
+    {
+        int ret = 0;
+        int status = mysql_stmt_execute_cont(&ret, c.stmts[c.req.stmt], wait);
+        after_execute(c, status, ret);
+    }
+    else if (c.stage == FETCH)
+    {
+        int ret = 0;
+        int status = mysql_stmt_store_result_cont(&ret, c.stmts[c.req.stmt], wait);
+        after_fetch(c, status, ret);
+    }
+}
+
+void async_sql::after_execute(sql_conn &c, int status, int ret)
+{
+    if (status)
+    {
+        watch(c, status);
+        return;
+    }
+    if (ret || !c.req.result)
+    {
+        finish(c, ret ? mysql_stmt_errno(c.stmts[c.req.stmt]) : 0);
+        return;
+    }
+
+    // 有结果集的语句继续把结果集读到客户端
+    c.stage = FETCH;
+    status = mysql_stmt_store_result_start(&ret, c.stmts[c.req.stmt]);
+    after_fetch(c, status, ret);
+}
+
+// 结果集已经全部读到客户端，之后的mysql_stmt_fetch、mysql_stmt_free_result不再访问网络
+void async_sql::after_fetch(sql_conn &c, int status, int ret)
+{
+    if (status)
+    {
+        watch(c, status);
+        return;
+    }
+    MYSQL_STMT *stmt = c.stmts[c.req.stmt];
+    if (ret)
+    {
+        unsigned int err = mysql_stmt_errno(stmt);
+        mysql_stmt_free_result(stmt);
+        finish(c, err);
+        return;
+    }
+
+    unsigned int err = 0;
+    int fetch = mysql_stmt_fetch(stmt);
+    if (fetch == 0 || fetch == MYSQL_DATA_TRUNCATED)
+    {
+        size_t n = c.result_null ? 0 : (c.result_len < sizeof(c.result_buf) - 1 ? c.result_len : sizeof(c.result_buf) - 1);
+        c.result_buf[n] = '\0';
+    }
+    else
+        err = fetch == MYSQL_NO_DATA ? MYSQL_NO_DATA : mysql_stmt_errno(stmt);
+    mysql_stmt_free_result(stmt);
+    finish(c, err);
+}
+
+// status不为0表示还需要等待socket，否则语句已经执行完，开始读取结果集
+void async_sql::after_query(sql_conn &c, int status, int ret)
+{
+    if (status)
+    {
+        watch(c, status);
+        return;
+    }
+    if (ret)
+    {
+        finish(c, mysql_errno(c.mysql));
+        return;
+    }
+
+    c.stage = STORE;
+    MYSQL_RES *res = nullptr;
+    status = mysql_store_result_start(&res, c.mysql);
+    after_store(c, status, res);
+}
+
+void async_sql::after_store(sql_conn &c, int status, MYSQL_RES *res)
+{
+    if (status)
+    {
+        watch(c, status);
+        return;
+    }
+    // 目前只需要知道是否执行成功，结果集直接释放
+    // 没有结果集的语句返回nullptr且mysql_errno为0
+    if (res)
+        mysql_free_result(res);
+    finish(c, res ? 0 : mysql_errno(c.mysql));
+}
+
+// 按客户端库等待的条件修改epoll中关注的事件
+// 没有设置读写超时，不会出现只等待MYSQL_WAIT_TIMEOUT的情况
+void async_sql::watch(sql_conn &c, int status)
+{
+    uint32_t events = 0;
+    if (status & MYSQL_WAIT_READ)
+        events |= EPOLLIN;
+    if (status & MYSQL_WAIT_WRITE)
+        events |= EPOLLOUT;
+    if (status & MYSQL_WAIT_EXCEPT)
+        events |= EPOLLPRI;
+    if (events == c.events)
+        return;
+
+    epoll_event event;
+    event.data.fd = c.fd;
+    event.events = events;
+    epoll_ctl(m_epollfd, EPOLL_CTL_MOD, c.fd, &event);
+    c.events = events;
+}
+
+// 查询结束：连接先接手下一个排队的查询，再通知调用者
+// 回调中可能再次调用query，所以回调放在最后
+void async_sql::finish(sql_conn &c, unsigned int err)
+{
+    void *arg = c.req.arg;
+    bool cancelled = c.cancelled;
+    // 调用者取消后result可能已经属于别的请求，只在没有取消时复制结果
+    if (err == 0 && c.req.result && !cancelled)
+        snprintf(c.req.result, c.req.result_len, "%s", c.result_buf);
+    c.stage = IDLE;
+    c.req.arg = nullptr;
+    m_busy--;
+
+    if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST)
+    {
+        LOG_ERROR("async sql connection %d lost: %s", c.fd, mysql_error(c.mysql));
+        drop(c);
+    }
+    else if (!m_waiting.empty())
+    {
+        sql_request next = std::move(m_waiting.front());
+        m_waiting.pop_front();
+        start(c, next);
+    }
+    else
+        watch(c, 0);
+
+    // 所有连接都已断开，排队的查询不会再有结果
+    bool alive = false;
+    for (sql_conn &conn : m_conns)
+        alive = alive || conn.mysql;
+    if (!alive)
+    {
+        deque<sql_request> waiting;
+        waiting.swap(m_waiting);
+        for (sql_request &r : waiting)
+            m_callback(m_owner, r.arg, CR_SERVER_LOST);
+    }
+
+    if (!cancelled)
+        m_callback(m_owner, arg, err);
+}
+
+#else
+
+bool async_sql::init(int, const string &, const string &, const string &,
+                     const string &, int, int, int close_log)
+{
+    m_close_log = close_log;
+    LOG_ERROR("async sql: client library has no non-blocking API");
+    return false;
+}
+
+bool async_sql::query(const char *, unsigned long, void *)
+{
+    return false;
+}
+
+bool async_sql::execute(SQL_STATEMENT, const char *const *, int, void *, char *, size_t)
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef ASYNC_SQL_H
+#define ASYNC_SQL_H
+
+#include <mysql/mysql.h>
+#include <mysql/errmsg.h>
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "../log/log.h"
+#include "sql_statement.h"
+
+using namespace std;
+
+// MariaDB客户端库提供非阻塞接口（mysql_real_query_start/cont等）时会定义MYSQL_WAIT_READ
+// MySQL官方客户端库没有这组接口，此时async_sql不可用，仍然使用连接池同步访问
+#ifdef MYSQL_WAIT_READ
+#define ASYNC_SQL_ENABLED 1
+#else
+#define ASYNC_SQL_ENABLED 0
+#endif
+
+// 查询完成的回调，在事件循环线程中调用
+// owner为构造时传入的参数，arg为提交查询时传入的参数，err为0表示成功，否则为mysql_errno
+typedef void (*sql_callback)(void *owner, void *arg, unsigned int err);
+
+// 挂在一个事件循环上的非阻塞数据库连接组
+// 每个连接的socket注册到循环的epoll中，查询发出后立即返回，socket可读写时由循环调用handle_event继续，
+// 完成后通过回调通知，线程不会阻塞在数据库的网络往返上
+// 只在所属事件循环的线程中使用，不加锁
+class async_sql
+{
+public:
+    async_sql(sql_callback callback, void *owner);
+    ~async_sql();
+
+    // 建立conn_num个非阻塞连接并注册到epollfd，启动时调用，连接过程是同步的
+    bool init(int epollfd, const string &url, const string &user, const string &passwd,
+              const string &db_name, int port, int conn_num, int close_log);
+    // 提交一条语句，所有连接都在忙时排队；没有可用的连接时返回false，不会调用回调
+    bool query(const char *sql, unsigned long len, void *arg);
+    // 执行预处理语句，params为以'\0'结尾的字符串参数，提交时复制一份
+    // 每个连接在init时预先创建好所有预处理语句
+    // 有结果集的语句（如STMT_SELECT_USER）传入result：读取结果后把第一行的第一列复制到result，
+    // 超长时截断，没有结果行时err为MYSQL_NO_DATA；结果先读到连接自己的缓冲区，取消后不会再写入result
+    bool execute(SQL_STATEMENT id, const char *const *params, int count, void *arg,
+                 char *result = nullptr, size_t result_len = 0);
+    // 取消arg还没有完成的查询，之后不会再为它调用回调（语句本身仍可能已经执行）
+    void cancel(void *arg);
+    // fd属于本连接组时处理事件并返回true，否则返回false
+    bool handle_event(int fd, uint32_t events);
+
+    static bool available() { return ASYNC_SQL_ENABLED; }
+    int busy() const { return m_busy; }                   // 正在执行的查询数
+    int waiting() const { return (int)m_waiting.size(); } // 排队等待连接的查询数
+
+private:
+    static const int MAX_PARAMS = 4;
+
+    // 一个查询依次经过发送语句、读取结果两个阶段；预处理语句只有执行一个阶段
+    enum STAGE
+    {
+        IDLE = 0,
+        QUERY,  // mysql_real_query_start/cont
+        STORE,  // mysql_store_result_start/cont，INSERT等没有结果集的语句会立即完成
+        EXECUTE, // mysql_stmt_execute_start/cont
+        FETCH    // mysql_stmt_store_result_start/cont，读取预处理语句的结果集
+    };
+
+    struct sql_request
+    {
+        int stmt;          // SQL_STATEMENT，-1表示sql中的普通语句
+        string sql;
+        vector<string> params;
+        void *arg;
+        char *result;      // 有结果集时结果的复制目标，否则为空
+        size_t result_len;
+    };
+
+    struct sql_conn
+    {
+        MYSQL *mysql;
+        int fd;
+        STAGE stage;
+        uint32_t events;   // 当前在epoll中关注的事件
+        sql_request req;   // 语句和参数在整个查询过程中必须保持有效
+        bool cancelled;
+        MYSQL_STMT *stmts[STMT_COUNT];
+        MYSQL_BIND bind[MAX_PARAMS];
+        unsigned long lengths[MAX_PARAMS];
+        MYSQL_BIND result;  // 结果集第一列的绑定，指向以下成员，每次执行前重新绑定
+        char result_buf[128];
+        unsigned long result_len;
+        sql_bool result_null;
+    };
+
+    bool submit(sql_request &req);
+    void start(sql_conn &c, sql_request &req);
+    void step(sql_conn &c, int wait);
+    void after_execute(sql_conn &c, int status, int ret);
+    void after_fetch(sql_conn &c, int status, int ret);
+    void after_query(sql_conn &c, int status, int ret);
+    void after_store(sql_conn &c, int status, MYSQL_RES *res);
+    void finish(sql_conn &c, unsigned int err);
+    void watch(sql_conn &c, int status);
+    void drop(sql_conn &c);
+
+private:
+    sql_callback m_callback;
+    void *m_owner;
+    int m_epollfd;
+    vector<sql_conn> m_conns;
+    deque<sql_request> m_waiting;
+    int m_busy;
+    int m_close_log;
+};
+
+#endif
@@ -0,0 +1,348 @@
+#define LOG_MODULE LOG_MOD_SQL // 本文件的日志属于sql模块，要在包含log.h之前定义
+#include <mysql/mysqld_error.h>
+#include <mysql/errmsg.h>
+#include <string.h>
+#include <time.h>
+#include <unordered_set>
+
+#include "register_queue.h"
+
+register_queue::register_queue()
+{
+    m_pool = nullptr;
+    m_con = nullptr;
+    m_batch_size = 1;
+    m_flush_ms = 0;
+    m_ack = ACK_COMMIT;
+    m_max_pending = 0;
+    m_close_log = 0;
+    m_running = false;
+    m_stop = false;
+    m_next_ticket = 1;
+}
+
+register_queue::~register_queue()
+{
+    stop();
+}
+
+bool register_queue::init(connection_pool *pool, int batch_size, int flush_ms, REGISTER_ACK ack,
+                          int max_pending, int close_log)
+{
+    if (m_running || !pool || batch_size < 1 || flush_ms < 0 || max_pending < batch_size)
+        return false;
+    m_pool = pool;
+    m_batch_size = batch_size;
+    m_flush_ms = flush_ms;
+    m_ack = ack;
+    m_max_pending = max_pending;
+    m_close_log = close_log;
+    m_stop = false;
+    if (pthread_create(&m_tid, NULL, worker, this) != 0)
+        return false;
+    m_running = true;
+    return true;
+}
+
+void register_queue::stop()
+{
+    if (!m_running)
+        return;
+    m_lock.lock();
+    m_stop = true;
+    m_cond.broadcast();
+    m_lock.unlock();
+    pthread_join(m_tid, NULL);
+    m_running = false;
+}
+
+// 调用者持有m_lock
+bool register_queue::enqueue(entry &e)
+{
+    if (!m_running || m_stop || m_queue.size() >= m_max_pending)
+        return false;
+    clock_gettime(CLOCK_REALTIME, &e.queued);
+    m_queue.push_back(std::move(e));
+    // 队列由空变为非空时写入线程开始计时，达到批量大小时立即写入
+    if (m_queue.size() == 1 || m_queue.size() == (size_t)m_batch_size)
+        m_cond.signal();
+    return true;
+}
+
+unsigned int register_queue::add(const char *name, const char *passwd)
+{
+    entry e;
+    e.name = name;
+    e.passwd = passwd;
+    e.acked = false;
+    e.w = nullptr;
+    e.callback = nullptr;
+    e.ticket = 0;
+    e.err = 0;
+
+    m_lock.lock();
+    if (m_ack == ACK_ENQUEUE)
+    {
+        if (!m_running || m_stop || m_queue.size() >= m_max_pending)
+        {
+            m_lock.unlock();
+            return ERR_BUSY;
+        }
+        // 先在user_cache中占用用户名，之后的重名检查以user_cache为准
+        if (!user_cache::get_instance()->insert(name, passwd))
+        {
+            m_lock.unlock();
+            return ER_DUP_ENTRY;
+        }
+        e.acked = true;
+        enqueue(e);
+        m_lock.unlock();
+        return 0;
+    }
+
+    waiter w;
+    w.done = false;
+    w.err = 0;
+    e.w = &w;
+    if (!enqueue(e))
+    {
+        m_lock.unlock();
+        return ERR_BUSY;
+    }
+    while (!w.done)
+        m_done.wait(m_lock.get());
+    m_lock.unlock();
+    return w.err;
+}
+
+uint64_t register_queue::add_async(const char *name, const char *passwd, register_callback callback,
+                                   void *owner, void *arg)
+{
+    if (m_ack != ACK_COMMIT)
+        return 0;
+    entry e;
+    e.name = name;
+    e.passwd = passwd;
+    e.acked = false;
+    e.w = nullptr;
+    e.callback = callback;
+    e.owner = owner;
+    e.arg = arg;
+    e.err = 0;
+
+    m_lock.lock();
+    e.ticket = m_next_ticket++;
+    uint64_t ticket = e.ticket;
+    if (!enqueue(e))
+        ticket = 0;
+    m_lock.unlock();
+    return ticket;
+}
+
+void *register_queue::worker(void *arg)
+{
+    register_queue *queue = (register_queue *)arg;
+    queue->run();
+    return nullptr;
+}
+
+void register_queue::run()
+{
+    struct timespec retry = {0, 0}; // 数据库不可用时，到这个时间之前不再重试
+    vector<entry> batch;
+    // 启动时就取出连接，不与之后处理请求的线程竞争
+    m_con = m_pool->GetConnection();
+    m_lock.lock();
+    while (true)
+    {
+        if (m_queue.empty())
+        {
+            if (m_stop)
+                break;
+            m_cond.wait(m_lock.get());
+            continue;
+        }
+
+        // 不足一批时等到最早的一条到期，停止时不再等待
+        if (!m_stop)
+        {
+            struct timespec deadline = m_queue.front().queued;
+            deadline.tv_sec += m_flush_ms / 1000;
+            deadline.tv_nsec += (m_flush_ms % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L)
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            if (m_queue.size() >= (size_t)m_batch_size ||
+                (retry.tv_sec > deadline.tv_sec || (retry.tv_sec == deadline.tv_sec && retry.tv_nsec > deadline.tv_nsec)))
+                deadline = retry;
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            if (now.tv_sec < deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec < deadline.tv_nsec))
+            {
+                m_cond.timewait(m_lock.get(), deadline);
+                continue;
+            }
+        }
+
+        batch.clear();
+        while (!m_queue.empty() && batch.size() < (size_t)m_batch_size)
+        {
+            batch.push_back(std::move(m_queue.front()));
+            m_queue.pop_front();
+        }
+        m_lock.unlock();
+
+        write_batch(batch);
+        complete(batch);
+
+        // 已经应答的注册因数据库不可用没有写入，放回队首稍后重试
+        m_lock.lock();
+        bool failed = false;
+        for (size_t i = batch.size(); i-- > 0;)
+        {
+            entry &e = batch[i];
+            if (!e.acked || e.err == 0 || e.err == ER_DUP_ENTRY)
+                continue;
+            if (m_stop)
+            {
+                LOG_ERROR("register queue: stopped, user %s is lost", e.name.c_str());
+                continue;
+            }
+            m_queue.push_front(std::move(e));
+            failed = true;
+        }
+        if (failed)
+        {
+            clock_gettime(CLOCK_REALTIME, &retry);
+            retry.tv_sec += m_flush_ms / 1000 + 1;
+        }
+    }
+    m_lock.unlock();
+
+    if (m_con)
+        m_pool->ReleaseConnection(m_con);
+    m_con = nullptr;
+}
+
+// 把一批注册写入数据库，结果写入各条目的err
+void register_queue::write_batch(vector<entry> &batch)
+{
+    user_cache *cache = user_cache::get_instance();
+
+    // 写入前排除重名：已经应答的条目在user_cache中占用了用户名，不会与其他条目重名
+    vector<entry *> rows;
+    unordered_set<string> names;
+    for (entry &e : batch)
+    {
+        e.err = 0;
+        if (!e.acked && cache->find(e.name.c_str()))
+            e.err = ER_DUP_ENTRY;
+        else if (!names.insert(e.name).second)
+            e.err = ER_DUP_ENTRY;
+        else
+            rows.push_back(&e);
+    }
+    if (rows.empty())
+        return;
+
+    // 写入线程一直占用连接池中的一个连接，线程池模式下等待提交的工作线程即使占满了其余的连接，
+    // 写入也不会因为取不到连接而超时；写入失败时放回，重新取出时由连接池检查连接是否可用
+    if (!m_con)
+        m_con = m_pool->GetConnection();
+    MYSQL *con = m_con;
+    unsigned int err = CR_SERVER_GONE_ERROR;
+    if (con)
+    {
+        // 一条多行INSERT，一次往返、一次提交；用户名和密码用mysql_real_escape_string转义
+        string sql = "INSERT INTO user(username, passwd) VALUES";
+        vector<char> buf;
+        for (size_t i = 0; i < rows.size(); i++)
+        {
+            const string *values[2] = {&rows[i]->name, &rows[i]->passwd};
+            sql += i ? ",(" : "(";
+            for (int j = 0; j < 2; j++)
+            {
+                buf.resize(values[j]->size() * 2 + 1);
+                unsigned long len = mysql_real_escape_string(con, buf.data(), values[j]->data(), values[j]->size());
+                sql += j ? ",'" : "'";
+                sql.append(buf.data(), len);
+                sql += "'";
+            }
+            sql += ")";
+        }
+        err = mysql_real_query(con, sql.data(), sql.size()) == 0 ? 0 : mysql_errno(con);
+
+        // 多行INSERT是一条语句，重名时整条回滚，改为逐行写入，只有重名的那几条失败
+        if (err == ER_DUP_ENTRY)
+        {
+            MYSQL_STMT *stmt = m_pool->GetStatement(con, STMT_INSERT_USER);
+            for (entry *e : rows)
+                e->err = stmt ? sql_insert_user(stmt, e->name.c_str(), e->passwd.c_str()) : CR_SERVER_GONE_ERROR;
+        }
+        else
+        {
+            for (entry *e : rows)
+                e->err = err;
+        }
+    }
+    else
+    {
+        for (entry *e : rows)
+            e->err = err;
+    }
+
+    int failed = 0;
+    for (entry *e : rows)
+    {
+        if (e->err == 0 && !e->acked)
+            cache->insert(e->name.c_str(), e->passwd.c_str());
+        else if (e->err == ER_DUP_ENTRY && e->acked)
+        {
+            // 已经应答成功，但数据库中早有这个用户（如其他服务进程注册的）：
+            // user_cache中是这次注册的密码，换回数据库中的密码，否则原用户无法登录，新注册者反而可以登录
+            LOG_ERROR("register queue: user %s already exists in database", e->name.c_str());
+            char db_password[100];
+            MYSQL_STMT *stmt = m_pool->GetStatement(con, STMT_SELECT_USER);
+            if (stmt && sql_select_user(stmt, e->name.c_str(), db_password, sizeof(db_password)) == 1)
+                cache->insert(e->name.c_str(), db_password, true);
+            else
+                LOG_ERROR("register queue: reload password of user %s failed", e->name.c_str());
+        }
+        else if (e->err && e->err != ER_DUP_ENTRY)
+            failed++;
+    }
+    if (failed)
+    {
+        LOG_ERROR("register queue: write %d users failed, error %u", failed, err);
+        if (m_con)
+            m_pool->ReleaseConnection(m_con);
+        m_con = nullptr;
+    }
+}
+
+// 通知等待结果的调用者，已经应答的条目不再通知
+void register_queue::complete(vector<entry> &batch)
+{
+    bool wake = false;
+    m_lock.lock();
+    for (entry &e : batch)
+    {
+        if (e.w)
+        {
+            e.w->err = e.err;
+            e.w->done = true;
+            wake = true;
+        }
+    }
+    if (wake)
+        m_done.broadcast();
+    m_lock.unlock();
+
+    for (entry &e : batch)
+    {
+        if (e.callback)
+            e.callback(e.owner, e.arg, e.ticket, e.err);
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef REGISTER_QUEUE_H
+#define REGISTER_QUEUE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "sql_connection_pool.h"
+#include "user_cache.h"
+
+using namespace std;
+
+// 注册完成的回调，在写入线程中调用
+// owner、arg为提交时传入的参数，ticket为add_async的返回值，err为0表示成功，重名时为ER_DUP_ENTRY
+typedef void (*register_callback)(void *owner, void *arg, uint64_t ticket, unsigned int err);
+
+// 注册的应答时机
+enum REGISTER_ACK
+{
+    ACK_COMMIT = 0, // 所在的批次提交后才返回结果
+    ACK_ENQUEUE     // 放入队列就返回成功，进程在写入前退出或数据库一直不可用时会丢失
+                    // 重名只按user_cache判断：数据库中已有而user_cache中没有的用户名也会先返回成功，
+                    // 写入时才发现重名，这次注册作废，user_cache改回数据库中的密码
+};
+
+// 注册的写入队列（write-behind）
+// 注册请求先放入队列，由一个写入线程攒成一条多行INSERT写入数据库，
+// 队列中达到batch_size条或者最早的一条已等待flush_ms毫秒时写入
+// 重名检查：同一批次中的重名、已在user_cache中的用户名在写入前直接判为重名；
+// 多行INSERT因重名失败时改为逐行执行预处理语句，找出真正重名的那几条
+class register_queue
+{
+public:
+    static register_queue *get_instance()
+    {
+        static register_queue instance;
+        return &instance;
+    }
+
+    static const unsigned int ERR_BUSY = 1; // 队列已满或没有启动
+
+    // 启动写入线程，只能调用一次；队列中最多max_pending条，超过时新的注册直接失败
+    bool init(connection_pool *pool, int batch_size, int flush_ms, REGISTER_ACK ack,
+              int max_pending, int close_log);
+    // 写完队列中剩余的注册后停止写入线程，要在使用回调的事件循环销毁前调用
+    void stop();
+    bool running() const { return m_running; }
+    REGISTER_ACK ack_mode() const { return m_ack; }
+
+    // 提交注册，ACK_COMMIT模式下阻塞到所在批次提交，ACK_ENQUEUE模式下放入队列即返回
+    // 成功返回0，否则返回错误码
+    unsigned int add(const char *name, const char *passwd);
+    // 只用于ACK_COMMIT模式：提交后立即返回票据，结果通过callback通知；队列已满或没有启动时返回0
+    uint64_t add_async(const char *name, const char *passwd, register_callback callback,
+                       void *owner, void *arg);
+
+private:
+    register_queue();
+    ~register_queue();
+
+    // 阻塞提交的调用者在m_done上等待
+    struct waiter
+    {
+        bool done;
+        unsigned int err;
+    };
+
+    struct entry
+    {
+        string name;
+        string passwd;
+        bool acked;        // ACK_ENQUEUE模式下已经应答，用户名已放入user_cache
+        waiter *w;         // 阻塞提交的调用者，可以为空
+        register_callback callback;
+        void *owner;
+        void *arg;
+        uint64_t ticket;
+        unsigned int err;  // 写入结果
+        struct timespec queued;
+    };
+
+    static void *worker(void *arg);
+    void run();
+    bool enqueue(entry &e);
+    void write_batch(vector<entry> &batch);
+    void complete(vector<entry> &batch);
+
+private:
+    connection_pool *m_pool;
+    MYSQL *m_con;          // 写入线程占用的连接，只在写入线程中访问
+    int m_batch_size;
+    int m_flush_ms;
+    REGISTER_ACK m_ack;
+    size_t m_max_pending;
+    int m_close_log;
+
+    pthread_t m_tid;
+    bool m_running;
+    bool m_stop;
+    locker m_lock;         // 保护以下成员
+    cond m_cond;           // 通知写入线程
+    cond m_done;           // 通知阻塞提交的调用者
+    deque<entry> m_queue;
+    uint64_t m_next_ticket;
+};
+
+#endif
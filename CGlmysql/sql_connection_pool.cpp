@@ -1,4 +1,11 @@
+#define LOG_MODULE LOG_MOD_SQL // 本文件的日志属于sql模块，要在包含log.h之前定义
 #include <mysql/mysql.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <string>
 #include "sql_connection_pool.h"
 
@@ -7,8 +14,27 @@ using namespace std;
 connection_pool::connection_pool()
 {
     // 将当前连接数和空闲连接数设为0
+    m_idle = 0;
+    m_empty = 0;
+    m_seq = 0;
+    m_waiters = 0;
+    m_destroyed = false;
     m_CurConn = 0;
     m_FreeConn = 0;
+    m_TotalConn = 0;
+    m_MaxConn = 0;
+    m_MinConn = 0;
+    m_IdleTimeout = 60;
+    m_PingInterval = 5;
+    m_WaitTimeout = 3000;
+    m_close_log = 0;
+    m_checkouts = 0;
+    m_timeouts = 0;
+    m_created = 0;
+    m_reaped = 0;
+    m_reconnects = 0;
+    m_wait_us = 0;
+    m_max_wait_us = 0;
 }
 
 connection_pool::~connection_pool()
@@ -16,26 +42,226 @@ connection_pool::~connection_pool()
     DestroyPool();
 }
 
-// 当有请求时，从数据库连接池中返回一个可用连接，更新使用和空闲连接数
-MYSQL *connection_pool::GetConnection()
+static long long now_us()
 {
-    MYSQL *con = nullptr; // 声明一个MYSQL指针用于存储获取到的连接
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// 在addr上等待，*addr仍等于val时睡眠，最多timeout_us微秒
+static void futex_wait(atomic<uint32_t> *addr, uint32_t val, long long timeout_us)
+{
+    struct timespec ts;
+    ts.tv_sec = timeout_us / 1000000;
+    ts.tv_nsec = (timeout_us % 1000000) * 1000;
+    syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT_PRIVATE, val, &ts, NULL, 0);
+}
+
+static void futex_wake(atomic<uint32_t> *addr, int count)
+{
+    syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+// 弹出栈顶的槽，栈为空时返回-1
+int connection_pool::Pop(atomic<uint64_t> &head)
+{
+    uint64_t old = head.load(memory_order_acquire);
+    while (true)
+    {
+        uint32_t top = (uint32_t)old;
+        if (top == 0)
+            return -1;
+        // 槽不会被释放，即使这时已被其他线程弹出，读到的next也只会让下面的CAS失败
+        uint32_t next = m_slots[top - 1].next.load(memory_order_relaxed);
+        uint64_t tagged = (((old >> 32) + 1) << 32) | next;
+        if (head.compare_exchange_weak(old, tagged, memory_order_acq_rel, memory_order_acquire))
+            return top - 1;
+    }
+}
 
-    if (connList.size() == 0) // 判断连接池中是否有可用连接
+void connection_pool::Push(atomic<uint64_t> &head, int idx)
+{
+    uint64_t old = head.load(memory_order_relaxed);
+    uint64_t tagged;
+    do
+    {
+        m_slots[idx].next.store((uint32_t)old, memory_order_relaxed);
+        tagged = (((old >> 32) + 1) << 32) | (uint32_t)(idx + 1);
+    } while (!head.compare_exchange_weak(old, tagged, memory_order_release, memory_order_relaxed));
+}
+
+// 先改m_seq再检查m_waiters，等待方先登记m_waiters再在m_seq上等待，两边都是seq_cst，不会漏掉唤醒
+void connection_pool::Notify()
+{
+    m_seq.fetch_add(1);
+    if (m_waiters.load() > 0)
+        futex_wake(&m_seq, 1);
+}
+
+// 放回连接时找到它所在的槽，同一个线程通常放回的就是上次取出的连接，先检查上次的槽
+int connection_pool::FindSlot(MYSQL *con)
+{
+    static thread_local int hint = 0;
+    int n = (int)m_slots.size();
+    if (hint < n && m_slots[hint].conn.load(memory_order_acquire) == con)
+        return hint;
+    for (int i = 0; i < n; i++)
+    {
+        if (m_slots[i].conn.load(memory_order_acquire) == con)
+        {
+            hint = i;
+            return i;
+        }
+    }
+    return -1;
+}
+
+// 建立到MySQL数据库的真实连接，连接过程不影响其他线程取放连接
+MYSQL *connection_pool::Connect()
+{
+    MYSQL *con = mysql_init(nullptr); // 初始化MYSQL对象
+    if (con == nullptr)
+    {
+        LOG_ERROR("MYSQL Error: mysql_init failed");
         return nullptr;
+    }
 
-    reverse.wait(); // 使用信号类，等待可用连接
+    // 数据库不可用时不要让取连接的线程长时间卡在建立连接上
+    unsigned int timeout = 3;
+    mysql_options(con, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
 
-    lock.lock(); // 加锁，确保线程安全
+    if (mysql_real_connect(con, m_url.c_str(), m_User.c_str(), m_PassWord.c_str(),
+                           m_DatabaseName.c_str(), m_Port, NULL, 0) == nullptr)
+    {
+        LOG_ERROR("MYSQL Error: %s", mysql_error(con));
+        mysql_close(con);
+        return nullptr;
+    }
+    return con;
+}
 
-    con = connList.front(); // 获取连接池中的第一个连接
-    connList.pop_front();   // 移除
+void connection_pool::Close(slot &s)
+{
+    for (int i = 0; i < STMT_COUNT; i++)
+    {
+        if (s.stmts[i])
+        {
+            mysql_stmt_close(s.stmts[i]);
+            s.stmts[i] = nullptr;
+        }
+    }
+    // 先把槽清空再关闭：mysql_close释放后同一地址可能马上被其他线程新建的连接复用，
+    // 槽里留着旧指针时FindSlot会把新连接错认成这个槽
+    MYSQL *con = s.conn.exchange(nullptr, memory_order_release);
+    if (con)
+        mysql_close(con);
+}
+
+MYSQL_STMT *connection_pool::GetStatement(MYSQL *con, SQL_STATEMENT id)
+{
+    int idx = FindSlot(con);
+    if (idx < 0)
+        return nullptr;
+    slot &s = m_slots[idx];
+    if (!s.stmts[id])
+    {
+        s.stmts[id] = sql_prepare(con, id);
+        if (!s.stmts[id])
+            LOG_ERROR("MYSQL Error: prepare \"%s\" failed: %s", sql_statements[id], mysql_error(con));
+    }
+    return s.stmts[id];
+}
 
-    --m_FreeConn; // 空闲连接数-1
-    ++m_CurConn;  // 当前连接数+1
+// 取到槽之后：空槽新建连接，空闲较久的连接先mysql_ping检查，失效则重新连接
+// 失败时槽回到空槽栈，返回nullptr
+MYSQL *connection_pool::Checkout(int idx, bool create)
+{
+    slot &s = m_slots[idx];
+    MYSQL *con = s.conn.load(memory_order_relaxed);
+    if (create)
+    {
+        con = Connect();
+        if (con)
+            m_created.fetch_add(1, memory_order_relaxed);
+    }
+    else if (time(NULL) - s.since >= m_PingInterval && mysql_ping(con) != 0)
+    {
+        // 连接已经失效（如被服务端按wait_timeout断开），换一个新连接
+        LOG_ERROR("MYSQL Error: connection lost, reconnect");
+        Close(s); // 旧连接上的预处理语句一起失效
+        con = Connect();
+        if (con)
+            m_reconnects.fetch_add(1, memory_order_relaxed);
+    }
+    s.conn.store(con, memory_order_relaxed);
 
-    lock.unlock(); // 解锁
+    if (con == nullptr)
+    {
+        // 归还名额，让等待的线程自己去尝试建立连接
+        m_CurConn--;
+        m_TotalConn--;
+        Push(m_empty, idx);
+        Notify();
+    }
+    return con;
+}
 
+// 当有请求时，从数据库连接池中返回一个可用连接，更新使用和空闲连接数
+// 优先取最近放回的空闲连接；没有时取一个空槽新建连接；都没有时等待其他线程放回，最多等待m_WaitTimeout毫秒
+MYSQL *connection_pool::GetConnection()
+{
+    long long start = now_us();
+    long long deadline = start + m_WaitTimeout * 1000LL;
+    MYSQL *con = nullptr; // 声明一个MYSQL指针用于存储获取到的连接
+
+    while (!m_destroyed.load(memory_order_relaxed))
+    {
+        // 先记下m_seq，之后有槽放回时m_seq会变，futex_wait不会睡过去
+        uint32_t seq = m_seq.load();
+        int idx = Pop(m_idle);
+        bool create = false;
+        if (idx < 0)
+        {
+            idx = Pop(m_empty);
+            create = true;
+        }
+
+        if (idx >= 0)
+        {
+            m_CurConn++; // 当前连接数+1
+            if (create)
+                m_TotalConn++;
+            else
+                m_FreeConn--; // 空闲连接数-1
+            con = Checkout(idx, create);
+            break;
+        }
+
+        long long now = now_us();
+        if (now >= deadline)
+        {
+            LOG_ERROR("MYSQL Error: wait for connection timeout");
+            break;
+        }
+        m_waiters++;
+        futex_wait(&m_seq, seq, deadline - now);
+        m_waiters--;
+    }
+
+    if (con == nullptr)
+    {
+        m_timeouts.fetch_add(1, memory_order_relaxed);
+        return nullptr;
+    }
+
+    long long wait = now_us() - start;
+    m_checkouts.fetch_add(1, memory_order_relaxed);
+    m_wait_us.fetch_add(wait, memory_order_relaxed);
+    long long max_wait = m_max_wait_us.load(memory_order_relaxed);
+    while (wait > max_wait && !m_max_wait_us.compare_exchange_weak(max_wait, wait, memory_order_relaxed))
+    {
+    }
     return con; // 返回得到的连接地址
 }
 
@@ -44,16 +270,25 @@ bool connection_pool::ReleaseConnection(MYSQL *con)
 {
     if (con == nullptr)
         return false;
+    int idx = FindSlot(con);
+    if (idx < 0)
+        return false;
 
-    lock.lock();
-
-    connList.push_back(con);
-    ++m_FreeConn;
-    --m_CurConn;
-
-    lock.unlock();
-
-    reverse.post();
+    m_CurConn--;
+    if (m_destroyed.load(memory_order_relaxed))
+    {
+        // 连接池已经销毁，不再保留
+        Close(m_slots[idx]);
+        m_TotalConn--;
+        Push(m_empty, idx);
+    }
+    else
+    {
+        m_slots[idx].since = time(NULL);
+        m_FreeConn++;
+        Push(m_idle, idx);
+    }
+    Notify();
     return true;
 }
 
@@ -63,23 +298,81 @@ int connection_pool::GetFreeConn()
     return this->m_FreeConn;
 }
 
+// 持有lock时调用：关闭栈底空闲超过m_IdleTimeout秒的连接，最多减少到m_MinConn个
+// 栈不支持从栈底取出，这里把空闲栈整个弹出再按原顺序压回，期间取连接的线程最多短暂地新建连接或等待
+void connection_pool::ReapIdle()
+{
+    vector<int> idle; // idle[0]为栈顶
+    int idx;
+    while ((idx = Pop(m_idle)) >= 0)
+        idle.push_back(idx);
+    if (idle.empty())
+        return;
+
+    time_t now = time(NULL);
+    int keep = (int)idle.size();
+    while (keep > 0 && m_TotalConn.load() - ((int)idle.size() - keep) > m_MinConn &&
+           now - m_slots[idle[keep - 1]].since >= m_IdleTimeout)
+        keep--;
+
+    // 留下的连接先放回，再关闭其余的连接（需要与服务端通信）
+    for (int i = keep - 1; i >= 0; i--)
+        Push(m_idle, idle[i]);
+    Notify();
+    for (int i = keep; i < (int)idle.size(); i++)
+    {
+        Close(m_slots[idle[i]]);
+        m_FreeConn--;
+        m_TotalConn--;
+        m_reaped.fetch_add(1, memory_order_relaxed);
+        Push(m_empty, idle[i]);
+    }
+    if (keep < (int)idle.size())
+        Notify();
+}
+
+// 获取统计信息，同时回收空闲太久的连接（没有请求时也能由定时统计触发回收）
+connection_pool::stats connection_pool::GetStats()
+{
+    lock.lock();
+    if (!m_destroyed.load())
+        ReapIdle();
+    lock.unlock();
+
+    stats st;
+    st.total = m_TotalConn;
+    st.busy = m_CurConn;
+    st.idle = m_FreeConn;
+    st.max = m_MaxConn;
+    st.checkouts = m_checkouts.exchange(0, memory_order_relaxed);
+    st.timeouts = m_timeouts.exchange(0, memory_order_relaxed);
+    st.created = m_created.exchange(0, memory_order_relaxed);
+    st.reaped = m_reaped.exchange(0, memory_order_relaxed);
+    st.reconnects = m_reconnects.exchange(0, memory_order_relaxed);
+    st.wait_us = m_wait_us.exchange(0, memory_order_relaxed);
+    st.max_wait_us = m_max_wait_us.exchange(0, memory_order_relaxed);
+    return st;
+}
+
 // 销毁数据库连接池
+// 正在使用的连接在放回时关闭，之后GetConnection直接返回nullptr
 void connection_pool::DestroyPool()
 {
     lock.lock();
-    if (connList.size() > 0)
+    m_destroyed = true;
+    int idx;
+    while ((idx = Pop(m_idle)) >= 0)
     {
-        list<MYSQL *>::iterator it;
-        for (it = connList.begin(); it != connList.end(); it++)
-        {
-            MYSQL *con = *it; // 获取当前迭代器指向的连接
-            mysql_close(con); // 关闭数据库连接
-        }
-        m_CurConn = 0;
-        m_FreeConn = 0;
-        connList.clear();
+        Close(m_slots[idx]); // 关闭数据库连接
+        m_FreeConn--;
+        m_TotalConn--;
+        Push(m_empty, idx);
     }
     lock.unlock();
+
+    // 唤醒所有等待的线程，让它们看到m_destroyed
+    m_seq.fetch_add(1);
+    futex_wake(&m_seq, INT32_MAX);
 }
 
 // 获取单例对象的实例
@@ -93,9 +386,10 @@ connection_pool *connection_pool::GetInstance()
     return &connPool; // 每次返回的都是同一个实例指针
 }
 
-void connection_pool::init(string url, string User,
+bool connection_pool::init(string url, string User,
                            string Passward, string DataBaseName,
-                           int Port, int MaxConn, int close_log)
+                           int Port, int MaxConn, int close_log,
+                           int MinConn, int idle_timeout, int ping_interval, int wait_timeout_ms)
 {
     // 初始化类的成员变量
     m_url = url;
@@ -104,44 +398,51 @@ void connection_pool::init(string url, string User,
     m_PassWord = Passward;
     m_DatabaseName = DataBaseName;
     m_close_log = close_log;
+    m_MaxConn = MaxConn;
+    m_MinConn = MinConn < 0 ? 0 : (MinConn > MaxConn ? MaxConn : MinConn);
+    m_IdleTimeout = idle_timeout;
+    m_PingInterval = ping_interval;
+    m_WaitTimeout = wait_timeout_ms;
 
-    // 循环创建MaxConn个数据库连接
-    for (int i = 0; i < MaxConn; i++)
+    // 一次分配好所有的槽，之后取放连接都不再分配内存
+    m_slots = vector<slot>(m_MaxConn);
+    for (int i = m_MaxConn - 1; i >= 0; i--)
     {
-        MYSQL *con = nullptr;
-        con = mysql_init(con); // 初始化MYSQL对象
-
-        // 如果初始化错误
-        if (con == nullptr)
-        {
-            LOG_ERROR("MYSQL Error"); // 记录一个错误日志
-            exit(1);                  // 以错误状态退出程序
-        }
-
-        // 建立到MySQL数据库的真实连接
-        // mysql_real_connect()函数连接到MySQL数据库
-        con = mysql_real_connect(con, url.c_str(), User.c_str(), Passward.c_str(),
-                                 DataBaseName.c_str(), Port, NULL, 0);
+        m_slots[i].conn = nullptr;
+        memset(m_slots[i].stmts, 0, sizeof(m_slots[i].stmts));
+        m_slots[i].since = 0;
+        Push(m_empty, i);
+    }
 
-        // 连接错误返回空指针，检测是否连接出现错误
+    // 只预先建立m_MinConn个连接，其余在需要时再建立
+    // 数据库暂时不可用时不退出程序，之后取连接时会再尝试
+    time_t now = time(NULL);
+    for (int i = 0; i < m_MinConn; i++)
+    {
+        MYSQL *con = Connect();
         if (con == nullptr)
-        {
-            LOG_ERROR("MYSQL Error"); // 记录一个错误日志
-            exit(1);                  // 以错误状态退出程序
-        }
-        connList.push_back(con); // 将连接对象添加到连接列表中
-        m_FreeConn++;            // 空闲连接数自增
+            break;
+        int idx = Pop(m_empty);
+        m_slots[idx].conn = con;
+        m_slots[idx].since = now;
+        m_TotalConn++;
+        m_FreeConn++; // 空闲连接数自增
+        Push(m_idle, idx);
     }
 
-    reserve = sem(m_FreeConn); // 使用sem构造函数创建一个sem实例给reserve
-
-    m_MaxConn = m_FreeConn; // 将最大连接数设置为当前空闲连接数
+    if (m_MinConn > 0 && m_TotalConn == 0)
+    {
+        LOG_ERROR("MYSQL Error: no connection to %s:%d", m_url.c_str(), m_Port);
+        return false;
+    }
+    return true;
 }
 
 connectionRAII::connectionRAII(MYSQL **SQL, connection_pool *connPool)
 {
     *SQL = connPool ->GetConnection(); // 获取连接池中的一个指针，并将该连接的指针赋给SQL指向的指针
 
+    sqlRAII = SQL;
     connRAII = *SQL; // 初始化需要管理的数据库连接对象
     poolRAII = connPool;// 初始化需要管理的连接池对象
 }
@@ -149,4 +450,6 @@ connectionRAII::connectionRAII(MYSQL **SQL, connection_pool *connPool)
 connectionRAII::~connectionRAII()
 {
     poolRAII->ReleaseConnection(connRAII); // 释放该连接池的数据库连接对象
+    // 连接已经还给连接池，可能马上被其他线程取走；之后再使用*SQL的代码必须重新获取连接
+    *sqlRAII = nullptr;
 }
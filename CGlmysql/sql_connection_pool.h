@@ -2,9 +2,13 @@
 #define _CONNECTION_POOL_
 
 #include <mysql/mysql.h>
-#include <list>
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
 #include <string>
+#include <vector>
 #include "../lock/locker.h"
+#include "sql_statement.h"
 #include "../log/log.h"
 
 using namespace std;
@@ -12,41 +16,106 @@ using namespace std;
 class connection_pool
 {
 public:
-    MYSQL *GetConnection();              // 获取数据库连接
+    // 连接池的运行统计，GetStats返回上次调用以来的累计值
+    struct stats
+    {
+        int total;              // 当前连接总数（含正在建立的）
+        int busy;               // 正在使用的连接数
+        int idle;               // 空闲连接数
+        int max;                // 最大连接数
+        long long checkouts;    // 成功获取连接的次数
+        long long timeouts;     // 等待超时或建立连接失败的次数
+        long long created;      // 新建的连接数
+        long long reaped;       // 因空闲太久而关闭的连接数
+        long long reconnects;   // 检测到连接失效后重新建立的次数
+        long long wait_us;      // 获取连接的总等待时间（微秒）
+        long long max_wait_us;  // 单次获取连接的最长等待时间（微秒）
+    };
+
+    MYSQL *GetConnection();              // 获取数据库连接，等待超时或无法建立连接时返回nullptr
     bool ReleaseConnection(MYSQL *conn); // 释放连接
     int GetFreeConn();                   // 获取空闲连接数
+    int GetMaxConn() { return m_MaxConn; } // 获取最大连接数
     void DestroyPool();                  // 销毁所有连接
+    stats GetStats();                    // 获取统计信息并清零累计值
+    // 获取conn上缓存的预处理语句，第一次使用时创建；conn必须是从本连接池取出、尚未放回的连接
+    // 连接重建或关闭时缓存的语句随之关闭
+    MYSQL_STMT *GetStatement(MYSQL *conn, SQL_STATEMENT id);
 
     // 单例模式，确保一个类只有一个实例，并提供一个全局访问点以获取该实例
     // 单例类必须自己创建自己的唯一实例
     // 需要构造函数私有化，确保外部无法直接实例化对象
     static connection_pool *GetInstance();
 
-    // 初始化函数
-    void init(string url, string User, string Passward, string DataBaseName, int Port, int MaxConn, int close_log);
+    // 初始化函数，只能调用一次
+    // 启动时只建立MinConn个连接，负载上来后按需增加到MaxConn个，空闲超过idle_timeout秒的连接关闭到只剩MinConn个
+    // 空闲超过ping_interval秒的连接取出时先mysql_ping检查，失效则重新连接
+    // 没有空闲连接且已达到MaxConn时最多等待wait_timeout_ms毫秒
+    // 一个连接都建立不起来时返回false
+    bool init(string url, string User, string Passward, string DataBaseName, int Port, int MaxConn, int close_log,
+              int MinConn = 1, int idle_timeout = 60, int ping_interval = 5, int wait_timeout_ms = 3000);
 
 private:
     // 单例模式下的初始化函数和析构函数
     connection_pool();
     ~connection_pool();
 
+    // 预先分配的连接槽，槽的下标在空闲栈、空槽栈之间流转，取出后只归取出的线程所有
+    struct slot
+    {
+        atomic<MYSQL *> conn;   // 没有建立连接时为nullptr
+        MYSQL_STMT *stmts[STMT_COUNT]; // 该连接上已创建的预处理语句，只由持有槽的线程访问
+        time_t since;           // 放回空闲栈的时间
+        atomic<uint32_t> next;  // 栈中下一个槽的下标+1，0表示栈底
+    };
+
+    // 无锁栈（Treiber stack），栈顶为 标记<<32 | (下标+1)，每次修改标记加一，避免ABA问题
+    int Pop(atomic<uint64_t> &head);
+    void Push(atomic<uint64_t> &head, int idx);
+    void Notify();               // 有槽放回后唤醒等待的线程
+    int FindSlot(MYSQL *con);
+    MYSQL *Connect();            // 建立一个新连接，失败返回nullptr
+    void Close(slot &s);         // 关闭槽中的连接和预处理语句
+    MYSQL *Checkout(int idx, bool create); // 取得槽之后检查或建立连接
+    void ReapIdle();             // 关闭空闲太久的连接，持有lock时调用
+
     // 参数声明
 public:
     string m_url;          // 主机地址
-    string m_Port;         // 数据库的端口号
+    int m_Port;            // 数据库的端口号
     string m_User;         // 登录数据库的用户名
     string m_PassWord;     // 登录数据库的密码
     string m_DatabaseName; // 使用的数据库名
     int m_close_log;       // 日志开关
 
 private:
-    list<MYSQL *> connList; // 连接池
-    sem reverse;            // 定义一个信号类
-    locker lock;            // 定义一个锁的类
-    int m_CurConn;          // 当前已使用的连接数
-    int m_FreeConn;         // 当前空闲的连接数
+    // 取放连接不加锁：空闲连接在m_idle栈中，后放回的先取出，不常用的连接沉在栈底等待回收
+    // 还没有建立连接的槽在m_empty栈中，取到空槽即获得新建一个连接的名额
+    // 两个栈都取不到时在m_seq上futex等待，放回槽时m_seq加一并唤醒
+    vector<slot> m_slots;
+    atomic<uint64_t> m_idle;
+    atomic<uint64_t> m_empty;
+    atomic<uint32_t> m_seq;
+    atomic<int> m_waiters;
+    atomic<bool> m_destroyed;
+    locker lock;            // 只用于回收空闲连接和销毁连接池，不在取放连接的路径上
+    atomic<int> m_CurConn;  // 当前已使用的连接数
+    atomic<int> m_FreeConn; // 当前空闲的连接数
+    atomic<int> m_TotalConn; // 连接总数，包括正在建立的连接
     int m_MaxConn;          // 最大连接数
-    sem reserve;            // 定义一个信号量,类对象
+    int m_MinConn;          // 保留的最少连接数
+    int m_IdleTimeout;
+    int m_PingInterval;
+    int m_WaitTimeout;      // 毫秒
+
+    // 统计的累计值
+    atomic<long long> m_checkouts;
+    atomic<long long> m_timeouts;
+    atomic<long long> m_created;
+    atomic<long long> m_reaped;
+    atomic<long long> m_reconnects;
+    atomic<long long> m_wait_us;
+    atomic<long long> m_max_wait_us;
 };
 
 // 实现资源获取即初始化（Resource Acquisition Is Initialization，RAII）的模式
@@ -59,6 +128,7 @@ public:
     ~connectionRAII();
 
 private:
+    MYSQL **sqlRAII; // 调用者保存连接的位置，释放后置空，避免留下悬空指针
     MYSQL *connRAII; //声明一个MYSQL指针，代表需要管理连接对象
     connection_pool *poolRAII; // 声明需要管理的连接池对象
 };
@@ -0,0 +1,84 @@
+#include <string.h>
+
+#include "sql_statement.h"
+
+const char *const sql_statements[STMT_COUNT] = {
+    "SELECT passwd FROM user WHERE username = ?",
+    "INSERT INTO user(username, passwd) VALUES(?, ?)",
+};
+
+MYSQL_STMT *sql_prepare(MYSQL *con, SQL_STATEMENT id)
+{
+    MYSQL_STMT *stmt = mysql_stmt_init(con);
+    if (!stmt)
+        return nullptr;
+    const char *sql = sql_statements[id];
+    if (mysql_stmt_prepare(stmt, sql, strlen(sql)) != 0)
+    {
+        mysql_stmt_close(stmt);
+        return nullptr;
+    }
+    return stmt;
+}
+
+bool sql_bind_strings(MYSQL_STMT *stmt, MYSQL_BIND *bind, unsigned long *lengths,
+                      const char *const *values, int count)
+{
+    memset(bind, 0, sizeof(MYSQL_BIND) * count);
+    for (int i = 0; i < count; i++)
+    {
+        lengths[i] = strlen(values[i]);
+        bind[i].buffer_type = MYSQL_TYPE_STRING;
+        bind[i].buffer = (void *)values[i];
+        bind[i].buffer_length = lengths[i];
+        bind[i].length = &lengths[i];
+    }
+    return mysql_stmt_bind_param(stmt, bind) == 0;
+}
+
+unsigned int sql_insert_user(MYSQL_STMT *stmt, const char *name, const char *passwd)
+{
+    const char *values[2] = {name, passwd};
+    MYSQL_BIND bind[2];
+    unsigned long lengths[2];
+    if (!sql_bind_strings(stmt, bind, lengths, values, 2) || mysql_stmt_execute(stmt) != 0)
+        return mysql_stmt_errno(stmt);
+    return 0;
+}
+
+int sql_select_user(MYSQL_STMT *stmt, const char *name, char *passwd, size_t len)
+{
+    MYSQL_BIND param;
+    unsigned long name_len;
+    if (!sql_bind_strings(stmt, &param, &name_len, &name, 1) || mysql_stmt_execute(stmt) != 0)
+        return -1;
+
+    // 结果写入passwd，超长时截断
+    MYSQL_BIND result;
+    unsigned long result_len = 0;
+    sql_bool is_null = 0;
+    memset(&result, 0, sizeof(result));
+    result.buffer_type = MYSQL_TYPE_STRING;
+    result.buffer = passwd;
+    result.buffer_length = len - 1;
+    result.length = &result_len;
+    result.is_null = &is_null;
+    if (mysql_stmt_bind_result(stmt, &result) != 0 || mysql_stmt_store_result(stmt) != 0)
+    {
+        mysql_stmt_free_result(stmt);
+        return -1;
+    }
+
+    int found = 0;
+    int ret = mysql_stmt_fetch(stmt);
+    if (ret == 0 || ret == MYSQL_DATA_TRUNCATED)
+    {
+        size_t n = is_null ? 0 : (result_len < len - 1 ? result_len : len - 1);
+        passwd[n] = '\0';
+        found = 1;
+    }
+    else if (ret != MYSQL_NO_DATA)
+        found = -1;
+    mysql_stmt_free_result(stmt);
+    return found;
+}
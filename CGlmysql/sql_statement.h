@@ -0,0 +1,36 @@
+#ifndef SQL_STATEMENT_H
+#define SQL_STATEMENT_H
+
+#include <mysql/mysql.h>
+#include <stddef.h>
+#include <type_traits>
+
+// 服务器用到的预处理语句
+// 每个数据库连接各自缓存一份服务端预处理语句，第一次使用时创建，之后复用，数据库不再重复解析SQL
+// 用户名和密码只作为参数传给数据库，不会拼接进SQL，不存在SQL注入
+enum SQL_STATEMENT
+{
+    STMT_SELECT_USER = 0, // 按用户名查询密码
+    STMT_INSERT_USER,     // 新增用户
+    STMT_COUNT
+};
+
+// MYSQL_BIND::is_null指向的类型：MariaDB和MySQL 5.7为my_bool，MySQL 8.0去掉了my_bool，改为bool
+typedef std::remove_pointer<decltype(MYSQL_BIND::is_null)>::type sql_bool;
+
+extern const char *const sql_statements[STMT_COUNT];
+
+// 在con上创建预处理语句，失败返回nullptr
+MYSQL_STMT *sql_prepare(MYSQL *con, SQL_STATEMENT id);
+
+// 把以'\0'结尾的字符串依次绑定为参数，lengths由调用者提供，执行完之前必须保持有效
+bool sql_bind_strings(MYSQL_STMT *stmt, MYSQL_BIND *bind, unsigned long *lengths,
+                      const char *const *values, int count);
+
+// 执行STMT_INSERT_USER，成功返回0，否则返回错误码（重名时为ER_DUP_ENTRY）
+unsigned int sql_insert_user(MYSQL_STMT *stmt, const char *name, const char *passwd);
+
+// 执行STMT_SELECT_USER，找到时把密码写入passwd并返回1，没有该用户返回0，出错返回-1
+int sql_select_user(MYSQL_STMT *stmt, const char *name, char *passwd, size_t len);
+
+#endif
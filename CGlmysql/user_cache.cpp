@@ -0,0 +1,138 @@
+#include <string.h>
+
+#include "user_cache.h"
+
+user_cache::user_cache()
+{
+    m_shards = new shard[SHARD_COUNT];
+    for (int i = 0; i < SHARD_COUNT; i++)
+    {
+        m_shards[i].current.store(new_table(INITIAL_SLOTS), memory_order_relaxed);
+        m_shards[i].count = 0;
+    }
+    m_size = 0;
+}
+
+user_cache::~user_cache()
+{
+    for (int i = 0; i < SHARD_COUNT; i++)
+    {
+        shard &s = m_shards[i];
+        s.retired.push_back(s.current.load(memory_order_relaxed));
+        for (table *t : s.retired)
+        {
+            delete[] t->slots;
+            delete t;
+        }
+        for (const user_record *rec : s.records)
+            delete rec;
+    }
+    delete[] m_shards;
+}
+
+// FNV-1a，低位选分片，其余的位选槽
+uint64_t user_cache::hash(const char *name, size_t len)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211ull;
+    }
+    return h ^ (h >> 32);
+}
+
+user_cache::table *user_cache::new_table(size_t slots)
+{
+    table *t = new table;
+    t->mask = slots - 1;
+    t->slots = new atomic<const user_record *>[slots];
+    for (size_t i = 0; i < slots; i++)
+        t->slots[i].store(nullptr, memory_order_relaxed);
+    return t;
+}
+
+// 放到第一个空槽，只用于还没有发布的新表
+void user_cache::place(table *t, const user_record *rec)
+{
+    size_t i = (rec->hash / SHARD_COUNT) & t->mask;
+    while (t->slots[i].load(memory_order_relaxed))
+        i = (i + 1) & t->mask;
+    t->slots[i].store(rec, memory_order_relaxed);
+}
+
+const char *user_cache::find(const char *name) const
+{
+    size_t len = strlen(name);
+    uint64_t h = hash(name, len);
+    // 表一经发布就只会增加或替换槽中的记录，装载率不超过一半，探测一定会遇到空槽
+    const table *t = shard_of(h).current.load(memory_order_acquire);
+    for (size_t i = (h / SHARD_COUNT) & t->mask;; i = (i + 1) & t->mask)
+    {
+        const user_record *rec = t->slots[i].load(memory_order_acquire);
+        if (!rec)
+            return nullptr;
+        if (rec->hash == h && rec->name.size() == len && memcmp(rec->name.data(), name, len) == 0)
+            return rec->passwd.c_str();
+    }
+}
+
+bool user_cache::insert(const char *name, const char *passwd, bool replace)
+{
+    size_t len = strlen(name);
+    uint64_t h = hash(name, len);
+    shard &s = shard_of(h);
+
+    s.lock.lock();
+    table *t = s.current.load(memory_order_relaxed);
+    size_t i = (h / SHARD_COUNT) & t->mask;
+    for (;; i = (i + 1) & t->mask)
+    {
+        const user_record *rec = t->slots[i].load(memory_order_relaxed);
+        if (!rec)
+            break;
+        if (rec->hash == h && rec->name.size() == len && memcmp(rec->name.data(), name, len) == 0)
+        {
+            if (!replace)
+            {
+                s.lock.unlock();
+                return false;
+            }
+            // 密码没有变化时不换记录，增量同步反复读到同一用户不会让记录越积越多
+            if (rec->passwd == passwd)
+            {
+                s.lock.unlock();
+                return true;
+            }
+            // 换成新记录，旧记录可能正在被读取，保留到缓存销毁
+            user_record *updated = new user_record{h, string(name, len), passwd};
+            s.records.push_back(updated);
+            t->slots[i].store(updated, memory_order_release);
+            s.lock.unlock();
+            return true;
+        }
+    }
+
+    user_record *rec = new user_record{h, string(name, len), passwd};
+    s.records.push_back(rec);
+    if ((s.count + 1) * 2 > t->mask + 1)
+    {
+        // 装载率超过一半时扩容为两倍：在新表中放好所有记录后再发布，读者看到的总是完整的表
+        table *bigger = new_table((t->mask + 1) * 2);
+        for (size_t j = 0; j <= t->mask; j++)
+        {
+            const user_record *old = t->slots[j].load(memory_order_relaxed);
+            if (old)
+                place(bigger, old);
+        }
+        place(bigger, rec);
+        s.current.store(bigger, memory_order_release);
+        s.retired.push_back(t);
+    }
+    else
+        t->slots[i].store(rec, memory_order_release);
+    s.count++;
+    m_size.fetch_add(1, memory_order_relaxed);
+    s.lock.unlock();
+    return true;
+}
@@ -0,0 +1,74 @@
+#ifndef USER_CACHE_H
+#define USER_CACHE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "../lock/locker.h"
+
+using namespace std;
+
+// 缓存中的一个用户，发布后不再修改，更新密码时换成新的记录
+struct user_record
+{
+    uint64_t hash;
+    string name;
+    string passwd;
+};
+
+// 所有线程共享的用户名到密码的缓存，代替原来的map加一把全局锁
+// 按哈希值分成SHARD_COUNT个分片，每个分片是一张开放寻址（线性探测）的哈希表：
+// 查找不加锁，只做原子读；插入只锁所在的分片
+// 记录和被扩容替换下来的旧表都不立即释放（RCU风格），正在读的线程不会访问到已释放的内存，
+// 旧表的总大小不超过当前表，缓存销毁时一起释放
+class user_cache
+{
+public:
+    static user_cache *get_instance()
+    {
+        static user_cache instance;
+        return &instance;
+    }
+
+    // 返回用户的密码，没有该用户返回nullptr
+    // 返回的指针在缓存销毁前一直有效，即使之后密码被更新
+    const char *find(const char *name) const;
+    // 插入用户；已存在时replace为true则更新密码，否则返回false
+    bool insert(const char *name, const char *passwd, bool replace = false);
+    size_t size() const { return m_size.load(memory_order_relaxed); }
+
+private:
+    user_cache();
+    ~user_cache();
+
+    static const int SHARD_COUNT = 64;      // 2的幂
+    static const size_t INITIAL_SLOTS = 64; // 每个分片哈希表的初始槽数，2的幂
+
+    struct table
+    {
+        size_t mask; // 槽数-1
+        atomic<const user_record *> *slots;
+    };
+
+    // 各分片独占缓存行，插入时不互相干扰
+    struct alignas(64) shard
+    {
+        atomic<table *> current;
+        size_t count;                        // 以下成员只在持有lock时访问
+        vector<table *> retired;
+        vector<const user_record *> records; // 所有发布过的记录，包括已被替换的
+        locker lock;
+    };
+
+    static uint64_t hash(const char *name, size_t len);
+    static table *new_table(size_t slots);
+    static void place(table *t, const user_record *rec);
+    shard &shard_of(uint64_t h) const { return m_shards[h & (SHARD_COUNT - 1)]; }
+
+private:
+    shard *m_shards;
+    atomic<size_t> m_size;
+};
+
+#endif
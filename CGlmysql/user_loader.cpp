@@ -0,0 +1,265 @@
+#define LOG_MODULE LOG_MOD_SQL // 本文件的日志属于sql模块，要在包含log.h之前定义
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "user_loader.h"
+
+user_loader::user_loader()
+{
+    m_pool = nullptr;
+    m_close_log = 0;
+    m_has_id = false;
+    m_high_water = 0;
+    m_running = false;
+    m_interval = 0;
+    m_stop = false;
+}
+
+user_loader::~user_loader()
+{
+    stop();
+}
+
+// 查询id的范围；user表没有id列时has_id为false
+bool user_loader::query_bounds(long long &min_id, long long &max_id, bool &has_id)
+{
+    MYSQL *con = nullptr;
+    connectionRAII mysqlcon(&con, m_pool);
+    if (!con)
+        return false;
+
+    has_id = true;
+    min_id = max_id = 0;
+    if (mysql_query(con, "SELECT MIN(id), MAX(id) FROM user") != 0)
+    {
+        // 1054：没有这一列
+        if (mysql_errno(con) == 1054)
+        {
+            has_id = false;
+            return true;
+        }
+        LOG_ERROR("user_loader: %s", mysql_error(con));
+        return false;
+    }
+    MYSQL_RES *res = mysql_store_result(con);
+    if (!res)
+        return false;
+    MYSQL_ROW row = mysql_fetch_row(res);
+    if (row && row[0] && row[1])
+    {
+        min_id = atoll(row[0]);
+        max_id = atoll(row[1]);
+    }
+    mysql_free_result(res);
+    return true;
+}
+
+// 执行sql并逐行读取结果放入user_cache，返回读取的行数，出错返回-1
+// with_id为true时第一列为id，最大的id写入max_id
+long long user_loader::stream(MYSQL *con, const char *sql, bool with_id, long long *max_id)
+{
+    if (mysql_query(con, sql) != 0)
+    {
+        LOG_ERROR("user_loader: %s", mysql_error(con));
+        return -1;
+    }
+    // mysql_use_result不把结果集整个读到客户端，边读边处理，内存占用与表的大小无关
+    MYSQL_RES *res = mysql_use_result(con);
+    if (!res)
+    {
+        LOG_ERROR("user_loader: %s", mysql_error(con));
+        return -1;
+    }
+
+    user_cache *cache = user_cache::get_instance();
+    long long rows = 0;
+    int col = with_id ? 1 : 0;
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(res)))
+    {
+        if (!row[col] || !row[col + 1])
+            continue;
+        // 数据库中的密码可能已被修改，以数据库为准
+        cache->insert(row[col], row[col + 1], true);
+        if (with_id && max_id)
+        {
+            long long id = atoll(row[0]);
+            if (id > *max_id)
+                *max_id = id;
+        }
+        rows++;
+    }
+    // 读取中途出错时mysql_fetch_row同样返回NULL，需要检查错误码
+    bool failed = mysql_errno(con) != 0;
+    mysql_free_result(res);
+    if (failed)
+    {
+        LOG_ERROR("user_loader: %s", mysql_error(con));
+        return -1;
+    }
+    return rows;
+}
+
+void *user_loader::load_range(void *arg)
+{
+    range *r = (range *)arg;
+    user_loader *loader = r->loader;
+    int m_close_log = loader->m_close_log;
+
+    MYSQL *con = nullptr;
+    connectionRAII mysqlcon(&con, loader->m_pool);
+    if (!con)
+    {
+        LOG_ERROR("user_loader: no connection for range [%lld, %lld]", r->first, r->last);
+        return nullptr;
+    }
+
+    char sql[128];
+    snprintf(sql, sizeof(sql), "SELECT username, passwd FROM user WHERE id BETWEEN %lld AND %lld",
+             r->first, r->last);
+    r->rows = loader->stream(con, sql, false, nullptr);
+    r->ok = r->rows >= 0;
+    return nullptr;
+}
+
+long long user_loader::load(connection_pool *pool, int threads, int close_log)
+{
+    m_pool = pool;
+    m_close_log = close_log;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    long long min_id, max_id;
+    if (!query_bounds(min_id, max_id, m_has_id))
+        return -1;
+
+    long long total = 0;
+    if (!m_has_id)
+    {
+        // 没有id列，无法分区间，也无法增量同步，只做一次全表读取
+        MYSQL *con = nullptr;
+        connectionRAII mysqlcon(&con, m_pool);
+        if (!con)
+            return -1;
+        total = stream(con, "SELECT username, passwd FROM user", false, nullptr);
+        if (total < 0)
+            return -1;
+    }
+    else if (max_id > 0)
+    {
+        // 按id把[min_id, max_id]平均分成threads段，每段一个线程、一个连接
+        // 线程数超过最大连接数时多出的线程只能等待，可能超时
+        if (threads > m_pool->GetMaxConn())
+            threads = m_pool->GetMaxConn();
+        if (threads < 1)
+            threads = 1;
+        long long span = max_id - min_id + 1;
+        if (threads > span)
+            threads = (int)span;
+        vector<range> ranges(threads);
+        vector<pthread_t> tids(threads);
+        vector<bool> started(threads, false);
+        long long first = min_id;
+        for (int i = 0; i < threads; i++)
+        {
+            long long len = span / threads + (i < span % threads ? 1 : 0);
+            ranges[i] = range{this, first, first + len - 1, 0, false};
+            first += len;
+            started[i] = pthread_create(&tids[i], NULL, load_range, &ranges[i]) == 0;
+            if (!started[i])
+                load_range(&ranges[i]);
+        }
+        bool ok = true;
+        for (int i = 0; i < threads; i++)
+        {
+            if (started[i])
+                pthread_join(tids[i], NULL);
+            ok = ok && ranges[i].ok;
+            total += ranges[i].rows;
+        }
+        if (!ok)
+            return -1;
+    }
+    // 加载期间新注册的用户id可能大于max_id，由增量同步补上
+    m_high_water = max_id;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long long ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    LOG_INFO("user_loader: %lld users loaded in %lld ms, high water %lld", total, ms, max_id);
+    return total;
+}
+
+// 读取id大于高水位的新用户，按id递增读取，读到哪里高水位就推进到哪里
+// 自增id在事务提交之前就已分配，id较小的事务可能晚于id较大的提交，只读id > 高水位会永久漏掉它；
+// 因此每次从高水位往回SYNC_OVERLAP个id重新读取，窗口内已有的用户按数据库中的密码覆盖，密码相同时不会新建记录
+void user_loader::sync_once()
+{
+    MYSQL *con = nullptr;
+    connectionRAII mysqlcon(&con, m_pool);
+    if (!con)
+        return;
+
+    long long high = m_high_water.load();
+    long long from = high > SYNC_OVERLAP ? high - SYNC_OVERLAP : 0;
+    char sql[128];
+    snprintf(sql, sizeof(sql), "SELECT id, username, passwd FROM user WHERE id > %lld ORDER BY id", from);
+    long long max_id = high;
+    long long rows = stream(con, sql, true, &max_id);
+    if (max_id > high)
+        LOG_INFO("user_loader: synced %lld users, high water %lld", rows, max_id);
+    m_high_water = max_id;
+}
+
+void *user_loader::sync_worker(void *arg)
+{
+    user_loader *loader = (user_loader *)arg;
+    loader->m_lock.lock();
+    while (!loader->m_stop)
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_REALTIME, &t);
+        t.tv_sec += loader->m_interval;
+        loader->m_cond.timewait(loader->m_lock.get(), t);
+        if (loader->m_stop)
+            break;
+        // 同步期间不持锁，stop只需等这一轮结束
+        loader->m_lock.unlock();
+        loader->sync_once();
+        loader->m_lock.lock();
+    }
+    loader->m_lock.unlock();
+    return nullptr;
+}
+
+bool user_loader::start_sync(int interval)
+{
+    if (!m_pool || m_running || interval <= 0)
+        return false;
+    if (!m_has_id)
+    {
+        LOG_ERROR("user_loader: table user has no id column, incremental sync disabled");
+        return false;
+    }
+    m_interval = interval;
+    m_stop = false;
+    if (pthread_create(&m_tid, NULL, sync_worker, this) != 0)
+        return false;
+    m_running = true;
+    return true;
+}
+
+void user_loader::stop()
+{
+    if (!m_running)
+        return;
+    m_lock.lock();
+    m_stop = true;
+    m_cond.broadcast();
+    m_lock.unlock();
+    pthread_join(m_tid, NULL);
+    m_running = false;
+}
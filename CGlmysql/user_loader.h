@@ -0,0 +1,67 @@
+#ifndef USER_LOADER_H
+#define USER_LOADER_H
+
+#include <pthread.h>
+#include <atomic>
+#include "sql_connection_pool.h"
+#include "user_cache.h"
+
+// 把user表加载到user_cache中
+// 启动时按id区间用多个连接并行地流式读取（mysql_use_result，不把整张表放进客户端内存），
+// 之后由后台线程定时读取id大于已加载的最大id（高水位）的新用户，让缓存保持完整
+// 每次同步都会重读高水位之前的一段id，补上提交顺序与id顺序不一致而漏掉的用户
+// 需要user表有自增的整数列id；没有时退化为一次全表流式读取，并且不做增量同步
+class user_loader
+{
+public:
+    static user_loader *get_instance()
+    {
+        static user_loader instance;
+        return &instance;
+    }
+
+    // 用最多threads个连接池中的连接并行加载，返回加载的用户数，失败返回-1
+    long long load(connection_pool *pool, int threads, int close_log);
+    // 启动后台线程，每隔interval秒同步一次新增的用户，需要先调用load
+    bool start_sync(int interval);
+    void stop();
+
+    long long high_water() const { return m_high_water.load(); }
+
+private:
+    // 增量同步时在高水位之前重新读取的id个数，应大于一个注册事务提交前其后可能分配的id个数
+    static const long long SYNC_OVERLAP = 1000;
+
+    user_loader();
+    ~user_loader();
+
+    struct range
+    {
+        user_loader *loader;
+        long long first; // 闭区间[first, last]
+        long long last;
+        long long rows;
+        bool ok;
+    };
+
+    static void *load_range(void *arg);
+    static void *sync_worker(void *arg);
+    bool query_bounds(long long &min_id, long long &max_id, bool &has_id);
+    long long stream(MYSQL *con, const char *sql, bool with_id, long long *max_id);
+    void sync_once();
+
+private:
+    connection_pool *m_pool;
+    int m_close_log;
+    bool m_has_id;
+    atomic<long long> m_high_water; // 已加载的最大id
+
+    pthread_t m_tid;
+    bool m_running;
+    int m_interval;
+    locker m_lock;
+    cond m_cond; // stop时唤醒同步线程
+    bool m_stop;
+};
+
+#endif
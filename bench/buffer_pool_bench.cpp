@@ -0,0 +1,139 @@
+/*************************************************************
+*连接缓冲区测试：N个长连接中只有一部分在收发数据时，对比常驻内存
+*  fixed   每个连接固定持有2KB读缓冲区和1KB写缓冲区（原来http_conn中的数组）
+*  pooled  连接处理请求时才从buffer_pool取缓冲区，响应发完后归还
+*另外输出buffer_pool分配、归还一对缓冲区的耗时，与malloc/free对比
+*用法：buffer_pool_bench [连接数] [同时活跃的连接数]
+*单独编译：g++ -O2 -std=c++17 bench/buffer_pool_bench.cpp http/buffer_pool.cpp -o buffer_pool_bench
+**************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include "../http/buffer_pool.h"
+
+using namespace std;
+
+static const size_t READ_SIZE = 2048;
+static const size_t WRITE_SIZE = 1024;
+
+static long rss_kb()
+{
+    long pages = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp)
+    {
+        if (fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+            resident = 0;
+        fclose(fp);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// 让编译器认为缓冲区被使用，不会把malloc、memset、free整个优化掉
+static void escape(void *p)
+{
+    asm volatile("" : : "r"(p) : "memory");
+}
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+struct pooled_conn
+{
+    char *read_buf = nullptr;
+    size_t read_size = 0;
+    char *write_buf = nullptr;
+    size_t write_size = 0;
+};
+
+int main(int argc, char *argv[])
+{
+    int conns = argc > 1 ? atoi(argv[1]) : 50000;
+    int active = argc > 2 ? atoi(argv[2]) : 500;
+    if (active > conns)
+        active = conns;
+
+    // fixed：和原来一样，每个连接的缓冲区一直存在，init时memset清零
+    long base = rss_kb();
+    char *fixed = (char *)malloc((READ_SIZE + WRITE_SIZE) * conns);
+    escape(fixed); // 否则malloc加memset清零可能被合并成calloc，页面不会被真正写入
+    memset(fixed, 0, (READ_SIZE + WRITE_SIZE) * conns);
+    escape(fixed);
+    long fixed_kb = rss_kb() - base;
+    free(fixed);
+
+    // pooled：每一轮有active个连接在处理请求，处理完归还缓冲区
+    base = rss_kb();
+    vector<pooled_conn> pc(conns);
+    long peak_kb = 0;
+    unsigned seed = 1;
+    for (int round = 0; round < 20; round++)
+    {
+        vector<int> busy;
+        for (int i = 0; i < active; i++)
+        {
+            int c = rand_r(&seed) % conns;
+            pooled_conn &p = pc[c];
+            if (p.read_buf)
+                continue;
+            p.read_buf = buffer_pool::alloc(READ_SIZE, &p.read_size);
+            p.write_buf = buffer_pool::alloc(WRITE_SIZE, &p.write_size);
+            memset(p.read_buf, 'r', 512);
+            memset(p.write_buf, 'w', 256);
+            busy.push_back(c);
+        }
+        long kb = rss_kb() - base;
+        if (kb > peak_kb)
+            peak_kb = kb;
+        for (int c : busy)
+        {
+            pooled_conn &p = pc[c];
+            buffer_pool::release(p.read_buf, p.read_size);
+            buffer_pool::release(p.write_buf, p.write_size);
+            p.read_buf = p.write_buf = nullptr;
+        }
+    }
+    long idle_kb = rss_kb() - base;
+
+    printf("%d connections, %d active\n", conns, active);
+    printf("  fixed buffers:  %8ld KB resident\n", fixed_kb);
+    printf("  pooled buffers: %8ld KB peak, %ld KB with all connections idle (includes %zu KB of connection slots)\n",
+           peak_kb, idle_kb, sizeof(pooled_conn) * conns / 1024);
+
+    // 分配、归还一对缓冲区的耗时
+    const int iters = 2000000;
+    double start = now_ns();
+    for (int i = 0; i < iters; i++)
+    {
+        size_t rs, ws;
+        char *r = buffer_pool::alloc(READ_SIZE, &rs);
+        char *w = buffer_pool::alloc(WRITE_SIZE, &ws);
+        r[0] = w[0] = (char)i;
+        escape(r);
+        escape(w);
+        buffer_pool::release(r, rs);
+        buffer_pool::release(w, ws);
+    }
+    double pool_ns = (now_ns() - start) / iters;
+    start = now_ns();
+    for (int i = 0; i < iters; i++)
+    {
+        char *r = (char *)malloc(READ_SIZE);
+        char *w = (char *)malloc(WRITE_SIZE);
+        r[0] = w[0] = (char)i;
+        escape(r);
+        escape(w);
+        free(r);
+        free(w);
+    }
+    double malloc_ns = (now_ns() - start) / iters;
+    printf("  alloc+release of a read/write pair: buffer_pool %.1f ns, malloc/free %.1f ns\n", pool_ns, malloc_ns);
+    return 0;
+}
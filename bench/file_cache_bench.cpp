@@ -0,0 +1,110 @@
+/*************************************************************
+*文件缓存测试：每个请求stat后从file_cache取文件，与关闭缓存时每次open、mmap、munmap、close对比
+*在临时目录中生成若干个文件，多个线程随机请求，读取映射的内容模拟发送
+*用法：file_cache_bench [目录] [每个线程的请求数]
+*单独编译：g++ -O2 -std=c++17 bench/file_cache_bench.cpp http/file_cache.cpp -o file_cache_bench -lpthread
+**************************************************************/
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../http/file_cache.h"
+
+using namespace std;
+
+static const int FILES = 64;
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool make_files(const string &dir, size_t size, vector<string> &paths)
+{
+    string data(size, 'x');
+    for (int i = 0; i < FILES; i++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "/bench_%zu_%d.html", size, i);
+        string path = dir + name;
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || ::write(fd, data.data(), size) != (ssize_t)size)
+        {
+            perror(path.c_str());
+            return false;
+        }
+        close(fd);
+        paths.push_back(path);
+    }
+    return true;
+}
+
+// 与do_request相同：先stat，再取文件；小文件读取映射中的数据，大文件只取fd
+static double run(const vector<string> &paths, int threads, long per_thread)
+{
+    double start = now_sec();
+    vector<thread> ts;
+    for (int t = 0; t < threads; t++)
+    {
+        ts.emplace_back([&, t] {
+            unsigned seed = t + 1;
+            unsigned long sum = 0;
+            for (long i = 0; i < per_thread; i++)
+            {
+                const string &path = paths[rand_r(&seed) % paths.size()];
+                struct stat st;
+                if (stat(path.c_str(), &st) < 0)
+                    continue;
+                cached_file *f = file_cache::get_instance()->acquire(path.c_str(), st);
+                if (!f)
+                    continue;
+                if (f->addr)
+                    sum += f->addr[0] + f->addr[f->size - 1];
+                else
+                    sum += f->fd;
+                file_cache::get_instance()->release(f);
+            }
+            if (sum == 1)
+                printf("\n");
+        });
+    }
+    for (thread &th : ts)
+        th.join();
+    return threads * per_thread / (now_sec() - start);
+}
+
+int main(int argc, char *argv[])
+{
+    string dir = argc > 1 ? argv[1] : "/tmp";
+    long per_thread = argc > 2 ? atol(argv[2]) : 200000;
+    const off_t threshold = 256 * 1024;
+
+    printf("size      threads   uncached(k req/s)   cached(k req/s)   hits\n");
+    for (size_t size : {(size_t)1024, (size_t)16 * 1024, (size_t)1024 * 1024})
+    {
+        vector<string> paths;
+        if (!make_files(dir, size, paths))
+            return 1;
+        for (int threads : {1, 4})
+        {
+            file_cache::get_instance()->init(false, 64 << 20, 1000, threshold);
+            double a = run(paths, threads, per_thread);
+            file_cache::get_instance()->init(true, 64 << 20, 1000, threshold);
+            long long hits = file_cache::get_instance()->get_stats().hits;
+            double b = run(paths, threads, per_thread);
+            hits = file_cache::get_instance()->get_stats().hits - hits;
+            printf("%-9zu %7d   %17.0f   %15.0f   %lld\n", size, threads, a / 1e3, b / 1e3, hits);
+        }
+        for (const string &p : paths)
+            unlink(p.c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,256 @@
+/*************************************************************
+*HTTP压测客户端，对比单循环和多循环（loop_num=0与loop_num=N）的吞吐和延迟
+*每个线程一个连接，阻塞socket，发送请求后读完整个响应再发下一个
+*用法：http_load [-h 地址] [-p 端口] [-c 连接数] [-n 总请求数] [-u 路径] [-k] [-P 深度]
+*  -k  长连接，每个连接上连续发送请求；否则每个请求新建一个连接
+*  -P  流水线深度，一次发送这么多个请求再依次读取响应，隐含-k
+*另外输出connect的延迟分布，用于比较accept方式（单个监听socket与SO_REUSEPORT分片）
+*单独编译：g++ -O2 -std=c++17 bench/http_load.cpp -o http_load -lpthread
+**************************************************************/
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+struct load_config
+{
+    const char *host = "127.0.0.1";
+    int port = 9006;
+    int conns = 16;
+    long requests = 100000;
+    const char *path = "/";
+    bool keep_alive = false;
+    int depth = 1;
+};
+
+struct load_result
+{
+    long ok = 0;
+    long failed = 0;
+    vector<double> latency_us; // 每个请求从发送到读完响应的时间
+    vector<double> connect_us; // connect返回的时间，包括三次握手和在accept队列中的排队
+};
+
+static double now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int connect_to(const load_config &cfg)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(cfg.port);
+    inet_pton(AF_INET, cfg.host, &addr.sin_addr);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static bool send_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = ::write(fd, data, len);
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// 读出一个完整的响应，buf中可能留下属于下一个响应的数据
+// 返回状态码，连接出错或被关闭时返回-1
+static int read_response(int fd, string &buf)
+{
+    char tmp[65536];
+    size_t head_end = string::npos;
+    long long body_len = -1;
+    while (true)
+    {
+        if (head_end == string::npos)
+        {
+            head_end = buf.find("\r\n\r\n");
+            if (head_end != string::npos)
+            {
+                head_end += 4;
+                body_len = 0;
+                // 服务器写的是"Content-Length:%lld"，冒号后可能没有空格
+                for (size_t pos = buf.find("\r\n"); pos < head_end; pos = buf.find("\r\n", pos + 2))
+                {
+                    if (strncasecmp(buf.c_str() + pos + 2, "Content-Length:", 15) == 0)
+                    {
+                        body_len = atoll(buf.c_str() + pos + 17);
+                        break;
+                    }
+                }
+            }
+        }
+        if (head_end != string::npos && buf.size() >= head_end + body_len)
+        {
+            int status = atoi(buf.c_str() + 9);
+            buf.erase(0, head_end + body_len);
+            return status;
+        }
+        ssize_t n = ::read(fd, tmp, sizeof(tmp));
+        if (n <= 0)
+            return -1;
+        buf.append(tmp, n);
+    }
+}
+
+// 每轮发送depth个请求（最后一轮可能更少），每个响应的延迟从这一轮发送时算起
+static void worker(const load_config &cfg, long count, load_result &res)
+{
+    char req[512];
+    int len = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n\r\n",
+                       cfg.path, cfg.host, cfg.keep_alive ? "keep-alive" : "close");
+    string batch;
+    for (int i = 0; i < cfg.depth; i++)
+        batch.append(req, len);
+    res.latency_us.reserve(count);
+    string buf;
+    int fd = -1;
+    for (long i = 0; i < count;)
+    {
+        int n = count - i < cfg.depth ? (int)(count - i) : cfg.depth;
+        double start = now_us();
+        if (fd < 0)
+        {
+            fd = connect_to(cfg);
+            buf.clear();
+            res.connect_us.push_back(now_us() - start);
+        }
+        int status = -1;
+        bool sent = fd >= 0 && send_all(fd, batch.data(), (size_t)len * n);
+        for (int k = 0; k < n; k++, i++)
+        {
+            status = sent ? read_response(fd, buf) : -1;
+            res.latency_us.push_back(now_us() - start);
+            if (status == 200)
+                res.ok++;
+            else
+                res.failed++;
+            sent = sent && status >= 0;
+        }
+        if (!cfg.keep_alive || status < 0)
+        {
+            if (fd >= 0)
+                close(fd);
+            fd = -1;
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+}
+
+static double percentile(const vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t idx = (size_t)(p * (sorted.size() - 1));
+    return sorted[idx];
+}
+
+int main(int argc, char *argv[])
+{
+    load_config cfg;
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:c:n:u:kP:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h':
+            cfg.host = optarg;
+            break;
+        case 'p':
+            cfg.port = atoi(optarg);
+            break;
+        case 'c':
+            cfg.conns = atoi(optarg);
+            break;
+        case 'n':
+            cfg.requests = atol(optarg);
+            break;
+        case 'u':
+            cfg.path = optarg;
+            break;
+        case 'k':
+            cfg.keep_alive = true;
+            break;
+        case 'P':
+            cfg.depth = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-h host] [-p port] [-c conns] [-n requests] [-u path] [-k] [-P depth]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (cfg.conns < 1)
+        cfg.conns = 1;
+    if (cfg.depth < 1)
+        cfg.depth = 1;
+    if (cfg.depth > 1)
+        cfg.keep_alive = true;
+
+    vector<load_result> results(cfg.conns);
+    vector<thread> threads;
+    double start = now_us();
+    for (int i = 0; i < cfg.conns; i++)
+    {
+        long count = cfg.requests / cfg.conns + (i < cfg.requests % cfg.conns ? 1 : 0);
+        threads.emplace_back(worker, cref(cfg), count, ref(results[i]));
+    }
+    for (thread &t : threads)
+        t.join();
+    double elapsed = (now_us() - start) / 1e6;
+
+    load_result total;
+    for (load_result &r : results)
+    {
+        total.ok += r.ok;
+        total.failed += r.failed;
+        total.latency_us.insert(total.latency_us.end(), r.latency_us.begin(), r.latency_us.end());
+        total.connect_us.insert(total.connect_us.end(), r.connect_us.begin(), r.connect_us.end());
+    }
+    sort(total.latency_us.begin(), total.latency_us.end());
+    sort(total.connect_us.begin(), total.connect_us.end());
+
+    printf("%s %s:%d%s, %d conns, depth %d, %ld requests in %.2fs\n", cfg.keep_alive ? "keep-alive" : "close",
+           cfg.host, cfg.port, cfg.path, cfg.conns, cfg.depth, cfg.requests, elapsed);
+    printf("ok %ld failed %ld, %.0f req/s\n", total.ok, total.failed, (total.ok + total.failed) / elapsed);
+    printf("latency us: p50 %.0f p90 %.0f p99 %.0f max %.0f\n",
+           percentile(total.latency_us, 0.50), percentile(total.latency_us, 0.90),
+           percentile(total.latency_us, 0.99), total.latency_us.empty() ? 0 : total.latency_us.back());
+    // accept队列溢出时SYN被丢弃，客户端1秒后重传，表现为connect的长尾
+    printf("connect us: p50 %.0f p90 %.0f p99 %.0f max %.0f (%zu connects)\n",
+           percentile(total.connect_us, 0.50), percentile(total.connect_us, 0.90),
+           percentile(total.connect_us, 0.99), total.connect_us.empty() ? 0 : total.connect_us.back(),
+           total.connect_us.size());
+    return 0;
+}
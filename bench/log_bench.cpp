@@ -0,0 +1,143 @@
+/*************************************************************
+*日志时间戳测试：
+*1.只比较每行日志前缀的生成：原来每行gettimeofday、localtime_r后snprintf整个日期时间，
+*  与每个线程缓存当前这一秒的前缀、只填入微秒对比，后者分别用CLOCK_REALTIME和CLOCK_REALTIME_COARSE取时间
+*2.按命令行选择的模式初始化Log，单线程连续写LOG_INFO，输出每行的平均耗时（5轮取最好的一轮）
+*用法：log_bench 日志文件 [async 0/1] [coarse_clock 0/1] [binary 0/1] [每轮行数]
+*单独编译：g++ -O2 -std=c++17 bench/log_bench.cpp log/log.cpp -o log_bench -lpthread
+**************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include "../log/log.h"
+
+using namespace std;
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// 让编译器认为前缀被使用，不会把格式化整个优化掉
+static void escape(void *p)
+{
+    asm volatile("" : : "r"(p) : "memory");
+}
+
+// 原来write_log的做法
+static int prefix_old(char *buf)
+{
+    struct timeval now = {0, 0};
+    gettimeofday(&now, NULL);
+    time_t t = now.tv_sec;
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+    return snprintf(buf, 48, "%d-%02d-%02d %02d:%02d:%02d.%06ld [info]:",
+                    my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+                    my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec);
+}
+
+// 与log.cpp中的log_clock相同：秒数变化时才重新格式化日期时间
+static thread_local time_t t_sec = (time_t)-1;
+static thread_local char t_prefix[32];
+static thread_local int t_prefix_len;
+
+static int prefix_cached(char *buf, clockid_t clock)
+{
+    struct timespec now;
+    clock_gettime(clock, &now);
+    if (t_sec != now.tv_sec)
+    {
+        t_sec = now.tv_sec;
+        struct tm my_tm;
+        localtime_r(&t_sec, &my_tm);
+        t_prefix_len = snprintf(t_prefix, sizeof(t_prefix), "%04d-%02d-%02d %02d:%02d:%02d",
+                                my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+                                my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec);
+    }
+    char *p = buf;
+    memcpy(p, t_prefix, t_prefix_len);
+    p += t_prefix_len;
+    *p++ = '.';
+    long usec = now.tv_nsec / 1000;
+    for (int i = 5; i >= 0; i--)
+    {
+        p[i] = '0' + usec % 10;
+        usec /= 10;
+    }
+    p += 6;
+    memcpy(p, " [info]:", 8);
+    return (int)(p + 8 - buf);
+}
+
+static void bench_prefix(int n)
+{
+    char buf[64];
+    double start = now_ns();
+    for (int i = 0; i < n; i++)
+    {
+        prefix_old(buf);
+        escape(buf);
+    }
+    double old_ns = (now_ns() - start) / n;
+
+    start = now_ns();
+    for (int i = 0; i < n; i++)
+    {
+        prefix_cached(buf, CLOCK_REALTIME);
+        escape(buf);
+    }
+    double cached_ns = (now_ns() - start) / n;
+
+    start = now_ns();
+    for (int i = 0; i < n; i++)
+    {
+        prefix_cached(buf, CLOCK_REALTIME_COARSE);
+        escape(buf);
+    }
+    double coarse_ns = (now_ns() - start) / n;
+
+    printf("line prefix: per-line localtime+snprintf %.1f ns, cached %.1f ns, cached+coarse clock %.1f ns\n",
+           old_ns, cached_ns, coarse_ns);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("usage: %s logfile [async] [coarse_clock] [binary] [lines]\n", argv[0]);
+        return 1;
+    }
+    bool async = argc > 2 && atoi(argv[2]);
+    bool coarse = argc > 3 && atoi(argv[3]);
+    bool binary = argc > 4 && atoi(argv[4]);
+    int n = argc > 5 ? atoi(argv[5]) : 1000000;
+
+    bench_prefix(n);
+
+    // 按行数分文件的阈值足够大，测试期间不切换文件
+    if (!Log::get_instance()->init(async ? 1024 : 0, 0, 2048, 50000000, argv[1], 100, coarse, binary))
+    {
+        printf("cannot open %s\n", argv[1]);
+        return 1;
+    }
+    int m_close_log = 0; // LOG_INFO宏使用
+    double best = 1e18;
+    for (int round = 0; round < 5; round++)
+    {
+        double start = now_ns();
+        for (int i = 0; i < n; i++)
+            LOG_INFO("GET /index.html HTTP/1.1 n %d", i);
+        double ns = (now_ns() - start) / n;
+        if (ns < best)
+            best = ns;
+    }
+    Log::get_instance()->flush();
+    printf("LOG_INFO (%s, %s clock, %s): %.1f ns/line, best of 5 rounds of %d\n", async ? "async" : "sync",
+           coarse ? "coarse" : "precise", binary ? "binary" : "text", best, n);
+    return 0;
+}
@@ -0,0 +1,108 @@
+/*************************************************************
+*日志队列测试：多个生产者线程写入、一个消费者线程取出，log_ring与block_queue（原来的日志队列）对比
+*每条数据是一行典型长度的日志字符串，队列满时与Log相同，视为丢弃（Log改为同步写）并计数
+*生产者线程数从1增加到64，总条数不变，输出每秒写入的条数
+*用法：log_queue_bench [总条数] [队列容量]
+*单独编译：g++ -O2 -std=c++17 bench/log_queue_bench.cpp -o log_queue_bench -lpthread
+**************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../log/block_queue.h"
+#include "../log/log_ring.h"
+
+using namespace std;
+
+static const char *const LINE = "2026-10-18 12:00:00.000000 [info]: some log line of typical length 0123456789\n";
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 原来的日志线程：pop带超时，生产者全部结束且队列取空后退出
+static long long consume(block_queue<string> &q, atomic<bool> &done)
+{
+    string s;
+    long long n = 0;
+    while (!done.load() || q.size() > 0)
+        if (q.pop(s, 10))
+            n++;
+    return n;
+}
+
+// 现在的刷新线程：close之后取完剩余数据pop返回false
+static long long consume(log_ring<string> &q, atomic<bool> &)
+{
+    string s;
+    long long n = 0;
+    while (q.pop(s))
+        n++;
+    return n;
+}
+
+static void finish(block_queue<string> &, atomic<bool> &done) { done = true; }
+static void finish(log_ring<string> &q, atomic<bool> &done)
+{
+    done = true;
+    q.close();
+}
+
+// threads个生产者各写入per条，返回每秒写入条数；got为消费者取出的条数，dropped为队列满的次数
+template <class Queue>
+static double run(Queue &q, int threads, long long per, long long *got, long long *dropped)
+{
+    atomic<bool> done(false);
+    atomic<long long> drop(0);
+    thread consumer([&] { *got = consume(q, done); });
+
+    double start = now_sec();
+    vector<thread> producers;
+    for (int t = 0; t < threads; t++)
+    {
+        producers.emplace_back([&] {
+            long long d = 0;
+            for (long long i = 0; i < per; i++)
+            {
+                string s = LINE;
+                if (!q.push(s))
+                    d++;
+            }
+            drop += d;
+        });
+    }
+    for (thread &th : producers)
+        th.join();
+    double used = now_sec() - start;
+
+    finish(q, done);
+    consumer.join();
+    *dropped = drop;
+    return threads * per / used;
+}
+
+int main(int argc, char *argv[])
+{
+    long long total = argc > 1 ? atoll(argv[1]) : 400000;
+    int capacity = argc > 2 ? atoi(argv[2]) : 1 << 19;
+
+    printf("threads   block_queue(M/s)  dropped   log_ring(M/s)  dropped   consumed\n");
+    for (int threads : {1, 2, 4, 8, 16, 32, 64})
+    {
+        long long per = total / threads;
+        long long got_a = 0, got_b = 0, drop_a = 0, drop_b = 0;
+        block_queue<string> bq(capacity);
+        double a = run(bq, threads, per, &got_a, &drop_a);
+        log_ring<string> ring(capacity);
+        double b = run(ring, threads, per, &got_b, &drop_b);
+        printf("%7d   %16.2f  %7lld   %13.2f  %7lld   %lld/%lld\n",
+               threads, a / 1e6, drop_a, b / 1e6, drop_b, got_a, got_b);
+    }
+    return 0;
+}
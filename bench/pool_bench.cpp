@@ -0,0 +1,148 @@
+/*************************************************************
+*连接池取放测试：无锁的connection_pool与locker+cond保护的链表（原来的连接池结构）对比
+*多个线程不断GetConnection后立即ReleaseConnection，输出每秒取放次数和最长等待时间
+*连接数少于线程数时取连接需要等待，测试等待与唤醒的开销
+*用法：pool_bench [连接数] [线程数] [每组的秒数]
+*单独编译：g++ -O2 -std=c++17 bench/pool_bench.cpp CGlmysql/sql_connection_pool.cpp log/log.cpp -o pool_bench -lpthread
+*（mysql客户端函数在本文件中用空实现代替，需要mysql的头文件，不需要链接客户端库，也不需要数据库）
+**************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <list>
+#include <thread>
+#include <vector>
+#include "../CGlmysql/sql_connection_pool.h"
+
+using namespace std;
+
+// 连接池用到的客户端函数，每个连接是一个独立的对象，取放时不与服务端通信
+MYSQL *mysql_init(MYSQL *mysql)
+{
+    return mysql ? mysql : new MYSQL();
+}
+MYSQL *mysql_real_connect(MYSQL *mysql, const char *, const char *, const char *, const char *,
+                          unsigned int, const char *, unsigned long)
+{
+    return mysql;
+}
+int mysql_options(MYSQL *, enum mysql_option, const void *) { return 0; }
+int mysql_ping(MYSQL *) { return 0; }
+const char *mysql_error(MYSQL *) { return ""; }
+void mysql_close(MYSQL *mysql) { delete mysql; }
+// 返回值在MySQL和MariaDB的头文件中分别为bool和my_bool
+decltype(mysql_stmt_close(nullptr)) mysql_stmt_close(MYSQL_STMT *) { return 0; }
+
+// 测试中不使用预处理语句，这里的定义只为链接
+const char *const sql_statements[STMT_COUNT] = {"", ""};
+MYSQL_STMT *sql_prepare(MYSQL *, SQL_STATEMENT) { return nullptr; }
+
+static long long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// 原来的结构：所有线程争抢同一把锁和同一个链表，没有空闲连接时在条件变量上等待
+class locked_pool
+{
+public:
+    void init(int max_conn)
+    {
+        for (int i = 0; i < max_conn; i++)
+            m_list.push_front(new MYSQL());
+    }
+    MYSQL *GetConnection()
+    {
+        long long start = now_us();
+        m_lock.lock();
+        while (m_list.empty())
+            m_cond.wait(m_lock.get());
+        MYSQL *con = m_list.front();
+        m_list.pop_front();
+        long long wait = now_us() - start;
+        if (wait > m_max_wait_us)
+            m_max_wait_us = wait;
+        m_lock.unlock();
+        return con;
+    }
+    bool ReleaseConnection(MYSQL *con)
+    {
+        m_lock.lock();
+        m_list.push_front(con);
+        m_lock.unlock();
+        m_cond.signal();
+        return true;
+    }
+    long long max_wait_us() { return m_max_wait_us; }
+
+private:
+    list<MYSQL *> m_list;
+    locker m_lock;
+    cond m_cond;
+    long long m_max_wait_us = 0;
+};
+
+// threads个线程取放seconds秒，返回每秒取放次数，fails为取连接失败的次数
+template <class Pool>
+static double run(Pool *pool, int threads, int seconds, long long *fails)
+{
+    atomic<bool> go(false), stop(false);
+    atomic<long long> ops(0), failed(0);
+    vector<thread> ts;
+    for (int t = 0; t < threads; t++)
+    {
+        ts.emplace_back([&] {
+            while (!go.load())
+                this_thread::yield();
+            long long n = 0, f = 0;
+            while (!stop.load(memory_order_relaxed))
+            {
+                MYSQL *con = pool->GetConnection();
+                if (!con)
+                {
+                    f++;
+                    continue;
+                }
+                pool->ReleaseConnection(con);
+                n++;
+            }
+            ops += n;
+            failed += f;
+        });
+    }
+    long long start = now_us();
+    go = true;
+    sleep(seconds);
+    stop = true;
+    for (thread &th : ts)
+        th.join();
+    *fails = failed;
+    return ops * 1e6 / (now_us() - start);
+}
+
+int main(int argc, char *argv[])
+{
+    int max_conn = argc > 1 ? atoi(argv[1]) : 64;
+    int threads = argc > 2 ? atoi(argv[2]) : 64;
+    int seconds = argc > 3 ? atoi(argv[3]) : 2;
+
+    long long fails = 0;
+    locked_pool locked;
+    locked.init(max_conn);
+    double a = run(&locked, threads, seconds, &fails);
+
+    // 预先建立全部连接，idle_timeout、ping_interval足够长，测试期间不回收、不检查连接
+    connection_pool *pool = connection_pool::GetInstance();
+    pool->init("localhost", "bench", "bench", "bench", 3306, max_conn, 1, max_conn, 3600, 3600, 5000);
+    double b = run(pool, threads, seconds, &fails);
+    connection_pool::stats st = pool->GetStats();
+
+    printf("%d connections, %d threads\n", max_conn, threads);
+    printf("  locker+cond list: %6.2f M ops/s, max wait %lld us\n", a / 1e6, locked.max_wait_us());
+    printf("  connection_pool:  %6.2f M ops/s, max wait %lld us, %lld failed\n", b / 1e6, st.max_wait_us, fails);
+    return 0;
+}
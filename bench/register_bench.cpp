@@ -0,0 +1,125 @@
+/*************************************************************
+*注册测试：拼接SQL字符串后mysql_query（原来do_request的注册方式）与连接上缓存的预处理语句对比
+*两种方式各注册N个新用户，输出每秒注册数；另外对比登录查询，结束后删除测试中插入的用户
+*需要可用的MySQL数据库和webserver使用的user表
+*用法：register_bench 主机 用户名 密码 数据库名 [端口] [每种方式的次数]
+*单独编译：g++ -O2 -std=c++17 bench/register_bench.cpp CGlmysql/sql_connection_pool.cpp CGlmysql/sql_statement.cpp log/log.cpp -o register_bench -lmysqlclient -lpthread
+**************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../CGlmysql/sql_connection_pool.h"
+
+using namespace std;
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 与原来的注册分支相同：用户名和密码直接拼接进SQL，数据库每次重新解析
+static bool insert_string(MYSQL *mysql, const char *name, const char *password)
+{
+    char *sql_insert = (char *)malloc(sizeof(char) * 200);
+    strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
+    strcat(sql_insert, "'");
+    strcat(sql_insert, name);
+    strcat(sql_insert, "', '");
+    strcat(sql_insert, password);
+    strcat(sql_insert, "')");
+    int res = mysql_query(mysql, sql_insert);
+    free(sql_insert);
+    return res == 0;
+}
+
+static bool select_string(MYSQL *mysql, const char *name)
+{
+    char sql[200];
+    snprintf(sql, sizeof(sql), "SELECT passwd FROM user WHERE username = '%s'", name);
+    if (mysql_query(mysql, sql) != 0)
+        return false;
+    MYSQL_RES *result = mysql_store_result(mysql);
+    if (!result)
+        return false;
+    bool found = mysql_fetch_row(result) != nullptr;
+    mysql_free_result(result);
+    return found;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 5)
+    {
+        printf("usage: %s host user password database [port] [count]\n", argv[0]);
+        return 1;
+    }
+    int port = argc > 5 ? atoi(argv[5]) : 3306;
+    int count = argc > 6 ? atoi(argv[6]) : 5000;
+
+    connection_pool *pool = connection_pool::GetInstance();
+    if (!pool->init(argv[1], argv[2], argv[3], argv[4], port, 1, 1))
+    {
+        printf("cannot connect to %s:%d\n", argv[1], port);
+        return 1;
+    }
+    MYSQL *mysql = pool->GetConnection();
+
+    // 用户名带上进程号，重复运行不会与之前的数据冲突
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "bench%d_", (int)getpid());
+    char name[64], password[64];
+
+    double start = now_sec();
+    int ok = 0;
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(name, sizeof(name), "%ss%d", prefix, i);
+        snprintf(password, sizeof(password), "pw%d", i);
+        ok += insert_string(mysql, name, password);
+    }
+    double string_insert = ok / (now_sec() - start);
+
+    start = now_sec();
+    ok = 0;
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(name, sizeof(name), "%sp%d", prefix, i);
+        snprintf(password, sizeof(password), "pw%d", i);
+        MYSQL_STMT *stmt = pool->GetStatement(mysql, STMT_INSERT_USER);
+        ok += stmt && sql_insert_user(stmt, name, password) == 0;
+    }
+    double stmt_insert = ok / (now_sec() - start);
+
+    start = now_sec();
+    ok = 0;
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(name, sizeof(name), "%ss%d", prefix, i);
+        ok += select_string(mysql, name);
+    }
+    double string_select = ok / (now_sec() - start);
+
+    start = now_sec();
+    ok = 0;
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(name, sizeof(name), "%sp%d", prefix, i);
+        MYSQL_STMT *stmt = pool->GetStatement(mysql, STMT_SELECT_USER);
+        ok += stmt && sql_select_user(stmt, name, password, sizeof(password)) == 1;
+    }
+    double stmt_select = ok / (now_sec() - start);
+
+    char sql[128];
+    snprintf(sql, sizeof(sql), "DELETE FROM user WHERE username LIKE '%s%%'", prefix);
+    mysql_query(mysql, sql);
+    pool->ReleaseConnection(mysql);
+
+    printf("%d users per method\n", count);
+    printf("  register: string query %8.0f/s, prepared statement %8.0f/s\n", string_insert, stmt_insert);
+    printf("  login:    string query %8.0f/s, prepared statement %8.0f/s\n", string_select, stmt_select);
+    return 0;
+}
@@ -0,0 +1,147 @@
+/*************************************************************
+*请求头扫描测试：http_scanner的逐字节、SSE4.2、AVX2三种实现分别扫描同一批请求头，输出每周期处理的字节数
+*另外对比请求头识别：完美哈希match_header与逐个strncasecmp
+*直接包含http_scanner.cpp以便调用其中的各个实现，CPU不支持的实现跳过
+*周期数用rdtsc读取，是TSC的参考周期，与睿频后的核心周期不完全相同
+*单独编译：g++ -O2 -std=c++17 bench/scanner_bench.cpp -o scanner_bench
+**************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "../http/http_scanner.cpp"
+#ifdef HTTP_SCANNER_X86
+#include <x86intrin.h>
+#endif
+
+using namespace std;
+using namespace http_scanner;
+
+static unsigned long long cycles()
+{
+#ifdef HTTP_SCANNER_X86
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+// 与parse_line相同的用法：先找行尾或':'，找到':'后只找行尾，再跳过"\r\n"
+static size_t scan_all(find_func find, const char *p, const char *end)
+{
+    size_t lines = 0;
+    while (p < end)
+    {
+        const char *q = find(p, end, true);
+        if (q < end && *q == ':')
+            q = find(q + 1, end, false);
+        lines++;
+        p = q + 2;
+    }
+    return lines;
+}
+
+// 浏览器常见的请求头，另一组带一个2KB的Cookie，测试长行
+static string make_requests(size_t total, bool long_cookie)
+{
+    string cookie = "Cookie: session=";
+    cookie.append(long_cookie ? 2048 : 40, 'c');
+    string req = "GET /static/js/app.3f9c2b.js HTTP/1.1\r\n"
+                 "Host: www.example.com\r\n"
+                 "Connection: keep-alive\r\n"
+                 "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/126.0 Safari/537.36\r\n"
+                 "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+                 "Accept-Encoding: gzip, deflate, br\r\n"
+                 "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+                 "If-None-Match: \"6ad462c2-2dc6c0\"\r\n" +
+                 cookie + "\r\n\r\n";
+    string buf;
+    while (buf.size() < total)
+        buf += req;
+    return buf;
+}
+
+static void bench_scan(const char *title, const string &buf, int rounds)
+{
+    struct impl
+    {
+        const char *name;
+        find_func find;
+        bool supported;
+    };
+    vector<impl> impls = {{"scalar", find_scalar, true}};
+#ifdef HTTP_SCANNER_X86
+    __builtin_cpu_init();
+    impls.push_back({"sse4.2", find_sse42, (bool)__builtin_cpu_supports("sse4.2")});
+    impls.push_back({"avx2", find_avx2, (bool)__builtin_cpu_supports("avx2")});
+#endif
+    printf("%s, %zu bytes x %d\n", title, buf.size(), rounds);
+    for (const impl &im : impls)
+    {
+        if (!im.supported)
+        {
+            printf("  %-7s not supported\n", im.name);
+            continue;
+        }
+        size_t lines = 0;
+        unsigned long long start = cycles();
+        for (int r = 0; r < rounds; r++)
+            lines += scan_all(im.find, buf.data(), buf.data() + buf.size());
+        unsigned long long used = cycles() - start;
+        printf("  %-7s %6.2f bytes/cycle  (%zu lines)\n", im.name, (double)buf.size() * rounds / used, lines);
+    }
+}
+
+// 原来parse_headers的方式：逐个strncasecmp比较字段名
+static int match_chain(const char *name, size_t len)
+{
+    for (size_t i = 0; i < sizeof(g_header_names) / sizeof(g_header_names[0]); i++)
+    {
+        size_t n = strlen(g_header_names[i]);
+        if (len == n && strncasecmp(name, g_header_names[i], n) == 0)
+            return (int)i + 1;
+    }
+    return 0;
+}
+
+static void bench_match(int rounds)
+{
+    const char *names[] = {"Host", "Connection", "User-Agent", "Accept", "Accept-Encoding",
+                           "Accept-Language", "If-None-Match", "Cookie", "Content-Length", "Range"};
+    const int count = sizeof(names) / sizeof(names[0]);
+    size_t lens[count];
+    for (int i = 0; i < count; i++)
+        lens[i] = strlen(names[i]);
+
+    long sum = 0;
+    unsigned long long start = cycles();
+    for (int r = 0; r < rounds; r++)
+        for (int i = 0; i < count; i++)
+            sum += match_chain(names[i], lens[i]);
+    unsigned long long chain = cycles() - start;
+
+    start = cycles();
+    for (int r = 0; r < rounds; r++)
+        for (int i = 0; i < count; i++)
+            sum += match_header(names[i], lens[i]);
+    unsigned long long hash = cycles() - start;
+
+    printf("header names (%d per request)\n", count);
+    printf("  strncasecmp chain %6.1f cycles/header\n", (double)chain / rounds / count);
+    printf("  perfect hash      %6.1f cycles/header  (%ld)\n", (double)hash / rounds / count, sum);
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 2000;
+    printf("selected implementation: %s\n", impl_name());
+    bench_scan("typical request heads", make_requests(64 * 1024, false), rounds);
+    bench_scan("request heads with a 2KB cookie", make_requests(64 * 1024, true), rounds);
+    bench_match(rounds * 100);
+    return 0;
+}
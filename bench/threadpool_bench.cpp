@@ -0,0 +1,178 @@
+/*************************************************************
+*线程池队列测试：工作窃取线程池与单个locker+sem任务队列（原来的线程池结构）对比
+*多个提交线程（相当于事件循环）不断append，工作线程执行一段固定的计算代替process()，
+*输出每秒处理的任务数和平均排队时间
+*用法：threadpool_bench [任务数] [每个任务的计算量]
+*单独编译：g++ -O2 -std=c++17 bench/threadpool_bench.cpp -o threadpool_bench -lpthread
+*（包含sql_connection_pool.h，需要mysql的头文件，不需要链接客户端库）
+**************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+#include <atomic>
+#include <list>
+#include <thread>
+#include <vector>
+#include "../threadpool/threadpool.h"
+
+using namespace std;
+
+// 线程池模板只在连接池不为空时使用connectionRAII，测试中连接池为空，这里的定义只为链接
+connectionRAII::connectionRAII(MYSQL **SQL, connection_pool *) { *SQL = nullptr; }
+connectionRAII::~connectionRAII() {}
+
+static int g_work = 200;
+static atomic<long long> g_done(0);
+
+// 代替http_conn，只提供线程池用到的接口
+struct fake_conn
+{
+    MYSQL *mysql = nullptr;
+    volatile unsigned long sink = 0;
+
+    bool read_once() { return true; }
+    void process()
+    {
+        unsigned long x = sink;
+        for (int i = 0; i < g_work; i++)
+            x = x * 6364136223846793005UL + 1442695040888963407UL;
+        sink = x;
+    }
+    bool write() { return true; }
+    void close_conn() {}
+    bool pending_request() { return false; }
+};
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// 原来的结构：所有提交线程和工作线程争抢同一把锁和同一个链表
+class locked_pool
+{
+public:
+    locked_pool(int thread_number, int max_requests) : m_max_requests(max_requests), m_stop(false)
+    {
+        for (int i = 0; i < thread_number; i++)
+            m_threads.emplace_back([this] { run(); });
+    }
+    ~locked_pool()
+    {
+        m_stop = true;
+        for (size_t i = 0; i < m_threads.size(); i++)
+            m_queuestat.post();
+        for (thread &t : m_threads)
+            t.join();
+    }
+    bool append(fake_conn *request, int)
+    {
+        m_queuelocker.lock();
+        if ((int)m_workqueue.size() >= m_max_requests)
+        {
+            m_queuelocker.unlock();
+            return false;
+        }
+        m_workqueue.push_back(make_pair(request, now_ns()));
+        m_queuelocker.unlock();
+        m_queuestat.post();
+        return true;
+    }
+    double avg_wait_us() { return m_tasks ? m_wait_ns / 1000.0 / m_tasks : 0; }
+
+private:
+    void run()
+    {
+        while (true)
+        {
+            m_queuestat.wait();
+            if (m_stop)
+                break;
+            m_queuelocker.lock();
+            pair<fake_conn *, long long> t = m_workqueue.front();
+            m_workqueue.pop_front();
+            m_tasks++;
+            m_wait_ns += now_ns() - t.second;
+            m_queuelocker.unlock();
+            t.first->process();
+            g_done.fetch_add(1, memory_order_relaxed);
+        }
+    }
+
+    int m_max_requests;
+    atomic<bool> m_stop;
+    list<pair<fake_conn *, long long>> m_workqueue;
+    locker m_queuelocker;
+    sem m_queuestat;
+    long long m_tasks = 0;
+    long long m_wait_ns = 0;
+    vector<thread> m_threads;
+};
+
+static void on_done(fake_conn *, void *)
+{
+    g_done.fetch_add(1, memory_order_relaxed);
+}
+
+// producers个线程共提交total个任务，提交失败（队列满）时让出CPU重试
+template <class Pool>
+static double run(Pool &pool, int producers, long long total, vector<fake_conn> &conns)
+{
+    g_done = 0;
+    long long start = now_ns();
+    vector<thread> threads;
+    for (int p = 0; p < producers; p++)
+    {
+        threads.emplace_back([&, p] {
+            for (long long i = p; i < total; i += producers)
+            {
+                fake_conn *c = &conns[i % conns.size()];
+                while (!pool.append(c, 0))
+                    sched_yield();
+            }
+        });
+    }
+    for (thread &t : threads)
+        t.join();
+    while (g_done.load(memory_order_relaxed) < total)
+        sched_yield();
+    return total / ((now_ns() - start) / 1e9);
+}
+
+int main(int argc, char *argv[])
+{
+    long long total = argc > 1 ? atoll(argv[1]) : 1000000;
+    if (argc > 2)
+        g_work = atoi(argv[2]);
+    vector<fake_conn> conns(4096);
+
+    printf("tasks %lld, work %d, cpus %u\n", total, g_work, thread::hardware_concurrency());
+    printf("producers workers   locked(Mtask/s) wait_us   stealing(Mtask/s) wait_us steals\n");
+    for (int producers : {1, 4})
+    {
+        for (int workers : {1, 4, 8, 16})
+        {
+            double a, b, wait_a, wait_b;
+            long long steals;
+            {
+                locked_pool pool(workers, 10000);
+                a = run(pool, producers, total, conns);
+                wait_a = pool.avg_wait_us();
+            }
+            {
+                threadpool<fake_conn> pool(nullptr, workers, 10000);
+                pool.set_done(on_done);
+                b = run(pool, producers, total, conns);
+                threadpool<fake_conn>::stats s = pool.get_stats();
+                wait_b = s.tasks ? s.wait_ns / 1000.0 / s.tasks : 0;
+                steals = s.steals;
+            }
+            printf("%9d %7d   %15.2f %7.1f   %17.2f %7.1f %6lld\n", producers, workers,
+                   a / 1e6, wait_a, b / 1e6, wait_b, steals);
+        }
+    }
+    return 0;
+}
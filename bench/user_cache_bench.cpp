@@ -0,0 +1,126 @@
+/*************************************************************
+*用户缓存测试：32个线程混合登录（查找）和注册（插入），user_cache与map加一把全局锁（原来的users）对比
+*预先放入10万个用户，登录随机查找已有用户并校验密码，注册插入新用户，输出每秒操作数
+*用法：user_cache_bench [线程数] [每组的秒数]
+*单独编译：g++ -O2 -std=c++17 bench/user_cache_bench.cpp CGlmysql/user_cache.cpp -o user_cache_bench -lpthread
+**************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../CGlmysql/user_cache.h"
+
+using namespace std;
+
+static const int PRELOAD = 100000;
+
+// 原来的结构：注册时加锁插入，这里登录时也加锁（原来登录不加锁，存在数据竞争）
+class locked_map
+{
+public:
+    const char *find(const char *name)
+    {
+        m_lock.lock();
+        map<string, string>::iterator it = m_users.find(name);
+        const char *p = it == m_users.end() ? nullptr : it->second.c_str();
+        m_lock.unlock();
+        return p;
+    }
+    bool insert(const char *name, const char *passwd)
+    {
+        m_lock.lock();
+        bool ok = m_users.insert(make_pair(string(name), string(passwd))).second;
+        m_lock.unlock();
+        return ok;
+    }
+
+private:
+    map<string, string> m_users;
+    locker m_lock;
+};
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 每个线程按register_pct的比例注册新用户，其余为登录；返回每秒操作数，bad为登录校验失败的次数
+template <class Cache>
+static double run(Cache *cache, int threads, int seconds, int register_pct, long long *bad)
+{
+    atomic<bool> go(false), stop(false);
+    atomic<long long> ops(0), failed(0);
+    vector<thread> ts;
+    for (int t = 0; t < threads; t++)
+    {
+        ts.emplace_back([&, t] {
+            while (!go.load())
+                this_thread::yield();
+            unsigned seed = t * 7919 + 1;
+            long long n = 0, f = 0;
+            int next = 0;
+            char name[48];
+            while (!stop.load(memory_order_relaxed))
+            {
+                if (rand_r(&seed) % 100 < register_pct)
+                {
+                    snprintf(name, sizeof(name), "new%d_%d_%d", register_pct, t, next++);
+                    cache->insert(name, "pw");
+                }
+                else
+                {
+                    snprintf(name, sizeof(name), "user%d", rand_r(&seed) % PRELOAD);
+                    const char *p = cache->find(name);
+                    if (!p || strcmp(p, "pw") != 0)
+                        f++;
+                }
+                n++;
+            }
+            ops += n;
+            failed += f;
+        });
+    }
+    double start = now_sec();
+    go = true;
+    sleep(seconds);
+    stop = true;
+    for (thread &th : ts)
+        th.join();
+    *bad = failed;
+    return ops / (now_sec() - start);
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 32;
+    int seconds = argc > 2 ? atoi(argv[2]) : 2;
+
+    locked_map locked;
+    user_cache *cache = user_cache::get_instance();
+    char name[32];
+    for (int i = 0; i < PRELOAD; i++)
+    {
+        snprintf(name, sizeof(name), "user%d", i);
+        locked.insert(name, "pw");
+        cache->insert(name, "pw");
+    }
+
+    printf("%d threads, %d users preloaded\n", threads, PRELOAD);
+    printf("register%%   map+lock(M ops/s)   user_cache(M ops/s)   bad logins\n");
+    for (int pct : {0, 1, 10, 50})
+    {
+        long long bad_a = 0, bad_b = 0;
+        double a = run(&locked, threads, seconds, pct, &bad_a);
+        double b = run(cache, threads, seconds, pct, &bad_b);
+        printf("%9d   %17.2f   %19.2f   %lld/%lld\n", pct, a / 1e6, b / 1e6, bad_a, bad_b);
+    }
+    return 0;
+}
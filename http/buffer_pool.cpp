@@ -0,0 +1,95 @@
+#include <stdlib.h>
+#include "buffer_pool.h"
+
+namespace buffer_pool
+{
+
+static const int CLASS_NUM = 7;          // 1K,2K,4K,8K,16K,32K,64K
+static const int MAX_CACHED = 64;        // 每个等级每个线程最多缓存的空闲缓冲区数
+
+// 空闲缓冲区本身的前几个字节用来保存链表指针
+struct free_node
+{
+    free_node *next;
+};
+
+// 每个线程自己的空闲链表，线程退出时释放
+struct thread_cache
+{
+    free_node *heads[CLASS_NUM];
+    int counts[CLASS_NUM];
+
+    thread_cache()
+    {
+        for (int i = 0; i < CLASS_NUM; i++)
+        {
+            heads[i] = nullptr;
+            counts[i] = 0;
+        }
+    }
+
+    ~thread_cache()
+    {
+        for (int i = 0; i < CLASS_NUM; i++)
+        {
+            while (heads[i])
+            {
+                free_node *node = heads[i];
+                heads[i] = node->next;
+                free(node);
+            }
+        }
+    }
+};
+
+static thread_local thread_cache t_cache;
+
+// 返回大小等级，超过MAX_SIZE返回-1
+static int size_class(size_t size)
+{
+    size_t cls_size = MIN_SIZE;
+    for (int i = 0; i < CLASS_NUM; i++, cls_size <<= 1)
+    {
+        if (size <= cls_size)
+            return i;
+    }
+    return -1;
+}
+
+char *alloc(size_t size, size_t *real_size)
+{
+    int cls = size_class(size);
+    if (cls < 0)
+    {
+        *real_size = size;
+        return (char *)malloc(size);
+    }
+
+    *real_size = MIN_SIZE << cls;
+    free_node *node = t_cache.heads[cls];
+    if (node)
+    {
+        t_cache.heads[cls] = node->next;
+        t_cache.counts[cls]--;
+        return (char *)node;
+    }
+    return (char *)malloc(*real_size);
+}
+
+void release(char *buf, size_t size)
+{
+    if (!buf)
+        return;
+    int cls = size_class(size);
+    if (cls < 0 || (MIN_SIZE << cls) != size || t_cache.counts[cls] >= MAX_CACHED)
+    {
+        free(buf);
+        return;
+    }
+    free_node *node = (free_node *)buf;
+    node->next = t_cache.heads[cls];
+    t_cache.heads[cls] = node;
+    t_cache.counts[cls]++;
+}
+
+}
@@ -0,0 +1,21 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+
+// 连接读写缓冲区的分配器
+// 按2的幂划分大小等级（1KB~64KB），每个线程为每个等级缓存一个空闲链表，
+// 同一线程上的分配和归还不需要加锁；超过缓存上限的缓冲区直接还给系统
+// 连接空闲时把缓冲区归还，内存占用随活跃流量变化，而不是随连接数（fd数）变化
+namespace buffer_pool
+{
+    static const size_t MIN_SIZE = 1024;      // 最小等级
+    static const size_t MAX_SIZE = 64 * 1024; // 最大等级，更大的请求直接malloc
+
+    // 分配至少size字节的缓冲区，*real_size返回实际大小
+    char *alloc(size_t size, size_t *real_size);
+    // 归还缓冲区，size必须是alloc返回的实际大小
+    void release(char *buf, size_t size);
+}
+
+#endif
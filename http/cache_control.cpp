@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "cache_control.h"
+
+void cache_control::init(const vector<pair<string, string>> &rules, const string &default_value)
+{
+    m_rules = rules;
+    m_default = default_value;
+    // 最长前缀优先，按前缀长度从长到短排列后第一个匹配的就是结果
+    stable_sort(m_rules.begin(), m_rules.end(),
+                [](const pair<string, string> &a, const pair<string, string> &b)
+                { return a.first.size() > b.first.size(); });
+}
+
+const char *cache_control::lookup(const char *url) const
+{
+    for (const auto &rule : m_rules)
+    {
+        if (strncmp(url, rule.first.c_str(), rule.first.size()) == 0)
+            return rule.second.empty() ? nullptr : rule.second.c_str();
+    }
+    return m_default.empty() ? nullptr : m_default.c_str();
+}
+
+int cache_control::make_etag(const struct stat &st, char *buf, int len, const char *suffix)
+{
+    if (suffix && *suffix)
+        return snprintf(buf, len, "\"%lx-%lx-%s\"", (unsigned long)st.st_mtime, (unsigned long)st.st_size, suffix);
+    return snprintf(buf, len, "\"%lx-%lx\"", (unsigned long)st.st_mtime, (unsigned long)st.st_size);
+}
+
+int cache_control::format_date(time_t t, char *buf, int len)
+{
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    return strftime(buf, len, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+time_t cache_control::parse_date(const char *value)
+{
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(value, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!end)
+        return -1;
+    return timegm(&tm);
+}
+
+bool cache_control::etag_match(const char *if_none_match, const char *etag)
+{
+    size_t etag_len = strlen(etag);
+    const char *p = if_none_match;
+    while (*p)
+    {
+        // 跳过分隔的逗号和空白
+        p += strspn(p, ", \t");
+        if (!*p)
+            break;
+        if (*p == '*')
+            return true;
+        // 弱比较，忽略W/前缀
+        if (strncmp(p, "W/", 2) == 0)
+            p += 2;
+        size_t len = strcspn(p, ", \t");
+        if (len == etag_len && strncmp(p, etag, len) == 0)
+            return true;
+        p += len;
+    }
+    return false;
+}
@@ -0,0 +1,55 @@
+#ifndef CACHE_CONTROL_H
+#define CACHE_CONTROL_H
+
+#include <sys/stat.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <utility>
+
+using namespace std;
+
+// 静态文件的缓存策略和条件请求的校验
+// 按URL路径前缀配置Cache-Control，最长前缀优先；
+// ETag和Last-Modified由stat得到的修改时间和大小生成，用于If-None-Match、If-Modified-Since返回304
+class cache_control
+{
+public:
+    static const int ETAG_LEN = 48;  // ETag缓冲区大小
+    static const int DATE_LEN = 32;  // HTTP日期缓冲区大小
+
+public:
+    static cache_control *get_instance()
+    {
+        static cache_control instance;
+        return &instance;
+    }
+
+    // rules为(路径前缀, Cache-Control字段值)，如("/static/", "max-age=86400")
+    // 没有匹配的前缀时使用default_value，为空则不发送Cache-Control
+    // 需要在服务启动、page_cache初始化之前调用，之后只读，查找不加锁
+    void init(const vector<pair<string, string>> &rules, const string &default_value = "");
+
+    // 返回url对应的Cache-Control字段值，没有配置返回nullptr
+    const char *lookup(const char *url) const;
+
+    // 生成形如"5f1e2a3b-4c1"（修改时间-大小，十六进制）的强ETag，带双引号
+    // 压缩后的内容与原文件是不同的表示，suffix为编码名，如"5f1e2a3b-4c1-gzip"
+    static int make_etag(const struct stat &st, char *buf, int len, const char *suffix = nullptr);
+    // 生成IMF-fixdate格式的日期，如"Sun, 06 Nov 1994 08:49:37 GMT"
+    static int format_date(time_t t, char *buf, int len);
+    // 解析IMF-fixdate格式的日期，失败返回-1
+    static time_t parse_date(const char *value);
+    // If-None-Match中是否有与etag匹配的项（弱比较，"*"匹配任意）
+    static bool etag_match(const char *if_none_match, const char *etag);
+
+private:
+    cache_control() {}
+    ~cache_control() {}
+
+private:
+    vector<pair<string, string>> m_rules; // 按前缀长度从长到短排列
+    string m_default;
+};
+
+#endif
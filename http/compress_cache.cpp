@@ -0,0 +1,275 @@
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <time.h>
+#include <zlib.h>
+#include "compress_cache.h"
+
+const char *const encoding_names[ENC_COUNT] = {"", "gzip", "br"};
+const char *const encoding_suffixes[ENC_COUNT] = {"", ".gz", ".br"};
+
+int accept_encodings(const char *accept_encoding)
+{
+    if (!accept_encoding)
+        return 0;
+    int accepted = 0;
+    int rejected = 0;
+    bool any = false;
+    const char *p = accept_encoding;
+    while (*p)
+    {
+        p += strspn(p, ", \t");
+        if (!*p)
+            break;
+        size_t len = strcspn(p, ";, \t");
+        const char *name = p;
+        p += len;
+
+        // 可选的;q=值，q=0表示不接受
+        bool zero = false;
+        p += strspn(p, " \t");
+        if (*p == ';')
+        {
+            const char *q = strchr(p, '=');
+            const char *end = p + strcspn(p, ",");
+            if (q && q < end)
+                zero = atof(q + 1) <= 0;
+            p = end;
+        }
+
+        int bit = 0;
+        if (len == 4 && strncasecmp(name, "gzip", 4) == 0)
+            bit = 1 << ENC_GZIP;
+        else if (len == 2 && strncasecmp(name, "br", 2) == 0)
+            bit = 1 << ENC_BR;
+        else if (len == 1 && *name == '*')
+        {
+            any = !zero;
+            continue;
+        }
+        if (zero)
+            rejected |= bit;
+        else
+            accepted |= bit;
+    }
+    // "*"表示接受其他没有列出的编码
+    if (any)
+        accepted |= ((1 << ENC_GZIP) | (1 << ENC_BR)) & ~rejected;
+    return accepted & ~rejected;
+}
+
+bool is_compressible(const char *path)
+{
+    static const char *const exts[] = {".html", ".htm", ".css", ".js", ".json", ".txt", ".xml", ".svg"};
+    const char *dot = strrchr(path, '.');
+    if (!dot)
+        return false;
+    for (const char *ext : exts)
+    {
+        if (strcasecmp(dot, ext) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool gzip_compress(const char *data, size_t len, string *out, int level)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    // windowBits为15+16时输出gzip格式
+    if (deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    out->resize(deflateBound(&zs, len));
+    zs.next_in = (Bytef *)data;
+    zs.avail_in = len;
+    zs.next_out = (Bytef *)&(*out)[0];
+    zs.avail_out = out->size();
+    int ret = deflate(&zs, Z_FINISH);
+    out->resize(zs.total_out);
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END;
+}
+
+// 缓存项占用的字节数：压缩结果加上路径和结构本身
+// "不值得压缩"的空结果也有开销，按这个大小计入m_bytes，同样会被LRU淘汰，数量不会无限增长
+static size_t entry_cost(const compressed_file *file)
+{
+    return sizeof(compressed_file) + file->path.size() + file->data.size();
+}
+
+static long long now_us(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+compress_cache::compress_cache()
+{
+    m_enable = true;
+    m_max_bytes = 16 * 1024 * 1024;
+    m_max_file_size = 1024 * 1024;
+    m_cpu_budget_us = 200000; // 每秒最多200ms CPU用于压缩
+    m_level = 6;
+    m_bytes = 0;
+    m_tokens_us = m_cpu_budget_us;
+    m_last_refill_us = now_us(CLOCK_MONOTONIC);
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+compress_cache::~compress_cache()
+{
+    m_lock.lock();
+    for (auto &it : m_files)
+    {
+        compressed_file *file = it.second;
+        file->cached = false;
+        if (file->refs == 0)
+            delete file;
+    }
+    m_files.clear();
+    m_lru.clear();
+    m_lock.unlock();
+}
+
+void compress_cache::init(bool enable, size_t max_bytes, off_t max_file_size, long long cpu_budget_us, int level)
+{
+    m_lock.lock();
+    m_enable = enable;
+    m_max_bytes = max_bytes;
+    m_max_file_size = max_file_size;
+    m_cpu_budget_us = cpu_budget_us;
+    m_tokens_us = cpu_budget_us;
+    m_level = level;
+    m_lock.unlock();
+}
+
+// 按经过的时间补充令牌，最多攒一秒的预算
+bool compress_cache::take_budget_locked()
+{
+    long long now = now_us(CLOCK_MONOTONIC);
+    m_tokens_us += (now - m_last_refill_us) * m_cpu_budget_us / 1000000;
+    if (m_tokens_us > m_cpu_budget_us)
+        m_tokens_us = m_cpu_budget_us;
+    m_last_refill_us = now;
+    return m_tokens_us > 0;
+}
+
+compressed_file *compress_cache::acquire(const char *path, const struct stat &st, const char *data)
+{
+    if (!data || st.st_size <= 0)
+        return nullptr;
+
+    m_lock.lock();
+    if (!m_enable || st.st_size > m_max_file_size)
+    {
+        m_lock.unlock();
+        return nullptr;
+    }
+
+    auto it = m_files.find(path);
+    if (it != m_files.end())
+    {
+        compressed_file *file = it->second;
+        if (file->dev == st.st_dev && file->ino == st.st_ino && file->size == st.st_size &&
+            file->mtime.tv_sec == st.st_mtim.tv_sec && file->mtime.tv_nsec == st.st_mtim.tv_nsec)
+        {
+            file->refs++;
+            m_lru.splice(m_lru.begin(), m_lru, file->lru_it);
+            m_stats.hits++;
+            if (!file->data.empty())
+            {
+                m_stats.bytes_in += file->size;
+                m_stats.bytes_out += file->data.size();
+            }
+            m_lock.unlock();
+            return file;
+        }
+        // 文件已被修改或替换，旧结果失效
+        remove_locked(file);
+    }
+
+    if (!take_budget_locked())
+    {
+        m_stats.rejected++;
+        m_lock.unlock();
+        return nullptr;
+    }
+    m_stats.misses++;
+    int level = m_level;
+    m_lock.unlock();
+
+    // 压缩放在锁外进行，用线程CPU时间计入预算
+    compressed_file *file = new compressed_file;
+    file->path = path;
+    file->dev = st.st_dev;
+    file->ino = st.st_ino;
+    file->mtime = st.st_mtim;
+    file->size = st.st_size;
+    file->refs = 1;
+    file->cached = false;
+    long long start = now_us(CLOCK_THREAD_CPUTIME_ID);
+    bool ok = gzip_compress(data, st.st_size, &file->data, level);
+    long long cost = now_us(CLOCK_THREAD_CPUTIME_ID) - start;
+    // 压缩后省不到十分之一就不值得，记下空结果以后不再尝试
+    if (!ok || file->data.size() * 10 > (size_t)st.st_size * 9)
+        file->data.clear();
+
+    m_lock.lock();
+    m_tokens_us -= cost;
+    m_stats.cpu_us += cost;
+    if (!file->data.empty())
+    {
+        m_stats.bytes_in += file->size;
+        m_stats.bytes_out += file->data.size();
+    }
+    if (m_files.count(path) == 0)
+    {
+        file->cached = true;
+        m_lru.push_front(file);
+        file->lru_it = m_lru.begin();
+        m_files[file->path] = file;
+        m_bytes += entry_cost(file);
+        evict_locked();
+    }
+    m_lock.unlock();
+    return file;
+}
+
+void compress_cache::release(compressed_file *file)
+{
+    if (!file)
+        return;
+    m_lock.lock();
+    bool dead = (--file->refs == 0 && !file->cached);
+    m_lock.unlock();
+    if (dead)
+        delete file;
+}
+
+// 从缓存中移除，仍被连接引用时等最后一个release再释放
+void compress_cache::remove_locked(compressed_file *file)
+{
+    m_files.erase(file->path);
+    m_lru.erase(file->lru_it);
+    m_bytes -= entry_cost(file);
+    file->cached = false;
+    if (file->refs == 0)
+        delete file;
+}
+
+void compress_cache::evict_locked()
+{
+    while (!m_lru.empty() && m_bytes > m_max_bytes)
+        remove_locked(m_lru.back());
+}
+
+compress_cache::stats compress_cache::get_stats()
+{
+    m_lock.lock();
+    stats s = m_stats;
+    s.files = m_files.size();
+    s.bytes = m_bytes;
+    m_lock.unlock();
+    return s;
+}
@@ -0,0 +1,105 @@
+#ifndef COMPRESS_CACHE_H
+#define COMPRESS_CACHE_H
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include "../lock/locker.h"
+
+using namespace std;
+
+// 内容编码，下标同时用于编码名、预压缩文件后缀
+enum ENCODING
+{
+    ENC_IDENTITY = 0,
+    ENC_GZIP,
+    ENC_BR,
+    ENC_COUNT
+};
+
+extern const char *const encoding_names[ENC_COUNT];    // "", "gzip", "br"
+extern const char *const encoding_suffixes[ENC_COUNT]; // "", ".gz", ".br"
+
+// 解析Accept-Encoding，返回客户端接受的编码的位掩码（1 << ENC_xxx），q=0的编码不计入
+int accept_encodings(const char *accept_encoding);
+// 按扩展名判断是否是值得压缩的文本类型
+bool is_compressible(const char *path);
+// gzip格式压缩，失败返回false
+bool gzip_compress(const char *data, size_t len, string *out, int level);
+
+// 缓存的一个gzip压缩结果
+struct compressed_file
+{
+    string path;
+    dev_t dev;             // 与cached_file一样用inode、修改时间、大小判断是否失效
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;            // 原文件大小
+    string data;           // 压缩后的内容，压缩效果不明显时为空，表示直接发送原文件
+    int refs;
+    bool cached;
+    list<compressed_file *>::iterator lru_it;
+};
+
+// 文本文件gzip压缩结果的缓存，第一次请求时压缩
+// 按压缩后字节数（加每项的开销）做LRU淘汰；压缩耗费的CPU时间按令牌桶限制在每秒cpu_budget_us微秒以内，
+// 超出预算时直接发送未压缩的内容，不让压缩拖慢其他请求
+class compress_cache
+{
+public:
+    struct stats
+    {
+        long long hits;
+        long long misses;       // 需要压缩的次数
+        long long rejected;     // 超出CPU预算未压缩的次数
+        long long bytes_in;     // 命中压缩结果的请求原本要发送的字节数
+        long long bytes_out;    // 实际发送的压缩后字节数
+        long long cpu_us;       // 压缩累计耗费的CPU时间（微秒）
+        long long files;
+        long long bytes;        // 当前缓存占用的字节数，包括压缩结果和每项的开销
+    };
+
+public:
+    static compress_cache *get_instance()
+    {
+        static compress_cache instance;
+        return &instance;
+    }
+
+    // enable为false时不做实时压缩（预压缩的.gz/.br文件仍然有效）
+    // max_bytes为缓存总大小上限（压缩结果加每项的开销），大于max_file_size的文件不压缩
+    void init(bool enable, size_t max_bytes, off_t max_file_size, long long cpu_budget_us, int level);
+
+    // data为path的完整内容（文件缓存中的映射），st为其stat信息
+    // 返回压缩结果，data为空表示不值得压缩；超出预算或不压缩时返回nullptr；成功后必须调用release
+    compressed_file *acquire(const char *path, const struct stat &st, const char *data);
+    void release(compressed_file *file);
+    stats get_stats();
+
+private:
+    compress_cache();
+    ~compress_cache();
+
+    bool take_budget_locked();
+    void remove_locked(compressed_file *file);
+    void evict_locked();
+
+private:
+    bool m_enable;
+    size_t m_max_bytes;
+    off_t m_max_file_size;
+    long long m_cpu_budget_us;
+    int m_level;
+
+    locker m_lock;
+    unordered_map<string, compressed_file *> m_files;
+    list<compressed_file *> m_lru;
+    size_t m_bytes;
+    long long m_tokens_us;      // 令牌桶中剩余的CPU时间
+    long long m_last_refill_us; // 上次补充令牌的时间
+    stats m_stats;
+};
+
+#endif
@@ -0,0 +1,173 @@
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "file_cache.h"
+
+file_cache::file_cache()
+{
+    m_enable = true;
+    m_max_bytes = 64 * 1024 * 1024;
+    m_max_files = 1024;
+    m_sendfile_threshold = 256 * 1024;
+    m_bytes = 0;
+    m_hits = 0;
+    m_misses = 0;
+}
+
+file_cache::~file_cache()
+{
+    m_lock.lock();
+    for (auto &it : m_files)
+    {
+        cached_file *file = it.second;
+        file->cached = false;
+        if (file->refs == 0)
+            destroy(file);
+    }
+    m_files.clear();
+    m_lru.clear();
+    m_lock.unlock();
+}
+
+void file_cache::init(bool enable, size_t max_bytes, int max_files, off_t sendfile_threshold)
+{
+    m_lock.lock();
+    m_enable = enable;
+    m_max_bytes = max_bytes;
+    m_max_files = max_files;
+    m_sendfile_threshold = sendfile_threshold;
+    m_lock.unlock();
+}
+
+// 打开文件，小文件同时映射到内存
+cached_file *file_cache::open_file(const char *path, const struct stat &st)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+
+    char *addr = nullptr;
+    if (st.st_size > 0 && st.st_size < m_sendfile_threshold)
+    {
+        addr = (char *)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED)
+        {
+            close(fd);
+            return nullptr;
+        }
+    }
+
+    cached_file *file = new cached_file;
+    file->path = path;
+    file->dev = st.st_dev;
+    file->ino = st.st_ino;
+    file->mtime = st.st_mtim;
+    file->size = st.st_size;
+    file->fd = fd;
+    file->addr = addr;
+    file->refs = 0;
+    file->cached = false;
+    return file;
+}
+
+void file_cache::destroy(cached_file *file)
+{
+    if (file->addr)
+        munmap(file->addr, file->size);
+    close(file->fd);
+    delete file;
+}
+
+// 从缓存中移除，仍被连接引用时等最后一个release再销毁
+void file_cache::remove_locked(cached_file *file)
+{
+    m_files.erase(file->path);
+    m_lru.erase(file->lru_it);
+    if (file->addr)
+        m_bytes -= file->size;
+    file->cached = false;
+    if (file->refs == 0)
+        destroy(file);
+}
+
+// 超出内存或fd上限时从最久未使用的一端淘汰
+void file_cache::evict_locked()
+{
+    while (!m_lru.empty() && (m_bytes > m_max_bytes || (int)m_files.size() > m_max_files))
+        remove_locked(m_lru.back());
+}
+
+cached_file *file_cache::acquire(const char *path, const struct stat &st)
+{
+    m_lock.lock();
+    if (!m_enable)
+    {
+        m_lock.unlock();
+        cached_file *file = open_file(path, st);
+        if (file)
+            file->refs = 1;
+        return file;
+    }
+
+    auto it = m_files.find(path);
+    if (it != m_files.end())
+    {
+        cached_file *file = it->second;
+        if (file->dev == st.st_dev && file->ino == st.st_ino && file->size == st.st_size &&
+            file->mtime.tv_sec == st.st_mtim.tv_sec && file->mtime.tv_nsec == st.st_mtim.tv_nsec)
+        {
+            file->refs++;
+            m_lru.splice(m_lru.begin(), m_lru, file->lru_it);
+            m_hits++;
+            m_lock.unlock();
+            return file;
+        }
+        // 文件已被修改或替换，旧缓存失效
+        remove_locked(file);
+    }
+    m_misses++;
+    m_lock.unlock();
+
+    // 打开和映射放在锁外进行
+    cached_file *file = open_file(path, st);
+    if (!file)
+        return nullptr;
+    file->refs = 1;
+
+    m_lock.lock();
+    if (m_files.count(path) == 0)
+    {
+        file->cached = true;
+        m_lru.push_front(file);
+        file->lru_it = m_lru.begin();
+        m_files[file->path] = file;
+        if (file->addr)
+            m_bytes += file->size;
+        evict_locked();
+    }
+    m_lock.unlock();
+    return file;
+}
+
+void file_cache::release(cached_file *file)
+{
+    if (!file)
+        return;
+    m_lock.lock();
+    bool dead = (--file->refs == 0 && !file->cached);
+    m_lock.unlock();
+    if (dead)
+        destroy(file);
+}
+
+file_cache::stats file_cache::get_stats()
+{
+    stats s;
+    m_lock.lock();
+    s.hits = m_hits;
+    s.misses = m_misses;
+    s.files = m_files.size();
+    s.bytes = m_bytes;
+    m_lock.unlock();
+    return s;
+}
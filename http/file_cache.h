@@ -0,0 +1,82 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include "../lock/locker.h"
+
+using namespace std;
+
+// 缓存中的一个文件：打开的文件描述符以及（小文件的）只读映射
+struct cached_file
+{
+    string path;
+    dev_t dev;               // 设备号和inode号用于判断文件是否被替换
+    ino_t ino;
+    struct timespec mtime;   // 修改时间用于判断文件是否被修改
+    off_t size;
+    int fd;                  // 大文件通过sendfile从fd直接发送
+    char *addr;              // 小文件的mmap地址，大文件为nullptr
+    int refs;                // 正在使用该文件的连接数，受file_cache的锁保护
+    bool cached;             // 是否还在缓存中，被淘汰或失效后为false
+    list<cached_file *>::iterator lru_it;
+};
+
+// 所有事件循环共享的文件缓存，以m_real_file为键
+// 避免每个请求都stat之后再open、mmap、close，大文件只缓存fd，由sendfile零拷贝发送
+class file_cache
+{
+public:
+    struct stats
+    {
+        long long hits;
+        long long misses;
+        long long files;  // 当前缓存的文件数
+        long long bytes;  // 当前缓存的映射字节数
+    };
+
+public:
+    static file_cache *get_instance()
+    {
+        static file_cache instance;
+        return &instance;
+    }
+
+    // enable为false时不缓存，每次请求都重新打开和映射，用于对比
+    // max_bytes为映射内存的上限，max_files为缓存fd个数的上限
+    // 大于等于sendfile_threshold字节的文件不做mmap，改用sendfile发送
+    void init(bool enable, size_t max_bytes, int max_files, off_t sendfile_threshold);
+
+    // 获取文件，st为调用者刚刚stat得到的信息，inode/mtime/size不一致的旧缓存会被替换
+    // 失败返回nullptr，成功后必须调用release
+    cached_file *acquire(const char *path, const struct stat &st);
+    void release(cached_file *file);
+    stats get_stats();
+
+private:
+    file_cache();
+    ~file_cache();
+
+    cached_file *open_file(const char *path, const struct stat &st);
+    void remove_locked(cached_file *file);
+    void destroy(cached_file *file);
+    void evict_locked();
+
+private:
+    bool m_enable;
+    size_t m_max_bytes;
+    int m_max_files;
+    off_t m_sendfile_threshold;
+
+    locker m_lock;
+    unordered_map<string, cached_file *> m_files;
+    list<cached_file *> m_lru; // 最近使用的放在最前面
+    size_t m_bytes;
+    long long m_hits;
+    long long m_misses;
+};
+
+#endif
@@ -1,6 +1,9 @@
+#define LOG_MODULE LOG_MOD_HTTP // 本文件的日志属于http模块，要在包含log.h之前定义
 #include <string>
 
 #include "http_coon.h"
+#include "buffer_pool.h"
+#include "../CGlmysql/user_cache.h"
 
 using namespace std;
 
@@ -12,36 +15,46 @@ const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
 const char *error_403_title = "Forbidden";
 const char *error_403_form = "You do not have permission to get file form this server.\n";
+const char *not_modified_304_title = "Not Modified";
+const char *partial_206_title = "Partial Content";
+const char *error_416_title = "Range Not Satisfiable";
+const char *error_416_form = "The requested range is not satisfiable.\n";
+const char *error_405_title = "Method Not Allowed";
+const char *error_405_form = "The request method is not supported for the requested resource.\n";
 
 // 给静态成员变量初始化
-// -1 作为初始值是一个惯例
-// 可以明确地表示这个文件描述符当前还没有被分配或初始化。
-int http_conn::m_epollfd = -1;
-int http_conn::m_user_count = 0;
+std::atomic<int> http_conn::m_user_count(0);
+long http_conn::m_body_memory_limit = 64 * 1024;
+long long http_conn::m_body_max_size = 1024LL * 1024 * 1024;
+string http_conn::m_body_spill_dir = "/tmp";
 
-// 定义全局变量
-map<string, string> users;
-locker m_lock;
+void http_conn::init_body(long memory_limit, long long max_size, const char *spill_dir)
+{
+    m_body_memory_limit = memory_limit;
+    m_body_max_size = max_size;
+    m_body_spill_dir = spill_dir ? spill_dir : "";
+}
 
 // 初始化连接
-void http_conn::init(int sockfd, const sockaddr_in &addr, char *root,
+void http_conn::init(int epollfd, int sockfd, const sockaddr_in &addr, char *root,
                      int TRIGMode, int close_log, string user,
                      string passwd, string sqlname)
 {
     // 将参数赋值给成员变量
-    m_sockfd = sockfd; // 给套结文字描述符赋值
-    m_address = addr;  // 给IPv4地址赋值,客户端地址
-
-    // 向 epoll 事件表注册 sockfd 上的可读事件以及开启oneshot模式
-    addfd(m_epollfd, sockfd, true, m_TRIGMode);
-    m_user_count++;
+    m_epollfd = epollfd; // 记录所属事件循环的epoll实例
+    m_sockfd = sockfd;   // 给套结文字描述符赋值
+    m_address = addr;    // 给IPv4地址赋值,客户端地址
 
     // 当浏览器出现连接重置时
     // 可能是网站根目录出错或http响应格式出错或者访问的文件中内容完全为空
     doc_root = root;         // 设置站点根目录
-    m_TRIGMode = TRIGMode;   // 设置触发模式
+    m_TRIGMode = TRIGMode;   // 设置触发模式，必须在addfd之前赋值
     m_close_log = close_log; // 设置日志的关闭状态
 
+    // 向 epoll 事件表注册 sockfd 上的可读事件以及开启oneshot模式
+    addfd(m_epollfd, sockfd, true, m_TRIGMode);
+    m_user_count++;
+
     // 将数据库相关参数转换为c风格的字符串
     strcpy(sql_user, user.c_str()); // 将 user 转换为 C 风格字符串并复制给 sql_user
     strcpy(sql_passwd, passwd.c_str());
@@ -57,8 +70,44 @@ void http_conn::init()
 {
     // 初始化变量值
     mysql = nullptr;
-    bytes_to_send = 0;
-    bytes_have_send = 0;
+    m_read_idx = 0;
+    m_checked_idx = 0;
+    m_body_fd = -1;
+    m_sql_state = SQL_NONE;
+    m_sql_ticket = 0;
+    m_pipelined = false;
+    m_write_deferred = false;
+    m_state = 0;
+    timer_flag = 0;
+    improv = 0;
+    m_file_address = nullptr;
+    m_file = nullptr;
+    m_compressed = nullptr;
+    m_page_snap = nullptr;
+    m_cached_page = nullptr;
+    m_range_map_count = 0;
+
+    init_request();
+    init_write();
+}
+
+// 一个请求处理完后重置解析状态
+// 读缓冲区中该请求之后的数据（流水线中的下一个请求）移到缓冲区开头保留下来
+void http_conn::init_request()
+{
+    // 当前请求的结尾，消息体已经由parse_content消费掉，m_checked_idx之后就是下一个请求
+    long end = m_checked_idx;
+    if (end > m_read_idx)
+        end = m_read_idx;
+    close_body();
+
+    long left = m_read_idx - end;
+    if (left > 0)
+        memmove(m_read_buf, m_read_buf + end, left);
+    if (m_read_buf)
+        memset(m_read_buf + left, '\0', m_read_idx - left);
+    m_read_idx = left;
+
     m_check_state = CHECK_STATE_REQUESTLINE;
     m_linger = false;
     m_method = GET;
@@ -66,18 +115,43 @@ void http_conn::init()
     m_version = 0;
     m_content_length = 0;
     m_host = 0;
+    m_accept_encoding = 0;
+    m_if_none_match = 0;
+    m_range = 0;
+    m_transfer_encoding = 0;
+    m_if_modified_since = 0;
+    m_if_range = 0;
+    m_range_count = 0;
+    m_encoding = ENC_IDENTITY;
+    m_vary = false;
     m_start_line = 0;
     m_checked_idx = 0;
-    m_read_idx = 0;
-    m_write_idx = 0;
+    m_line_colon = -1;
+    m_text_colon = -1;
     cgi = 0;
-    m_state = 0;
-    timer_flag;
-    improv = 0;
+    m_string = 0;
+    m_chunked = false;
+    m_chunk_state = CHUNK_SIZE;
+    m_chunk_left = 0;
+    m_body_start = 0;
+    m_body_size = 0;
+    // 长连接上的下一个请求不能沿用上一个请求的文件路径（包括协商编码加上的.gz、.br）
+    memset(m_real_file, '\0', FILENAME_LEN);
+}
 
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
-    memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
-    memset(m_read_buf, '\0', FILENAME_LEN);
+// 一批响应发送完后重置写状态
+void http_conn::init_write()
+{
+    bytes_to_send = 0;
+    bytes_have_send = 0;
+    m_write_idx = 0;
+    m_head_start = 0;
+    m_iv_count = 0;
+    m_iv_idx = 0;
+    m_resp_count = 0;
+    m_sendfile = nullptr;
+    m_file_offset = 0;
+    m_close_after = false;
 }
 
 // 将fd添加到epollfd中进行监控，监控事件为读事件，触发方式等可以自定义
@@ -125,9 +199,19 @@ void http_conn::close_conn(bool real_close)
     if (real_close && (m_sockfd != -1))
     {
         printf("close%d\n", m_sockfd);
+        m_write_deferred = false;
+        unmap(); // 发送中途关闭时归还文件
         removefd(m_epollfd, m_sockfd);
         m_sockfd = -1;
         m_user_count--;
+        // 连接对象会被复用，缓冲区先归还，空闲连接不占用缓冲区内存
+        release_buffers(true);
+        close_body();
+        // 还在等待的数据库结果不再需要
+        if (m_sql_state == SQL_WAIT && m_async_sql)
+            m_async_sql->cancel(this);
+        m_sql_state = SQL_NONE;
+        m_sql_ticket = 0;
     }
 }
 
@@ -140,23 +224,72 @@ void removefd(int epollfd, int fd)
 
 void http_conn::process()
 {
-    // 处理读操作，返回读操作的结果
-    HTTP_CODE read_ret = process_read();
+    // 读缓冲区中可能有多个流水线请求，依次处理并把响应按顺序排队，最后一起writev发出
+    while (m_resp_count < MAX_PIPELINE)
+    {
+        // 处理读操作，返回读操作的结果
+        // 上一批放不下而被推迟的请求已经处理过，直接生成响应；
+        // 被暂停的请求已经拿到数据库结果时，先完成这个请求
+        HTTP_CODE read_ret;
+        if (m_write_deferred)
+        {
+            read_ret = m_deferred_ret;
+            m_write_deferred = false;
+        }
+        else
+            read_ret = (m_sql_state == SQL_DONE) ? finish_sql() : process_read();
+        // 请求还不完整，等待更多数据
+        if (read_ret == NO_REQUEST)
+            break;
+        // 等待数据库结果期间不注册任何事件，已排队的响应和之后的流水线请求都留到sql_done之后处理
+        if (read_ret == SQL_REQUEST)
+            return;
+
+        // 出错的请求之后无法可靠地找到下一个请求的开头，响应完就关闭连接
+        if (read_ret != FILE_REQUEST && read_ret != NOT_MODIFIED &&
+            read_ret != PARTIAL_CONTENT && read_ret != RANGE_NOT_SATISFIABLE)
+            m_linger = false;
+
+        // 处理写操作，传入读操作的结果，并返回写操作的结果
+        int write_idx = m_write_idx, head_start = m_head_start, iv_count = m_iv_count;
+        long to_send = bytes_to_send;
+        bool write_ret = process_write(read_ret);
+        if(!write_ret)
+        {
+            // 写缓冲区放不下这个响应，但前面已经有排队的响应：撤销这个响应写入的部分，
+            // 先把这一批发出去，请求本身不丢弃，发完后write()让调用者再次调用process()生成它的响应
+            if (m_resp_count > 0)
+            {
+                m_write_idx = write_idx;
+                m_head_start = head_start;
+                m_iv_count = iv_count;
+                bytes_to_send = to_send;
+                m_deferred_ret = read_ret;
+                m_write_deferred = true;
+                break;
+            }
+            close_conn(); // 写入响应失败，关闭当前的连接
+            return;
+        }
 
-    if (read_ret == NO_REQUEST)
+        // 非长连接、sendfile发送的大文件（必须是这一批的最后一个）、多区间响应（占用较多m_iv）
+        // 或写缓冲区快满时，不再继续处理
+        bool more = !m_close_after && !m_sendfile && m_range_count <= 1 &&
+                    MAX_WRITE_BUFFER_SIZE - m_write_idx > WRITE_RESERVE;
+        init_request();
+        if (!more)
+            break;
+    }
+
+    if (m_resp_count == 0)
     {
         // 如果没有请求需求处理
         // 则修改文件描述符的事件，等待下一次事件发生后继续处理
         // EPOLLIN 用来监听文件描述符上的读事件
+        release_buffers();
         modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
         return;
     }
-    // 处理写操作，传入读操作的结果，并返回写操作的结果
-    bool write_ret = process_write(read_ret);
-    if(!write_ret)
-    {
-        close_conn(); // 写入响应失败，关闭当前的连接
-    }
     // 调用 modfd() 函数修改事件的注册
     // 将监听的事件类型改为 EPOLLOUT（表示可写事件），以准备将响应发送给客户端
     modfd(m_epollfd,m_sockfd,EPOLLOUT,m_TRIGMode);
@@ -168,12 +301,23 @@ http_conn::HTTP_CODE http_conn::process_read()
     HTTP_CODE ret = NO_REQUEST;        // 定义HTTP处理结果的状态量，初始值为NO_REQUEST
     char *text = 0;                    // 初始化一个字符指针为0
 
-    // 进入循环，直到状态为CHECK_STATE_CONTENT 且 行状态为LINE_OK，或者解析行的结果仍为LINE_OK
-    while ((m_check_state == CHECK_STATE_CONTENT && line_status == LINE_OK) || ((line_status = parse_line()) == LINE_OK))
+    // 请求行和请求头逐行解析，直到解析行的结果不为LINE_OK
+    // 消息体不按行解析，进入CHECK_STATE_CONTENT后把已经读到的部分交给parse_content
+    while (m_check_state == CHECK_STATE_CONTENT || (line_status = parse_line()) == LINE_OK)
     {
+        if (m_check_state == CHECK_STATE_CONTENT)
+        {
+            ret = parse_content();       // 消费已读到的消息体
+            if (ret == GET_REQUEST)      // 消息体已经完整
+                return do_request();
+            return ret;                  // 出错，或需要继续读取
+        }
         text = get_line();            // 获取一行HTTP报文数据
+        // parse_line记录的':'位置换算成相对本行开头的偏移
+        m_text_colon = (m_line_colon >= 0) ? m_line_colon - m_start_line : -1;
+        m_line_colon = -1;
         m_start_line = m_checked_idx; // 设置起始行位置为当前已处理位置
-        LOG_INFO("%s", text);         // 记录日志，输出获取的行数据
+        LOG_DEBUG("%s", text);        // 记录日志，输出获取的行数据，默认不输出
         switch (m_check_state)
         {
         // 请求行状态
@@ -190,33 +334,36 @@ http_conn::HTTP_CODE http_conn::process_read()
             ret = parse_headers(text); // 解析请求头
             if (ret == BAD_REQUEST)
                 return BAD_REQUEST;     // 解析失败
-            else if (ret = GET_REQUEST) // 解析成功
+            else if (ret == GET_REQUEST) // 解析成功
             {
                 return do_request(); // 处理GET请求
             }
             break;
         }
-        // 处理解析内容状态
-        case CHECK_STATE_CONTENT:
-        {
-            ret = parse_content(text); // 解析内容
-            if (ret == GET_REQUEST)    // 若内容解析完成，且为GET请求
-                return do_request();   // 处理GET请求
-            line_status = LINE_OPEN;   // 行状态置为LINE_OPEN，表示尚未结束
-            break;
-        }
         default:
             return INTERNAL_ERROR; // 返回内部错误信息
         }
     }
+    // 格式错误的行之后无法继续解析
+    if (line_status == LINE_BAD)
+        return BAD_REQUEST;
     return NO_REQUEST;
 }
 
 http_conn::LINE_STATUS http_conn::parse_line()
 {
     char temp;
-    for (; m_checked_idx < m_read_idx; ++m_checked_idx) // 从已检查的位置开始循环直到已读取数据的总长度
+    while (m_checked_idx < m_read_idx) // 从已检查的位置开始直到已读取数据的总长度
     {
+        // 用向量化扫描直接跳到下一个'\r'或'\n'，顺便记下行内第一个':'，供parse_headers使用
+        const char *colon = nullptr;
+        const char *p = http_scanner::scan_line(m_read_buf + m_checked_idx, m_read_buf + m_read_idx, &colon);
+        if (colon && m_line_colon < 0)
+            m_line_colon = colon - m_read_buf;
+        m_checked_idx = p - m_read_buf;
+        if (m_checked_idx >= m_read_idx)
+            break;
+
         temp = m_read_buf[m_checked_idx]; // 获取当前位置的字符
 
         // 如果是回车符
@@ -225,7 +372,7 @@ http_conn::LINE_STATUS http_conn::parse_line()
             if ((m_checked_idx + 1) == m_read_idx) // 如果下一个位置是已读取数据的末尾
                 return LINE_OPEN;
 
-            else if (m_read_buf[m_checked_idx + 1 == '\n']) // 如果下一个位置是换行符,请求行读取结束
+            else if (m_read_buf[m_checked_idx + 1] == '\n') // 如果下一个位置是换行符,请求行读取结束
             {
                 m_read_buf[m_checked_idx++] = '\0'; // 将回车符替换为字符串结束符
                 m_read_buf[m_checked_idx++] = '\0'; // 将换行符替换为字符串结束符
@@ -259,19 +406,14 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
         return BAD_REQUEST;
     }
     // 在找到的空格或制表符位置处插入空字符，同时将m_url指针后移一位
+    // 方法名用编译期生成的完美哈希表识别，一次哈希加一次比较
+    int method = http_scanner::match_method(text, m_url - text);
     *m_url++ = '\0';
-    char *method = text;
-    // 比较字符串，判断请求方法是GET还是POST
-    // strcasecmp方法只比对字符串的开头内容是否相等
-    if (strcasecmp(method, "GET") == 0)
-        m_method = GET;
-    else if (strcasecmp(method, "POST") == 0)
-    {
-        m_method = POST;
-        cgi = 1;
-    }
-    else
+    if (method < 0)
         return BAD_REQUEST;
+    m_method = (METHOD)method;
+    if (m_method == POST)
+        cgi = 1;
     // 跳过空格和制表符
     m_url += strspn(m_url, " \t");
     m_version = strpbrk(m_url, " \t");
@@ -281,6 +423,8 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
     m_version += strspn(m_version, " \t");
     if (strcasecmp(m_version, "HTTP/1.1") != 0)
         return BAD_REQUEST;
+    // HTTP/1.1默认使用长连接，除非请求头中有Connection: close
+    m_linger = true;
     // 如果URL以http://或https://开头，则跳过这部分内容，移动m_url指针到第一个'/'字符的位置
     if (strncasecmp(m_version, "http://", 7) == 0)
     {
@@ -308,53 +452,130 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
     // 检查文本是否为空
     if (text[0] == '\0')
     {
-        // 如果内容长度不为0，则设置状态为CHECK_STATE_CONTENT，返回NO_REQUEST
-        if (m_content_length != 0)
+        // 有消息体（分块编码或内容长度不为0）时，设置状态为CHECK_STATE_CONTENT，返回NO_REQUEST
+        // 分块编码时忽略Content-Length
+        if (m_chunked || m_content_length != 0)
         {
+            if (!m_chunked && m_body_max_size > 0 && m_content_length > m_body_max_size)
+                return BAD_REQUEST;
             m_check_state = CHECK_STATE_CONTENT;
+            m_body_start = m_checked_idx;
             return NO_REQUEST;
         }
         // 如果内容长度为0，则返回GET_REQUEST
         return GET_REQUEST;
     }
-    // 检查connection字段
-    else if (strncasecmp(text, "Connection:", 11) == 0)
-    {
-        // 跳过字段名及空格制表符等空白字符
-        text += 11;
-        text += strspn(text, " \t");
-        // 如果字段值是 keep-alive，则设置 linger 为 true
-        if (strcasecmp(text, "keep-alive") == 0)
-        {
-            m_linger = true; // 启用 TCP 连接的优雅关闭（即延迟关闭）
-        }
-    }
-    // 检查 Content-length 字段
-    else if (strncasecmp(text, "Content-length:", 15) == 0)
-    {
-        text += 15;
-        text += strspn(text, " \t");
-        // 获取内容长度，并使用 atol 转换为长整型数
-        m_content_length = atol(text); // 将字符串转换为长整型数值
-    }
-    // 检查Host字段
-    else if (strncasecmp(text, "Host:", 5) == 0)
-    {
-        text += 5;
-        text += strspn(text, " \t");
-        // 将主机信息保存到 m_host 中
-        m_host = text;
-    }
-    // 如果是其他未知的字段，则记录日志
-    else
+
+    // parse_line扫描时已经找到了':'，字段名用完美哈希表识别后直接调用对应的处理函数
+    http_scanner::HEADER header = http_scanner::HEADER_UNKNOWN;
+    char *value = text;
+    if (m_text_colon > 0)
     {
-        LOG_INFO("oop!unknow header: %s", text);
+        header = http_scanner::match_header(text, m_text_colon);
+        // 跳过字段名、':'及空格制表符等空白字符
+        value = text + m_text_colon + 1;
+        value += strspn(value, " \t");
     }
+    if (header == http_scanner::HEADER_UNKNOWN)
+        value = text;
+    return (this->*m_header_handlers[header])(value);
+}
+
+// 下标与http_scanner::HEADER一致
+const http_conn::header_handler http_conn::m_header_handlers[http_scanner::HEADER_COUNT] = {
+    &http_conn::on_unknown,
+    &http_conn::on_connection,
+    &http_conn::on_content_length,
+    &http_conn::on_host,
+    &http_conn::on_accept_encoding,
+    &http_conn::on_if_none_match,
+    &http_conn::on_range,
+    &http_conn::on_transfer_encoding,
+    &http_conn::on_if_modified_since,
+    &http_conn::on_if_range};
+
+// 如果是其他未知的字段，则记录日志
+http_conn::HTTP_CODE http_conn::on_unknown(char *text)
+{
+    LOG_DEBUG("oop!unknow header: %s", text);
+    return NO_REQUEST;
+}
+
+// 检查connection字段
+http_conn::HTTP_CODE http_conn::on_connection(char *value)
+{
+    // 如果字段值是 keep-alive，则设置 linger 为 true
+    if (strcasecmp(value, "keep-alive") == 0)
+        m_linger = true; // 启用 TCP 连接的优雅关闭（即延迟关闭）
+    else if (strcasecmp(value, "close") == 0)
+        m_linger = false; // 响应后关闭连接
+    return NO_REQUEST;
+}
+
+// 检查 Content-length 字段
+http_conn::HTTP_CODE http_conn::on_content_length(char *value)
+{
+    // 获取内容长度，并使用 atol 转换为长整型数
+    m_content_length = atol(value);
+    if (m_content_length < 0)
+        return BAD_REQUEST;
+    return NO_REQUEST;
+}
+
+// 检查Host字段，将主机信息保存到 m_host 中
+http_conn::HTTP_CODE http_conn::on_host(char *value)
+{
+    m_host = value;
+    return NO_REQUEST;
+}
+
+http_conn::HTTP_CODE http_conn::on_accept_encoding(char *value)
+{
+    m_accept_encoding = value;
+    return NO_REQUEST;
+}
+
+http_conn::HTTP_CODE http_conn::on_if_none_match(char *value)
+{
+    m_if_none_match = value;
+    return NO_REQUEST;
+}
+
+http_conn::HTTP_CODE http_conn::on_range(char *value)
+{
+    m_range = value;
+    return NO_REQUEST;
+}
+
+http_conn::HTTP_CODE http_conn::on_if_modified_since(char *value)
+{
+    m_if_modified_since = value;
+    return NO_REQUEST;
+}
+
+http_conn::HTTP_CODE http_conn::on_if_range(char *value)
+{
+    m_if_range = value;
+    return NO_REQUEST;
+}
+
+// 只支持chunked，其他编码无法确定消息体的边界，按错误请求处理
+http_conn::HTTP_CODE http_conn::on_transfer_encoding(char *value)
+{
+    m_transfer_encoding = value;
+    if (strcasecmp(value, "chunked") == 0)
+        m_chunked = true;
+    else if (strcasecmp(value, "identity") != 0)
+        return BAD_REQUEST;
     return NO_REQUEST;
 }
 
 http_conn::HTTP_CODE http_conn::do_request()
 {
+    // 识别出的其他方法（PUT、DELETE、PATCH等）没有对应的资源处理，返回405
+    if (m_method != GET && m_method != POST && m_method != HEAD)
+        return NOT_ALLOWED;
+
     strcpy(m_real_file, doc_root); // 复制C字符串
     int len = strlen(doc_root);    // 计算C字符串长度，不包括结尾的null字符
 
@@ -377,79 +598,205 @@ http_conn::HTTP_CODE http_conn::do_request()
 
         // 将用户名和密码提取出来
         // m_string="user=123&passwd=123"
+        // 没有消息体、消息体不是预期的表单或者写入了临时文件时，不注册也不登录，直接返回失败页面
+        const char *fail_page = *(p + 1) == '3' ? "/registerError.html" : "/logError.html";
+        if (!m_string || strncmp(m_string, "user=", 5) != 0)
+        {
+            strcpy(m_url, fail_page);
+            return do_file_request();
+        }
         char name[100], password[100];
         int i;
         // 提取用户名
-        for (i = 5; m_string[i] != '&'; i++)
+        // 消息体可以超过原来的固定缓冲区大小，用户名和密码按name、password的长度截断
+        for (i = 5; m_string[i] != '&' && m_string[i] != '\0' && i - 5 < 99; i++)
         {
             name[i - 5] = m_string[i];
         }
         name[i - 5] = '\0'; // 加入结束符
+        while (m_string[i] != '&' && m_string[i] != '\0')
+            i++;
 
         // 提取密码
         int j = 0;
         // 也许是 i + 8 ？
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
+        // 跳过"&password="，消息体不完整时不能越过结束符
+        int k = 0;
+        while (k < 10 && m_string[i] != '\0')
+            i++, k++;
+        for (; m_string[i] != '\0' && j < 99; ++i, ++j)
         {
             password[j] = m_string[i];
         }
         password[j] = '\0';
 
+        // 用户名为空的表单同样直接失败，不会创建或查询空用户名
+        if (name[0] == '\0')
+        {
+            strcpy(m_url, fail_page);
+            return do_file_request();
+        }
+
         if (*(p + 1) == '3')
         {
             // 如果是注册，先检测数据库中是否有重名的
             // 没有重名的，进行增加数据
+            // 用户名和密码作为预处理语句的参数传给数据库，不拼接进SQL
 
-            // 构建insert sql语句, SQL INSERT INTO 语句用于向表中插入新记录
-            // 语法：INSERT INTO table_name VALUES (value1,value2,value3,...);
-            char *sql_insert = (char *)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "','");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-
-            // 如果users中没有重名的条目
-            //  则加锁，执行SQL语句，更新users数据，然后解锁
-            if (users.find(name) == users.end())
+            // 如果user_cache中有重名的条目，直接失败
+            if (user_cache::get_instance()->find(name))
+                strcpy(m_url, "/registerError.html");
+            // 启动了注册写入队列时交给队列攒批写入
+            else if (register_queue::get_instance()->running())
             {
-                m_lock.lock();
-
-                // mysql_query 函数用于向 MySQL 数据库发送 SQL 查询
-                // mysql 是一个 MYSQL* 类型的指针，指向一个已连接的 MySQL 数据库
-                // 0：表示查询成功,非0值：表示查询失败
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(pair<string, string>(name, password));
-
-                m_lock.unlock();
-
-                // 根据执行结果更新m_url
-                // 为0，则登录成功
-                if (!res)
+                register_queue *queue = register_queue::get_instance();
+                // 在事件循环线程中处理时不等待提交，连接暂停，提交后在finish_sql中完成
+                if (queue->ack_mode() == ACK_COMMIT && m_register_callback)
+                {
+                    m_sql_ticket = queue->add_async(name, password, m_register_callback, m_register_owner, this);
+                    if (m_sql_ticket)
+                    {
+                        strcpy(m_sql_name, name);
+                        strcpy(m_sql_password, password);
+                        m_sql_state = SQL_WAIT;
+                        return SQL_REQUEST;
+                    }
+                    LOG_ERROR("register queue is full, register %s failed", name);
+                    strcpy(m_url, "/registerError.html");
+                }
+                // 线程池模式阻塞到批次提交；ACK_ENQUEUE模式放入队列即成功
+                else if (queue->add(name, password) == 0)
                     strcpy(m_url, "/log.html");
                 else
                     strcpy(m_url, "/registerError.html");
             }
-            else
+            // 有非阻塞数据库连接时只提交语句，连接暂停，结果返回后在finish_sql中完成
+            else if (m_async_sql)
+            {
+                const char *params[2] = {name, password};
+                if (m_async_sql->execute(STMT_INSERT_USER, params, 2, this))
+                {
+                    strcpy(m_sql_name, name);
+                    strcpy(m_sql_password, password);
+                    m_sql_state = SQL_WAIT;
+                    return SQL_REQUEST;
+                }
+                LOG_ERROR("async sql unavailable, register %s failed", name);
                 strcpy(m_url, "/registerError.html");
+            }
+            else
+            {
+                // 使用该连接上缓存的预处理语句，连接池等待超时或者数据库不可用时mysql为空
+                MYSQL_STMT *stmt = mysql ? connection_pool::GetInstance()->GetStatement(mysql, STMT_INSERT_USER) : nullptr;
+                if (!stmt)
+                {
+                    LOG_ERROR("no sql connection, register %s failed", name);
+                    strcpy(m_url, "/registerError.html");
+                }
+                else
+                {
+                    // 执行SQL语句，成功后加入user_cache
+                    unsigned int err = sql_insert_user(stmt, name, password);
+                    if (!err)
+                        user_cache::get_instance()->insert(name, password);
+
+                    // 根据执行结果更新m_url
+                    // 为0，则登录成功
+                    if (!err)
+                        strcpy(m_url, "/log.html");
+                    else
+                        strcpy(m_url, "/registerError.html");
+                }
+            }
         }
         // 如果是登录，直接判断
         else if (*(p + 1) == '2')
         {
-            if (users.find(name) != users.end() && users[name] == password)
+            // 查找不加锁，返回的指针在缓存销毁前一直有效
+            const char *expected = user_cache::get_instance()->find(name);
+            // user_cache中没有该用户时（如其他服务进程注册的用户）查询数据库，查到后加入user_cache
+            // 有非阻塞数据库连接时只提交查询，连接暂停，结果返回后在finish_sql中完成
+            if (!expected && m_async_sql)
+            {
+                const char *params[1] = {name};
+                if (m_async_sql->execute(STMT_SELECT_USER, params, 1, this, m_sql_result, sizeof(m_sql_result)))
+                {
+                    strcpy(m_sql_name, name);
+                    strcpy(m_sql_password, password);
+                    m_sql_state = SQL_WAIT;
+                    return SQL_REQUEST;
+                }
+                LOG_ERROR("async sql unavailable, login %s failed", name);
+            }
+            char db_password[100];
+            if (!expected && mysql)
+            {
+                MYSQL_STMT *stmt = connection_pool::GetInstance()->GetStatement(mysql, STMT_SELECT_USER);
+                if (stmt && sql_select_user(stmt, name, db_password, sizeof(db_password)) == 1)
+                {
+                    user_cache::get_instance()->insert(name, db_password, true);
+                    expected = db_password;
+                }
+            }
+            if (expected && strcmp(expected, password) == 0)
                 strcpy(m_url, "/welcome.html");
             else
                 strcpy(m_url, "/logError.html");
         }
     }
 
+    return do_file_request();
+}
+
+// 异步注册或登录查询完成，按结果更新user_cache并继续处理被暂停的请求
+http_conn::HTTP_CODE http_conn::finish_sql()
+{
+    m_sql_state = SQL_NONE;
+    m_sql_ticket = 0;
+    const char *p = strrchr(m_url, '/');
+    // 登录：查到用户时加入user_cache，再比较密码
+    if (*(p + 1) == '2')
+    {
+        if (m_sql_err == 0)
+            user_cache::get_instance()->insert(m_sql_name, m_sql_result, true);
+        else if (m_sql_err != MYSQL_NO_DATA)
+            LOG_ERROR("async sql error %u, login %s failed", m_sql_err, m_sql_name);
+        if (m_sql_err == 0 && strcmp(m_sql_result, m_sql_password) == 0)
+            strcpy(m_url, "/welcome.html");
+        else
+            strcpy(m_url, "/logError.html");
+    }
+    else if (m_sql_err == 0)
+    {
+        user_cache::get_instance()->insert(m_sql_name, m_sql_password);
+        strcpy(m_url, "/log.html");
+    }
+    else
+        strcpy(m_url, "/registerError.html");
+    return do_file_request();
+}
+
+void http_conn::sql_done(unsigned int err)
+{
+    if (m_sql_state != SQL_WAIT)
+        return;
+    m_sql_err = err;
+    m_sql_state = SQL_DONE;
+    process();
+}
+
+// 根据m_url确定要发送的文件，CGI请求已经在do_request中把m_url换成了结果页面
+http_conn::HTTP_CODE http_conn::do_file_request()
+{
+    int len = strlen(doc_root);
+    const char *p = strrchr(m_url, '/');
+
     // 注册请求
     if (*(p + 1) == '0')
     {
         char *m_url_real = (char *)malloc(sizeof(char) * 200);
         strcpy(m_url_real, "/register.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
 
         free(m_url_real);
     }
@@ -458,7 +805,7 @@ http_conn::HTTP_CODE http_conn::do_request()
     {
         char *m_url_real = (char *)malloc(sizeof(char) * 200);
         strcpy(m_url_real, "/log.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
 
         free(m_url_real);
     }
@@ -467,7 +814,7 @@ http_conn::HTTP_CODE http_conn::do_request()
     {
         char *m_url_real = (char *)malloc(sizeof(char) * 200);
         strcpy(m_url_real, "/picture.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
 
         free(m_url_real);
     }
@@ -476,7 +823,7 @@ http_conn::HTTP_CODE http_conn::do_request()
     {
         char *m_url_real = (char *)malloc(sizeof(char) * 200);
         strcpy(m_url_real, "/video.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
 
         free(m_url_real);
     }
@@ -485,18 +832,39 @@ http_conn::HTTP_CODE http_conn::do_request()
     {
         char *m_url_real = (char *)malloc(sizeof(char) * 200);
         strcpy(m_url_real, "/fans.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
 
         free(m_url_real);
     }
     else
         strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
 
+    // 热点页面直接使用页面缓存中的完整响应，连stat都不需要
+    // HEAD请求只要响应头，Range请求只要部分内容，都不使用包含内容的完整响应
+    if (m_method != HEAD && !m_range)
+        m_page_snap = page_cache::get_instance()->acquire();
+    if (m_page_snap)
+    {
+        const cached_page *page = m_page_snap->find(m_real_file);
+        if (page)
+        {
+            // 按Accept-Encoding选择预先生成的br、gzip或未压缩的版本
+            const page_variant *variant = page->select(accept_encodings(m_accept_encoding));
+            if (not_modified(variant->etag.c_str(), page->mtime))
+                m_cached_page = &variant->not_modified[m_linger];
+            else
+                m_cached_page = &variant->responses[m_linger];
+            return FILE_REQUEST;
+        }
+        page_cache::get_instance()->release(m_page_snap);
+        m_page_snap = nullptr;
+    }
+
     // stat 函数返回值： 0 表示成功 -1 表示失败
     // m_real_file想要检查的文件或目录的路径
     // m_file_stat用来保存文件的信息
     if (stat(m_real_file, &m_file_stat) < 0)
-        return NO_REQUEST;
+        return NO_RESOURCE;
 
     // 提取出其他用户读取权限位
     // st_mode 包含文件的模式信息（即文件的类型和权限）
@@ -508,38 +876,488 @@ http_conn::HTTP_CODE http_conn::do_request()
     if (S_ISDIR(m_file_stat.st_mode))
         return BAD_REQUEST;
 
-    // 打开文件，并将文件映射到内存中
-    // O_RDONLY 表示以只读模式打开文件
-    int fd = open(m_real_file, O_RDONLY);
-    // mmap 是一个系统调用函数，用来创建新的内存映射或者修改现有内存映射
-    // 第一个参数 0 是指定映射的起始地址。通常设置为0，表示由操作系统自动选择合适的地址。
-    // 第二个参数是要映射的文件的大小
-    // 第三个参数是指定内存映射的保护方式。PROT_READ 表示映射的区域可以被读取。
-    // 第四个参数是指定内存映射的类型。
-    // 第五个参数是文件描述符,表示需要映射的文件
-    // 第六个参数表示文件在内存中的偏移量，通常设置为0，表示从文件的开头开始映射
-    m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    close(fd);
+    // 内容协商，选择预压缩文件或实时gzip压缩的结果
+    if (m_method == GET || m_method == HEAD)
+        negotiate_encoding();
+
+    // 客户端缓存的版本仍然有效，不需要打开文件
+    char etag[cache_control::ETAG_LEN];
+    cache_control::make_etag(m_file_stat, etag, sizeof(etag), encoding_names[m_encoding]);
+    if (not_modified(etag, m_file_stat.st_mtime))
+        return NOT_MODIFIED;
+
+    // Range请求只发送请求的区间，播放器拖动进度时不必重新传整个文件
+    // 实时压缩的结果不支持Range，直接返回整个压缩后的内容
+    if (m_range && !m_compressed && (m_method == GET || m_method == HEAD))
+    {
+        m_range_count = parse_range(etag);
+        if (m_range_count < 0)
+            return RANGE_NOT_SATISFIABLE;
+    }
+
+    // 从共享的文件缓存中获取已打开（小文件已映射）的文件，避免每个请求都open/mmap/close
+    // 大文件不做映射，m_file_address为空，发送时改用sendfile
+    if (!m_file)
+    {
+        m_file = file_cache::get_instance()->acquire(m_real_file, m_file_stat);
+        if (!m_file)
+            return INTERNAL_ERROR;
+        m_file_address = m_file->addr;
+    }
 
-    return FILE_REQUEST;
+    return m_range_count > 0 ? PARTIAL_CONTENT : FILE_REQUEST;
 }
 
-// 判断http请求是否被完整读入
-http_conn::HTTP_CODE http_conn::parse_content(char *text)
+// 条件请求：有If-None-Match时只比较ETag，否则比较If-Modified-Since与文件修改时间
+// 只对GET、HEAD生效
+bool http_conn::not_modified(const char *etag, time_t mtime)
 {
-    // 如果已经读取的数据长度大于等于（消息的长度+检查过的长度）
-    if (m_read_idx >= (m_content_length + m_checked_idx))
+    if (m_method != GET && m_method != HEAD)
+        return false;
+    if (m_if_none_match)
+        return cache_control::etag_match(m_if_none_match, etag);
+    if (m_if_modified_since)
+    {
+        time_t since = cache_control::parse_date(m_if_modified_since);
+        return since != -1 && mtime <= since;
+    }
+    return false;
+}
+
+// 文本文件的内容协商
+// 客户端接受br或gzip且存在不比原文件旧的预压缩文件（m_real_file加.br、.gz）时，改为发送该文件；
+// 否则客户端接受gzip时从压缩缓存获取实时压缩的结果，超出CPU预算或压缩效果不明显时发送原文件
+void http_conn::negotiate_encoding()
+{
+    if (!is_compressible(m_real_file))
+        return;
+    m_vary = true;
+    int accepted = accept_encodings(m_accept_encoding);
+    if (!accepted)
+        return;
+
+    const int preferred[] = {ENC_BR, ENC_GZIP};
+    size_t len = strlen(m_real_file);
+    for (int enc : preferred)
+    {
+        if (!(accepted & (1 << enc)) || len + strlen(encoding_suffixes[enc]) >= (size_t)FILENAME_LEN)
+            continue;
+        char path[FILENAME_LEN];
+        strcpy(path, m_real_file);
+        strcat(path, encoding_suffixes[enc]);
+        struct stat st;
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && (st.st_mode & S_IROTH) &&
+            st.st_mtime >= m_file_stat.st_mtime)
+        {
+            strcpy(m_real_file, path);
+            m_file_stat = st;
+            m_encoding = enc;
+            return;
+        }
+    }
+
+    if (!(accepted & (1 << ENC_GZIP)))
+        return;
+    // 压缩需要文件内容，只有文件缓存中已映射的小文件才做实时压缩
+    m_file = file_cache::get_instance()->acquire(m_real_file, m_file_stat);
+    if (!m_file)
+        return;
+    m_file_address = m_file->addr;
+    m_compressed = compress_cache::get_instance()->acquire(m_real_file, m_file_stat, m_file_address);
+    if (m_compressed && m_compressed->data.empty())
+    {
+        compress_cache::get_instance()->release(m_compressed);
+        m_compressed = nullptr;
+    }
+    if (m_compressed)
+        m_encoding = ENC_GZIP;
+}
+
+// 解析Range: bytes=a-b,c-,-n，结果放入m_range_start、m_range_len
+// 返回区间数；返回0表示忽略Range发送整个文件（格式错误、区间太多或If-Range与当前版本不一致）；
+// 返回-1表示没有可以满足的区间
+int http_conn::parse_range(const char *etag)
+{
+    off_t size = m_file_stat.st_size;
+
+    // If-Range不一致说明客户端已有的部分内容过期了，返回整个文件
+    // ETag需要强比较，弱ETag永远不匹配
+    if (m_if_range)
+    {
+        if (m_if_range[0] == '"' || strncmp(m_if_range, "W/", 2) == 0)
+        {
+            if (strcmp(m_if_range, etag) != 0)
+                return 0;
+        }
+        else if (cache_control::parse_date(m_if_range) != m_file_stat.st_mtime)
+            return 0;
+    }
+
+    if (strncasecmp(m_range, "bytes=", 6) != 0)
+        return 0;
+    const char *p = m_range + 6;
+    int count = 0;
+    int specs = 0;
+    while (true)
     {
-        // 在消息体末尾添加字符串结束标志
-        text[m_content_length] = '\0';
-        // POST请求中最后为输入的用户名和密码
-        m_string = text;    // 将消息体保存到m_string中
-        return GET_REQUEST; // 返回GET请求，表示请求已经完整读入
+        p += strspn(p, " \t,");
+        if (*p == '\0')
+            break;
+        specs++;
+
+        char *next = nullptr;
+        off_t start, end;
+        if (*p == '-')
+        {
+            // 后缀区间：最后n个字节
+            if (!isdigit((unsigned char)p[1]))
+                return 0;
+            off_t n = strtoll(p + 1, &next, 10);
+            start = n >= size ? 0 : size - n;
+            end = size - 1;
+            if (n == 0)
+                start = size; // 不可满足
+        }
+        else
+        {
+            if (!isdigit((unsigned char)*p))
+                return 0;
+            start = strtoll(p, &next, 10);
+            if (*next != '-')
+                return 0;
+            next++;
+            end = size - 1;
+            if (isdigit((unsigned char)*next))
+            {
+                off_t last = strtoll(next, &next, 10);
+                if (last < start)
+                    return 0;
+                if (last < end)
+                    end = last;
+            }
+        }
+        p = next + strspn(next, " \t");
+        if (*p != '\0' && *p != ',')
+            return 0;
+
+        // 起点超出文件的区间忽略
+        if (start >= size)
+            continue;
+        if (count == MAX_RANGES)
+            return 0;
+        m_range_start[count] = start;
+        m_range_len[count] = end - start + 1;
+        count++;
+    }
+    if (specs == 0)
+        return 0;
+    return count > 0 ? count : -1;
+}
+
+// 多区间请求没有映射的大文件时，把每个区间单独映射，整批发送完后在unmap中解除
+char *http_conn::map_range(off_t start, off_t len)
+{
+    off_t page = sysconf(_SC_PAGESIZE);
+    off_t aligned = start - start % page;
+    size_t map_len = len + (start - aligned);
+    char *addr = (char *)mmap(0, map_len, PROT_READ, MAP_PRIVATE, m_file->fd, aligned);
+    if (addr == MAP_FAILED)
+        return nullptr;
+    m_range_maps[m_range_map_count] = addr;
+    m_range_map_lens[m_range_map_count] = map_len;
+    m_range_map_count++;
+    return addr + (start - aligned);
+}
+
+// 循环读取客户数据，直到无数据可读或对方关闭连接
+// 非阻塞ET工作模式下，需要一次性将数据读完
+bool http_conn::read_once()
+{
+    // 留出一个字节作为结束符的位置
+    // 缓冲区满了先扩容，已经达到上限说明请求过大
+    if (m_read_idx >= m_read_buf_size - 1 && !grow_read_buf())
+        return false;
+    int bytes_read = 0;
+
+    // LT读取数据，没读完下次epoll_wait还会通知
+    if (0 == m_TRIGMode)
+    {
+        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, m_read_buf_size - 1 - m_read_idx, 0);
+        if (bytes_read <= 0)
+            return false;
+        m_read_idx += bytes_read;
+        return true;
+    }
+    // ET读数据，必须读到EAGAIN为止
+    while (true)
+    {
+        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, m_read_buf_size - 1 - m_read_idx, 0);
+        if (bytes_read == -1)
+        {
+            // 非阻塞下内核缓冲区已读空
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return false;
+        }
+        else if (bytes_read == 0) // 对端关闭连接
+            return false;
+        m_read_idx += bytes_read;
+        if (m_read_idx >= m_read_buf_size - 1 && !grow_read_buf())
+            break;
     }
-    // 若请求还未完全接收
+    return true;
+}
+
+// 读缓冲区扩大一倍（第一次使用时分配初始大小）
+// 已解析出的m_url等指针指向旧缓冲区，需要按新地址平移
+bool http_conn::grow_read_buf()
+{
+    long new_size = m_read_buf ? m_read_buf_size * 2 : READ_BUFFER_SIZE;
+    if (new_size > MAX_READ_BUFFER_SIZE)
+        return false;
+
+    size_t real_size = 0;
+    char *buf = buffer_pool::alloc(new_size, &real_size);
+    if (!buf)
+        return false;
+    if (m_read_buf)
+    {
+        memcpy(buf, m_read_buf, m_read_idx);
+        char **ptrs[] = {&m_url, &m_version, &m_host, &m_accept_encoding,
+                         &m_if_none_match, &m_range, &m_transfer_encoding, &m_if_modified_since,
+                         &m_if_range};
+        for (char **p : ptrs)
+        {
+            if (*p && *p >= m_read_buf && *p < m_read_buf + m_read_buf_size)
+                *p = buf + (*p - m_read_buf);
+        }
+        buffer_pool::release(m_read_buf, m_read_buf_size);
+    }
+    memset(buf + m_read_idx, '\0', real_size - m_read_idx);
+    m_read_buf = buf;
+    m_read_buf_size = real_size;
+    return true;
+}
+
+// 写缓冲区扩大一倍（第一次使用时分配初始大小）
+// 已排队的响应头iovec指向旧缓冲区，需要按新地址平移
+bool http_conn::grow_write_buf()
+{
+    int new_size = m_write_buf ? m_write_buf_size * 2 : WRITE_BUFFER_SIZE;
+    if (new_size > MAX_WRITE_BUFFER_SIZE)
+        return false;
+
+    size_t real_size = 0;
+    char *buf = buffer_pool::alloc(new_size, &real_size);
+    if (!buf)
+        return false;
+    if (m_write_buf)
+    {
+        memcpy(buf, m_write_buf, m_write_idx);
+        for (int i = 0; i < m_iv_count; i++)
+        {
+            char *base = (char *)m_iv[i].iov_base;
+            if (base >= m_write_buf && base < m_write_buf + m_write_buf_size)
+                m_iv[i].iov_base = buf + (base - m_write_buf);
+        }
+        buffer_pool::release(m_write_buf, m_write_buf_size);
+    }
+    buf[m_write_idx] = '\0';
+    m_write_buf = buf;
+    m_write_buf_size = real_size;
+    return true;
+}
+
+// 读缓冲区中没有未处理的数据、写缓冲区中没有待发送的数据时归还给buffer_pool
+// force为true时（连接关闭）无条件归还
+void http_conn::release_buffers(bool force)
+{
+    if (m_read_buf && (force || m_read_idx == 0))
+    {
+        buffer_pool::release(m_read_buf, m_read_buf_size);
+        m_read_buf = nullptr;
+        m_read_buf_size = 0;
+        m_read_idx = 0;
+    }
+    if (m_write_buf && (force || (m_write_idx == 0 && bytes_to_send == 0)))
+    {
+        buffer_pool::release(m_write_buf, m_write_buf_size);
+        m_write_buf = nullptr;
+        m_write_buf_size = 0;
+        m_write_idx = 0;
+    }
+}
+
+// 消费读缓冲区中已经收到的消息体，判断消息体是否完整
+// 消息体按收到的顺序交给on_body，消费过的部分从读缓冲区中移除，
+// 所以消息体再大也只占用读缓冲区中请求头之后的一小段
+http_conn::HTTP_CODE http_conn::parse_content()
+{
+    long pos = m_checked_idx;
+    bool done = false;
+    if (m_chunked)
+    {
+        HTTP_CODE ret = parse_chunked(pos);
+        if (ret == BAD_REQUEST)
+            return BAD_REQUEST;
+        done = (ret == GET_REQUEST);
+    }
+    else
+    {
+        long n = m_content_length - m_body_size;
+        if (n > m_read_idx - pos)
+            n = m_read_idx - pos;
+        if (n > 0 && !on_body(m_read_buf + pos, n))
+            return BAD_REQUEST;
+        pos += n;
+        done = (m_body_size == m_content_length);
+    }
+
+    if (done)
+    {
+        // 消息体完整，m_checked_idx指向流水线中的下一个请求
+        // POST请求中最后为输入的用户名和密码，保存在m_string中
+        m_checked_idx = pos;
+        m_string = &m_body[0];
+        return GET_REQUEST;
+    }
+
+    // 丢弃已经消费的消息体，未消费的部分（不完整的块大小行等）移到消息体起点
+    long left = m_read_idx - pos;
+    memmove(m_read_buf + m_body_start, m_read_buf + pos, left);
+    m_read_idx = m_body_start + left;
+    m_checked_idx = m_body_start;
     return NO_REQUEST;
 }
 
+// 分块编码解码，从pos开始消费，块数据交给on_body
+// 返回GET_REQUEST表示最后一个块和尾部字段已经收完，NO_REQUEST表示需要更多数据
+http_conn::HTTP_CODE http_conn::parse_chunked(long &pos)
+{
+    while (pos < m_read_idx)
+    {
+        switch (m_chunk_state)
+        {
+        case CHUNK_SIZE:
+        case CHUNK_TRAILER:
+        {
+            // 块大小行和尾部字段都需要一整行
+            char *line = m_read_buf + pos;
+            char *lf = (char *)memchr(line, '\n', m_read_idx - pos);
+            if (!lf)
+            {
+                if (m_read_idx - pos > MAX_CHUNK_LINE)
+                    return BAD_REQUEST;
+                return NO_REQUEST;
+            }
+            pos = lf - m_read_buf + 1;
+            if (m_chunk_state == CHUNK_TRAILER)
+            {
+                // 空行表示消息结束，其余尾部字段忽略
+                if (lf == line || (lf == line + 1 && *line == '\r'))
+                    return GET_REQUEST;
+                break;
+            }
+            // 十六进制的块大小，之后可能有;开头的扩展，忽略
+            if (!isxdigit((unsigned char)*line))
+                return BAD_REQUEST;
+            char *end = nullptr;
+            long long size = strtoll(line, &end, 16);
+            if (size < 0 || (m_body_max_size > 0 && m_body_size + size > m_body_max_size))
+                return BAD_REQUEST;
+            m_chunk_left = size;
+            m_chunk_state = size == 0 ? CHUNK_TRAILER : CHUNK_DATA;
+            break;
+        }
+        case CHUNK_DATA:
+        {
+            long n = m_chunk_left;
+            if (n > m_read_idx - pos)
+                n = m_read_idx - pos;
+            if (!on_body(m_read_buf + pos, n))
+                return BAD_REQUEST;
+            pos += n;
+            m_chunk_left -= n;
+            if (m_chunk_left == 0)
+                m_chunk_state = CHUNK_DATA_END;
+            break;
+        }
+        case CHUNK_DATA_END:
+        {
+            // 块数据之后必须是"\r\n"
+            if (m_read_buf[pos] == '\r')
+            {
+                if (pos + 1 >= m_read_idx)
+                    return NO_REQUEST;
+                pos++;
+            }
+            if (m_read_buf[pos] != '\n')
+                return BAD_REQUEST;
+            pos++;
+            m_chunk_state = CHUNK_SIZE;
+            break;
+        }
+        }
+    }
+    return NO_REQUEST;
+}
+
+// 保存一段消息体
+// 内存中的消息体超过m_body_memory_limit时转存到临时文件（打开后立即unlink，关闭即删除），之后直接追加到文件
+bool http_conn::on_body(const char *data, long len)
+{
+    m_body_size += len;
+    if (m_body_max_size > 0 && m_body_size > m_body_max_size)
+        return false;
+
+    if (m_body_fd < 0 && !m_body_spill_dir.empty() &&
+        (long)m_body.size() + len > m_body_memory_limit)
+    {
+        string path = m_body_spill_dir + "/webserver_body_XXXXXX";
+        m_body_fd = mkstemp(&path[0]);
+        if (m_body_fd < 0)
+            return false;
+        unlink(path.c_str());
+        if (!m_body.empty() && ::write(m_body_fd, m_body.data(), m_body.size()) != (ssize_t)m_body.size())
+            return false;
+        string().swap(m_body);
+    }
+
+    if (m_body_fd < 0)
+    {
+        m_body.append(data, len);
+        return true;
+    }
+    while (len > 0)
+    {
+        ssize_t n = ::write(m_body_fd, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// 一个请求结束后释放消息体占用的内存和临时文件
+void http_conn::close_body()
+{
+    if (m_body_fd >= 0)
+    {
+        close(m_body_fd);
+        m_body_fd = -1;
+    }
+    // 大的消息体不保留内存，小的保留容量给下一个请求
+    if (m_body.capacity() > (size_t)m_body_memory_limit)
+        string().swap(m_body);
+    else
+        m_body.clear();
+}
+
 // 将事件重置为EPOLLONESHOT
 void modfd(int epollfd, int fd, int ev, int TRIGMode)
 {
@@ -558,8 +1376,220 @@ void modfd(int epollfd, int fd, int ev, int TRIGMode)
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
+// 归还do_request以及已排队的响应从文件缓存、页面缓存获取的资源
+void http_conn::unmap()
+{
+    for (int i = 0; i < m_resp_count; i++)
+    {
+        if (m_resp_files[i])
+            file_cache::get_instance()->release(m_resp_files[i]);
+        if (m_resp_snaps[i])
+            page_cache::get_instance()->release(m_resp_snaps[i]);
+        if (m_resp_compressed[i])
+            compress_cache::get_instance()->release(m_resp_compressed[i]);
+        m_resp_files[i] = nullptr;
+        m_resp_snaps[i] = nullptr;
+        m_resp_compressed[i] = nullptr;
+    }
+    m_resp_count = 0;
+    m_sendfile = nullptr;
+
+    for (int i = 0; i < m_range_map_count; i++)
+        munmap(m_range_maps[i], m_range_map_lens[i]);
+    m_range_map_count = 0;
+
+    // 被推迟的请求还要用它自己的文件生成响应
+    if (m_write_deferred)
+        return;
+    if (m_file)
+    {
+        file_cache::get_instance()->release(m_file);
+        m_file = nullptr;
+        m_file_address = nullptr;
+    }
+    if (m_page_snap)
+    {
+        page_cache::get_instance()->release(m_page_snap);
+        m_page_snap = nullptr;
+        m_cached_page = nullptr;
+    }
+    if (m_compressed)
+    {
+        compress_cache::get_instance()->release(m_compressed);
+        m_compressed = nullptr;
+    }
+}
+
+// 用writev把排队的所有响应发给客户端
+// 返回false表示需要由事件循环关闭连接
+bool http_conn::write()
+{
+    long temp = 0;
+
+    // 没有要发送的数据，重新监听读事件，准备接收下一个请求
+    if (bytes_to_send == 0)
+    {
+        unmap();
+        init_write();
+        release_buffers();
+        if (m_read_idx > 0 || m_write_deferred)
+            m_pipelined = true;
+        else
+            modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+        return true;
+    }
+
+    while (1)
+    {
+        // m_iv发完后，最后一个响应如果是未映射的大文件，用sendfile直接从fd发送，数据不经过用户态
+        bool use_sendfile = m_sendfile && m_iv_idx == m_iv_count;
+        if (use_sendfile)
+            temp = sendfile(m_sockfd, m_sendfile->fd, &m_file_offset, bytes_to_send);
+        else
+            temp = writev(m_sockfd, m_iv + m_iv_idx, m_iv_count - m_iv_idx);
+        if (temp < 0)
+        {
+            // 发送缓冲区已满，等待下一次EPOLLOUT事件
+            if (errno == EAGAIN)
+            {
+                modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+                return true;
+            }
+            unmap();
+            return false;
+        }
+        // sendfile返回0说明文件在发送期间被截短，剩余的字节永远发不出去，关闭连接
+        if (use_sendfile && temp == 0)
+        {
+            LOG_WARN("sendfile reached EOF with %lld bytes unsent", (long long)bytes_to_send);
+            unmap();
+            return false;
+        }
+
+        bytes_have_send += temp;
+        bytes_to_send -= temp;
+        // 从m_iv中去掉已经发送的部分
+        while (!use_sendfile && temp > 0 && m_iv_idx < m_iv_count)
+        {
+            if (temp >= (long)m_iv[m_iv_idx].iov_len)
+            {
+                temp -= m_iv[m_iv_idx].iov_len;
+                m_iv[m_iv_idx++].iov_len = 0;
+            }
+            else
+            {
+                m_iv[m_iv_idx].iov_base = (char *)m_iv[m_iv_idx].iov_base + temp;
+                m_iv[m_iv_idx].iov_len -= temp;
+                temp = 0;
+            }
+        }
+
+        if (bytes_to_send <= 0)
+        {
+            bool close_after = m_close_after;
+            unmap();
+            init_write();
+            // 写缓冲区发完即归还，读缓冲区没有剩余请求时也一起归还
+            release_buffers();
+            // 最后一个响应不是长连接，关闭
+            if (close_after)
+                return false;
+            // 读缓冲区中还有流水线请求或被推迟的响应时不重新注册读事件，由调用者接着调用process()
+            if (m_read_idx > 0 || m_write_deferred)
+            {
+                m_pipelined = true;
+                return true;
+            }
+            modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+            return true;
+        }
+    }
+}
+
+// m_write_buf中还没有加入发送队列的部分（响应头）加入m_iv
+void http_conn::push_head()
+{
+    if (m_write_idx > m_head_start)
+    {
+        m_iv[m_iv_count].iov_base = m_write_buf + m_head_start;
+        m_iv[m_iv_count].iov_len = m_write_idx - m_head_start;
+        bytes_to_send += m_write_idx - m_head_start;
+        m_iv_count++;
+    }
+    m_head_start = m_write_idx;
+}
+
+void http_conn::push_body(const char *body, long body_len)
+{
+    if (body && body_len > 0)
+    {
+        m_iv[m_iv_count].iov_base = (char *)body;
+        m_iv[m_iv_count].iov_len = body_len;
+        bytes_to_send += body_len;
+        m_iv_count++;
+    }
+}
+
+// 把当前响应加入发送队列：m_write_buf中本响应的状态行和头部，以及内容（文件映射或缓存的完整响应）
+// send_len大于0时，内容是没有映射的大文件从send_offset开始的send_len字节，在m_iv之后用sendfile发送
+// 同时接管do_request获取的文件和快照，整批发送完后再归还
+bool http_conn::queue_response(const char *body, long body_len, off_t send_offset, off_t send_len)
+{
+    // HEAD请求的响应头与GET相同，但不发送内容
+    if (m_method == HEAD)
+    {
+        body = nullptr;
+        send_len = 0;
+    }
+
+    push_head();
+    push_body(body, body_len);
+
+    if (m_file && send_len > 0)
+    {
+        m_sendfile = m_file;
+        m_file_offset = send_offset;
+        bytes_to_send += send_len;
+    }
+
+    m_resp_files[m_resp_count] = m_file;
+    m_resp_snaps[m_resp_count] = m_page_snap;
+    m_resp_compressed[m_resp_count] = m_compressed;
+    m_resp_count++;
+    m_file = nullptr;
+    m_compressed = nullptr;
+    m_file_address = nullptr;
+    m_page_snap = nullptr;
+    m_cached_page = nullptr;
+
+    if (!m_linger)
+        m_close_after = true;
+    return true;
+}
+
 bool http_conn::process_write(HTTP_CODE ret)
 {
+    // 命中页面缓存的文件请求，直接使用预先生成的完整响应
+    if (ret == FILE_REQUEST && m_cached_page)
+        return queue_response(m_cached_page->data(), m_cached_page->size());
+
+    // 错误页面同样优先使用缓存
+    int status = 0;
+    if (ret == INTERNAL_ERROR)
+        status = 500;
+    else if (ret == BAD_REQUEST || ret == NO_RESOURCE)
+        status = 404;
+    else if (ret == FORBIDDEN_REQUEST)
+        status = 403;
+    if (status && !m_page_snap && m_method != HEAD)
+        m_page_snap = page_cache::get_instance()->acquire();
+    if (status && m_page_snap)
+    {
+        const string *response = m_page_snap->error_page(status, m_linger);
+        if (response)
+            return queue_response(response->data(), response->size());
+    }
+
     switch (ret)
     {
     // 服务器内部错误 
@@ -573,6 +1603,7 @@ bool http_conn::process_write(HTTP_CODE ret)
     }
     // 请求不合法
     case BAD_REQUEST:
+    case NO_RESOURCE: // 资源不存在
     {
         add_status_line(404, error_404_title); // 行
         add_headers(strlen(error_404_form)); // 头
@@ -589,20 +1620,63 @@ bool http_conn::process_write(HTTP_CODE ret)
             return false;
         break;
     }
+    // 不支持的请求方法，用Allow告诉客户端支持哪些方法
+    case NOT_ALLOWED:
+    {
+        add_status_line(405, error_405_title);
+        add_response("Allow: GET, HEAD, POST\r\n");
+        add_headers(strlen(error_405_form));
+        if(!add_content(error_405_form))
+            return false;
+        break;
+    }
+    // 只发送请求的区间
+    case PARTIAL_CONTENT:
+    {
+        add_status_line(206, partial_206_title);
+        if (!add_validators())
+            return false;
+        return add_ranges();
+    }
+    // 请求的区间都超出了文件范围
+    case RANGE_NOT_SATISFIABLE:
+    {
+        add_status_line(416, error_416_title);
+        add_response("Content-Range: bytes */%lld\r\n", (long long)m_file_stat.st_size);
+        add_headers(strlen(error_416_form));
+        if(!add_content(error_416_form))
+            return false;
+        break;
+    }
+    // 客户端缓存仍然有效，只发送响应头
+    case NOT_MODIFIED:
+    {
+        if (!add_status_line(304, not_modified_304_title) || !add_validators() ||
+            !add_linger() || !add_black_line())
+            return false;
+        break;
+    }
     // 文件请求
     case FILE_REQUEST:
     {
         add_status_line(200, ok_200_title);
+        if (!add_validators())
+            return false;
+        // 实时压缩的结果
+        if (m_compressed)
+        {
+            if (!add_headers(m_compressed->data.size()))
+                return false;
+            return queue_response(m_compressed->data.data(), m_compressed->data.size());
+        }
         if(m_file_stat.st_size != 0)
         {
-            add_headers(m_file_stat.st_size);
-            m_iv[0].iov_base = m_write_buf;
-            m_iv[0].iov_len = m_write_idx;
-            m_iv[1].iov_base = m_file_address;
-            m_iv[1].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
-            bytes_to_send = m_write_idx + m_file_stat.st_size;
-            return true;
+            if (!add_headers(m_file_stat.st_size))
+                return false;
+            // 已映射的文件和响应头一起writev，否则文件部分在write()中用sendfile发送
+            if (m_file_address)
+                return queue_response(m_file_address, m_file_stat.st_size);
+            return queue_response(nullptr, 0, 0, m_file_stat.st_size);
         }
         else
         {
@@ -611,16 +1685,13 @@ bool http_conn::process_write(HTTP_CODE ret)
             if(!add_content(ok_string))
                 return false;
         }
+        break;
     }
     default:
         return false;
     }
-    // 当没有文件内容时，准备发送 m_write_buf 中的数据
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
-    return true;
+    // 当没有文件内容时，只发送 m_write_buf 中本响应的数据
+    return queue_response(nullptr, 0);
 }
 
 bool http_conn::add_status_line(int status, const char *title)
@@ -628,24 +1699,96 @@ bool http_conn::add_status_line(int status, const char *title)
     return add_response("%s %d %s\r\n", "HTTP/1.1", status,title);
 }
 
-bool http_conn::add_headers(int content_len)
+bool http_conn::add_headers(long long content_len)
 {
     return add_content_length(content_len) && add_linger() && add_black_line();
 }
 
 bool http_conn::add_content(const char *content)
 {
+    if (m_method == HEAD)
+        return true;
     return add_response("%s",content);
 }
 
-bool http_conn::add_content_length(int content_len)
+bool http_conn::add_content_length(long long content_len)
 {
-    return add_response("Content-Type:%s\r\n",content_len);
+    return add_response("Content-Length:%lld\r\n",content_len);
 }
 
 bool http_conn::add_linger()
 {
-    return add_response("Connection%s\r\n",(m_linger == true) ? "keep_alive":"close");
+    return add_response("Connection: %s\r\n",(m_linger == true) ? "keep-alive":"close");
+}
+
+// ETag、Last-Modified以及按路径配置的Cache-Control
+bool http_conn::add_validators()
+{
+    char etag[cache_control::ETAG_LEN], date[cache_control::DATE_LEN];
+    cache_control::make_etag(m_file_stat, etag, sizeof(etag), encoding_names[m_encoding]);
+    cache_control::format_date(m_file_stat.st_mtime, date, sizeof(date));
+    if (m_encoding != ENC_IDENTITY && !add_response("Content-Encoding: %s\r\n", encoding_names[m_encoding]))
+        return false;
+    if (m_vary && !add_response("Vary: Accept-Encoding\r\n"))
+        return false;
+    if (!add_response("ETag: %s\r\nLast-Modified: %s\r\nAccept-Ranges: bytes\r\n", etag, date))
+        return false;
+    // 按站点根目录下的路径查找，与page_cache中页面的名字一致
+    const char *policy = cache_control::get_instance()->lookup(m_real_file + strlen(doc_root));
+    if (policy)
+        return add_response("Cache-Control: %s\r\n", policy);
+    return true;
+}
+
+// 206响应的Content-Range等头部和各区间的内容
+// 单个区间直接发送文件的这一段；多个区间按multipart/byteranges发送，
+// 各部分的分隔头写在m_write_buf中，内容指向文件映射，与分隔头交替加入m_iv
+bool http_conn::add_ranges()
+{
+    long long size = m_file_stat.st_size;
+    if (m_range_count == 1)
+    {
+        off_t start = m_range_start[0], len = m_range_len[0];
+        if (!add_response("Content-Range: bytes %lld-%lld/%lld\r\n", (long long)start, (long long)(start + len - 1), size) ||
+            !add_headers(len))
+            return false;
+        if (m_file_address)
+            return queue_response(m_file_address + start, len);
+        return queue_response(nullptr, 0, start, len);
+    }
+
+    static const char *part_format = "\r\n--%s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n";
+    static const char *end_format = "\r\n--%s--\r\n";
+    static std::atomic<unsigned long> boundary_seq(0);
+    char boundary[32];
+    snprintf(boundary, sizeof(boundary), "%020lu", ++boundary_seq);
+
+    // 先算出各部分分隔头和内容的总长度
+    long long total = snprintf(nullptr, 0, end_format, boundary);
+    for (int i = 0; i < m_range_count; i++)
+    {
+        off_t start = m_range_start[i], len = m_range_len[i];
+        total += snprintf(nullptr, 0, part_format, boundary, (long long)start, (long long)(start + len - 1), size) + len;
+    }
+    if (!add_response("Content-Type: multipart/byteranges; boundary=%s\r\n", boundary) || !add_headers(total))
+        return false;
+    if (m_method == HEAD)
+        return queue_response(nullptr, 0);
+
+    for (int i = 0; i < m_range_count; i++)
+    {
+        off_t start = m_range_start[i], len = m_range_len[i];
+        if (!add_response(part_format, boundary, (long long)start, (long long)(start + len - 1), size))
+            return false;
+        const char *body = m_file_address ? m_file_address + start : map_range(start, len);
+        if (!body)
+            return false;
+        push_head();
+        push_body(body, len);
+    }
+    if (!add_response(end_format, boundary))
+        return false;
+    return queue_response(nullptr, 0);
 }
 
 bool http_conn::add_black_line()
@@ -656,31 +1799,39 @@ bool http_conn::add_black_line()
 // 接受一个格式字符串 format，后面可以跟多个可变参数（使用 ... 表示）
 bool http_conn::add_response(const char *format, ...)
 {
-    // 如果当前的写入索引大于或等于预设的写缓冲区大小
-    // 返回 false，表示无法再继续添加响应内容
-    if (m_write_idx >= WRITE_BUFFER_SIZE)
+    // 第一次写入时才分配写缓冲区
+    if (!m_write_buf && !grow_write_buf())
         return false;
     va_list arg_list; // va_list 用于存储可变参数列表
 
     va_start(arg_list, format); // 初始化arg_list
-    // 使用 vsnprintf 函数将格式化后的字符串写入 m_write_buf 的指定位置
-    // （m_write_idx 到 m_write_buf 的末尾）
-    int len = vsnprintf(m_write_buf + m_write_idx,
-                        WRITE_BUFFER_SIZE - 1 - m_write_idx,
-                        format, arg_list);
-
-    // 检查写入长度，如果返回的长度 len 大于或等于剩余的缓冲区大小
-    // 结束可变参数的处理（调用 va_end）。
-    // 返回 false，表示写入失败。
-    if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx))
-    {
-        va_end(arg_list);
-        return false;
+    while (true)
+    {
+        va_list args;
+        va_copy(args, arg_list); // 空间不够扩容后需要重新格式化，每次使用一份拷贝
+        // 使用 vsnprintf 函数将格式化后的字符串写入 m_write_buf 的指定位置
+        // （m_write_idx 到 m_write_buf 的末尾）
+        int len = vsnprintf(m_write_buf + m_write_idx,
+                            m_write_buf_size - 1 - m_write_idx,
+                            format, args);
+        va_end(args);
+
+        // 写入成功，更新写入索引
+        if (len < (m_write_buf_size - 1 - m_write_idx))
+        {
+            m_write_idx += len;
+            break;
+        }
+        // 检查写入长度，如果返回的长度 len 大于或等于剩余的缓冲区大小
+        // 扩容后重试，已经达到上限则返回 false，表示写入失败。
+        if (!grow_write_buf())
+        {
+            va_end(arg_list);
+            return false;
+        }
     }
-    // 更新写入索引,并结束可变参数处理
-    m_write_idx += len;
     va_end(arg_list);
 
-    LOG_INFO("resquest:%s",m_write_buf);
+    LOG_DEBUG("resquest:%s",m_write_buf);
     return true;
 }
@@ -4,13 +4,25 @@
 #include <sys/epoll.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
 #include <fcntl.h>
 #include <string.h>
+#include <errno.h>
+#include <stdarg.h>
 #include<unistd.h>
 #include<map>
+#include <atomic>
 
 #include "../CGlmysql/sql_connection_pool.h"
+#include "../CGlmysql/async_sql.h"
+#include "../CGlmysql/register_queue.h"
 #include "../log/log.h"
+#include "file_cache.h"
+#include "page_cache.h"
+#include "http_scanner.h"
+#include "cache_control.h"
+#include "compress_cache.h"
 // 定义http连接类
 class http_conn
 {
@@ -21,8 +33,14 @@ public:
     // 即只会定义一次，其他实例共享这个变量
     // 通过类名访问
     static const int FILENAME_LEN = 200;       // 文件名的最大长度
-    static const int READ_BUFFER_SIZE = 2048;  // 读取缓存区大小
-    static const int WRITE_BUFFER_SIZE = 1024; // 写入缓存区大小
+    static const int READ_BUFFER_SIZE = 2048;        // 读取缓存区初始大小
+    static const int WRITE_BUFFER_SIZE = 1024;       // 写入缓存区初始大小
+    static const int MAX_READ_BUFFER_SIZE = 65536;   // 读取缓存区最多增长到的大小
+    static const int MAX_WRITE_BUFFER_SIZE = 16384;  // 写入缓存区最多增长到的大小
+    static const int MAX_PIPELINE = 16;        // 一批最多排队发送的流水线响应数
+    static const int WRITE_RESERVE = 256;      // 写缓冲区剩余空间少于该值时不再处理下一个流水线请求
+    static const int MAX_RANGES = 8;           // 一个Range请求最多的区间数，超过时忽略Range返回整个文件
+    static const int MAX_CHUNK_LINE = 1024;    // 分块编码中块大小行、尾部字段行的最大长度
 
     // 定义枚举类型的成员，为一组连续的整数常量，定义之后不可修改
     // 默认从0开始（或者显示定义开始的值），后续的值依次递增
@@ -61,7 +79,29 @@ public:
         FORBIDDEN_REQUEST, // 客户对资源没有足够的访问权限
         FILE_REQUEST,      // 文件请求
         INTERNAL_ERROR,    // 服务器内部错误
-        CLOSED_CONNECTION  // 客户端已经关闭连接
+        CLOSED_CONNECTION, // 客户端已经关闭连接
+        NOT_ALLOWED,       // 认识但不支持的请求方法
+        NOT_MODIFIED,      // 条件请求命中，返回304
+        PARTIAL_CONTENT,   // Range请求，返回206
+        RANGE_NOT_SATISFIABLE, // Range中没有可以满足的区间，返回416
+        SQL_REQUEST        // 已提交异步数据库操作，连接暂停处理，结果返回后继续
+    };
+
+    // 异步数据库操作的状态
+    enum SQL_STATE
+    {
+        SQL_NONE = 0, // 没有进行中的数据库操作
+        SQL_WAIT,     // 已提交，等待结果
+        SQL_DONE      // 结果已返回，等待process继续处理被暂停的请求
+    };
+
+    // 分块传输编码(chunked)的解码状态
+    enum CHUNK_STATE
+    {
+        CHUNK_SIZE = 0,  // 读取块大小行
+        CHUNK_DATA,      // 读取块数据
+        CHUNK_DATA_END,  // 块数据之后的"\r\n"
+        CHUNK_TRAILER    // 最后一个块之后的尾部字段，直到空行
     };
 
     // 从状态机主要用于逐行读取数据
@@ -77,34 +117,98 @@ public:
 public:
     // 直接完整定义*空的*构造函数和析构函数，所以没有;
     // 没有具体初始化或清理操作
-    http_conn() {}
-    ~http_conn() {}
+    // 读写缓冲区在第一次使用时才从buffer_pool分配，连接空闲或关闭时归还
+    http_conn() : m_read_buf(nullptr), m_read_buf_size(0), m_read_idx(0),
+                  m_write_buf(nullptr), m_write_buf_size(0), m_async_sql(nullptr),
+                  m_register_callback(nullptr), m_register_owner(nullptr) {}
+    ~http_conn() { release_buffers(true); }
 
     // 声明公共成员函数
 public:
-    void init(int sockfd, const sockaddr_in &addr, char *root,
+    // epollfd为该连接所属事件循环(event_loop)的epoll实例
+    // 连接从注册到关闭始终只在这一个循环里被处理，不会跨线程
+    void init(int epollfd, int sockfd, const sockaddr_in &addr, char *root,
               int TRIGMode, int close_log, string user,
               string passwd, string sqlname);
+    // 消息体的处理方式，所有连接共用，在服务启动前调用
+    // 超过memory_limit字节的消息体写入spill_dir下的临时文件（spill_dir为nullptr时全部保存在内存中），
+    // 超过max_size字节的消息体按错误请求处理，max_size为0表示不限制
+    static void init_body(long memory_limit, long long max_size, const char *spill_dir);
     void close_conn(bool real_close = true);
     void process();
+    bool read_once(); // 一次性读完内核缓冲区中的数据
+    bool write();     // 将响应写回客户端
+    sockaddr_in *get_address() { return &m_address; }
+    int get_sockfd() { return m_sockfd; } // 连接关闭后为-1
+    // write()发完一批响应后，读缓冲区中还有流水线请求，调用者需要接着调用process()
+    // 由write()记录，取出后清除：线程池模式下write()重新注册事件后连接可能已被其他线程处理，
+    // 不能再根据连接的当前状态判断，取出保证同一批流水线请求只被处理一次
+    bool pending_request() { return m_pipelined.exchange(false); }
+    // 设置后注册请求通过所属事件循环的非阻塞数据库连接执行，不再需要mysql
+    // 只能在连接由事件循环线程处理时使用，线程池模式下为nullptr
+    void set_async_sql(async_sql *sql) { m_async_sql = sql; }
+    // 设置后ACK_COMMIT模式的注册写入队列不阻塞当前线程，批次提交后通过callback通知所属事件循环
+    // 线程池模式下为nullptr，工作线程阻塞等待提交
+    void set_register_callback(register_callback callback, void *owner)
+    {
+        m_register_callback = callback;
+        m_register_owner = owner;
+    }
+    // 正在等待的注册写入队列票据，没有时为0；事件循环用来丢弃已关闭或被复用的连接的通知
+    uint64_t sql_ticket() { return m_sql_ticket; }
+    // 异步数据库操作完成，由事件循环调用，err为0表示成功；之后继续处理暂停的请求
+    void sql_done(unsigned int err);
 
 private:
     void init();
+    void init_request(); // 重置单个请求的解析状态，保留流水线中剩余的数据
+    void init_write();   // 重置写状态
     HTTP_CODE process_read();
     LINE_STATUS parse_line();
     char *get_line(){return m_read_buf + m_start_line;};
     HTTP_CODE parse_request_line(char *text);
     HTTP_CODE parse_headers(char *text);
-    HTTP_CODE parse_content(char *text);
+    // 各请求头的处理函数，由parse_headers按http_scanner::HEADER查表调用
+    typedef HTTP_CODE (http_conn::*header_handler)(char *value);
+    static const header_handler m_header_handlers[http_scanner::HEADER_COUNT];
+    HTTP_CODE on_unknown(char *value);
+    HTTP_CODE on_connection(char *value);
+    HTTP_CODE on_content_length(char *value);
+    HTTP_CODE on_host(char *value);
+    HTTP_CODE on_accept_encoding(char *value);
+    HTTP_CODE on_if_none_match(char *value);
+    HTTP_CODE on_range(char *value);
+    HTTP_CODE on_transfer_encoding(char *value);
+    HTTP_CODE on_if_modified_since(char *value);
+    HTTP_CODE on_if_range(char *value);
+    bool not_modified(const char *etag, time_t mtime);
+    void negotiate_encoding();
+    int parse_range(const char *etag);
+    bool add_ranges();
+    char *map_range(off_t start, off_t len);
+    HTTP_CODE parse_content();
+    HTTP_CODE parse_chunked(long &pos);
+    bool on_body(const char *data, long len);
+    void close_body();
     HTTP_CODE do_request();
+    HTTP_CODE do_file_request();
+    HTTP_CODE finish_sql();
     bool process_write(HTTP_CODE ret);
     bool add_status_line(int status,const char *title);
     bool add_response(const char *format, ...);
-    bool add_headers(int content_length);
-    bool add_content_length(int content_length);
+    bool add_headers(long long content_length);
+    bool add_content_length(long long content_length);
     bool add_linger();
     bool add_black_line();
+    bool add_validators();
     bool add_content(const char *content);
+    void push_head();
+    void push_body(const char *body, long body_len);
+    bool queue_response(const char *body, long body_len, off_t send_offset = 0, off_t send_len = 0);
+    void unmap();
+    bool grow_read_buf();
+    bool grow_write_buf();
+    void release_buffers(bool force = false); // 归还空闲的读写缓冲区
 
     // 声明私有变量
 private:
@@ -115,8 +219,11 @@ private:
     sockaddr_in m_address;
     int m_TRIGMode;
     char *doc_root;
-    char m_read_buf[READ_BUFFER_SIZE];
-    char m_write_buf[WRITE_BUFFER_SIZE];
+    char *m_read_buf;       // 读缓冲区，按需增长，空闲时为nullptr
+    long m_read_buf_size;
+    long m_read_idx;
+    char *m_write_buf;      // 写缓冲区，按需增长，空闲时为nullptr
+    int m_write_buf_size;
     char m_real_file[FILENAME_LEN];
     int m_close_log;
     CHECK_STATE m_check_state;
@@ -125,32 +232,90 @@ private:
     char sql_user[100];
     char sql_passwd[100];
     char sql_name[100];
-    int bytes_to_send;   // 要发送的字节数
-    int bytes_have_send; // 已经发送的字节数
+    long bytes_to_send;   // 要发送的字节数
+    long bytes_have_send; // 已经发送的字节数
     METHOD m_method;
     char *m_url;
     char *m_version; // 表示http的版本号
     char *m_host;    // 主机名
+    char *m_accept_encoding;   // Accept-Encoding字段值
+    char *m_if_none_match;     // If-None-Match字段值
+    char *m_range;             // Range字段值
+    char *m_transfer_encoding; // Transfer-Encoding字段值
+    char *m_if_modified_since; // If-Modified-Since字段值
+    char *m_if_range;          // If-Range字段值
+    int m_range_count;                  // 本次请求要发送的区间数，0表示整个文件
+    off_t m_range_start[MAX_RANGES];    // 各区间的起始偏移
+    off_t m_range_len[MAX_RANGES];      // 各区间的长度
+    char *m_range_maps[MAX_RANGES];     // 多区间请求大文件时为各区间临时映射的内存
+    size_t m_range_map_lens[MAX_RANGES];
+    int m_range_map_count;
     long m_content_length;
     int m_start_line;
     long m_checked_idx;
-    long m_read_idx;
     int m_write_idx;
     int cgi; // 是否启用的POST，通用网关接口（CGI，Common Gateway Interface）
-    char *m_string; //存储请求头数据
+    char *m_string; // 保存在内存中的消息体，以'\0'结尾；消息体写入了临时文件时为空字符串
+    bool m_chunked;          // 消息体使用分块传输编码
+    CHUNK_STATE m_chunk_state;
+    long m_chunk_left;       // 当前块还没有读取的字节数
+    long m_body_start;       // 消息体在m_read_buf中的起始位置，之前是请求行和请求头
+    long long m_body_size;   // 已经收到的消息体字节数
+    string m_body;           // 内存中的消息体
+    int m_body_fd;           // 消息体写入的临时文件，没有为-1
+    static long m_body_memory_limit;
+    static long long m_body_max_size;
+    static string m_body_spill_dir;
     struct stat m_file_stat; // struct stat 是 C/C++ 中用于存储文件状态信息的一个数据结构，通常在 POSIX（如 UNIX/Linux）系统中使用
-    struct iovec m_iv[2]; // struct iovec 是在 C/C++ 中用于描述一个内存缓冲区的结构体，通常用于实现高效的读写操作
+    struct iovec m_iv[2 * MAX_PIPELINE + 2 * MAX_RANGES]; // 每个响应最多占用两项：响应头和内容，多区间响应另外每个区间两项； struct iovec 是在 C/C++ 中用于描述一个内存缓冲区的结构体，通常用于实现高效的读写操作
     char *m_file_address;
+    cached_file *m_file;  // 从文件缓存获取的文件，发送完后归还
+    compressed_file *m_compressed; // 从压缩缓存获取的gzip结果，发送完后归还
+    int m_encoding;               // 响应内容的编码，ENCODING
+    bool m_vary;                  // 响应随Accept-Encoding变化，需要发送Vary
+    off_t m_file_offset;  // sendfile发送到的文件偏移
+    page_snapshot *m_page_snap;   // 持有的页面缓存快照，发送完后释放
+    const string *m_cached_page;  // 命中页面缓存时的完整响应
+    int m_head_start;             // 当前响应在m_write_buf中的起始位置
+    int m_iv_idx;                 // m_iv中下一个待发送的位置
+    int m_resp_count;             // 已排队的响应数
+    cached_file *m_resp_files[MAX_PIPELINE];   // 已排队响应持有的文件
+    page_snapshot *m_resp_snaps[MAX_PIPELINE]; // 已排队响应持有的页面快照
+    compressed_file *m_resp_compressed[MAX_PIPELINE]; // 已排队响应持有的压缩结果
+    cached_file *m_sendfile;      // 这一批最后一个响应需要sendfile发送的文件
+    bool m_close_after;           // 这一批发送完后关闭连接
+    bool m_write_deferred;        // 当前请求的响应放不进这一批，等这一批发完后再生成
+    HTTP_CODE m_deferred_ret;     // 被推迟的响应对应的处理结果
+    std::atomic<bool> m_pipelined; // write()发完后读缓冲区中还有未处理的流水线请求
+    long m_line_colon;            // parse_line扫描到的当前行第一个':'在m_read_buf中的位置
+    long m_text_colon;            // 当前行第一个':'相对行首的偏移，没有则为-1
     int m_iv_count;
+    async_sql *m_async_sql;       // 所属事件循环的非阻塞数据库连接，可以为空
+    SQL_STATE m_sql_state;
+    unsigned int m_sql_err;
+    char m_sql_name[100];         // 等待注册、登录结果期间保存用户名和密码
+    char m_sql_password[100];
+    char m_sql_result[100];       // 异步登录查询到的密码
+    register_callback m_register_callback;
+    void *m_register_owner;
+    uint64_t m_sql_ticket;        // 等待中的注册写入队列票据
 
 public:
+    // 每个连接记录自己所属事件循环的epoll实例，不再共享一个全局epoll
+    int m_epollfd;
     // 声明静态成员变量，在类中只能声明，不能定义具体值
-    static int m_epollfd;
-    static int m_user_count;
+    // 多个事件循环线程会同时修改，所以使用原子变量
+    static std::atomic<int> m_user_count;
     MYSQL *mysql;
     int m_state;
     int timer_flag; // 定时器状态标志
     int improv;
 };
 
+// epoll相关的工具函数，所有事件循环共用
+int setnonblocking(int fd);
+void addfd(int epollfd, int fd, bool one_shot, int TRIGMode);
+void removefd(int epollfd, int fd);
+void modfd(int epollfd, int fd, int ev, int TRIGMode);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,138 @@
+#include <string.h>
+#include <strings.h>
+#include "http_scanner.h"
+#include "perfect_hash.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_SCANNER_X86 1
+#endif
+
+namespace http_scanner
+{
+
+// 查找第一个属于{'\r','\n',':'}（with_colon为true）或{'\r','\n'}的字节
+typedef const char *(*find_func)(const char *begin, const char *end, bool with_colon);
+
+static const char *find_scalar(const char *p, const char *end, bool with_colon)
+{
+    for (; p < end; ++p)
+    {
+        if (*p == '\r' || *p == '\n' || (with_colon && *p == ':'))
+            return p;
+    }
+    return end;
+}
+
+#ifdef HTTP_SCANNER_X86
+// SSE4.2：pcmpestri一条指令比较16个字节和最多3个目标字符
+__attribute__((target("sse4.2")))
+static const char *find_sse42(const char *p, const char *end, bool with_colon)
+{
+    const __m128i needle = _mm_setr_epi8('\r', '\n', ':', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const int needle_len = with_colon ? 3 : 2;
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        int idx = _mm_cmpestri(needle, needle_len, chunk, 16,
+                               _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if (idx < 16)
+            return p + idx;
+    }
+    return find_scalar(p, end, with_colon);
+}
+
+// AVX2：一次比较32个字节，用比较结果的位掩码定位第一个匹配
+__attribute__((target("avx2")))
+static const char *find_avx2(const char *p, const char *end, bool with_colon)
+{
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i co = _mm256_set1_epi8(with_colon ? ':' : '\r');
+    for (; end - p >= 32; p += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, cr),
+                                                      _mm256_cmpeq_epi8(chunk, lf)),
+                                      _mm256_cmpeq_epi8(chunk, co));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(hit);
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    return find_scalar(p, end, with_colon);
+}
+#endif
+
+static find_func select_impl(const char **name)
+{
+#ifdef HTTP_SCANNER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        *name = "avx2";
+        return find_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        *name = "sse4.2";
+        return find_sse42;
+    }
+#endif
+    *name = "scalar";
+    return find_scalar;
+}
+
+static const char *g_impl_name = "scalar";
+// 局部静态变量只初始化一次，且是线程安全的
+static find_func get_impl()
+{
+    static find_func impl = select_impl(&g_impl_name);
+    return impl;
+}
+
+const char *scan_line(const char *begin, const char *end, const char **colon)
+{
+    find_func find = get_impl();
+    const char *p = find(begin, end, true);
+    if (p < end && *p == ':')
+    {
+        *colon = p;
+        p = find(p + 1, end, false);
+    }
+    return p;
+}
+
+// 字段名的顺序与HEADER一致（从HEADER_UNKNOWN之后开始）
+static constexpr const char *g_header_names[] = {
+    "Connection", "Content-Length", "Host", "Accept-Encoding",
+    "If-None-Match", "Range", "Transfer-Encoding", "If-Modified-Since",
+    "If-Range"};
+static_assert(sizeof(g_header_names) / sizeof(g_header_names[0]) == HEADER_COUNT - 1,
+              "g_header_names must match HEADER");
+static constexpr perfect_hash::table<HEADER_COUNT - 1, 16> g_headers(g_header_names);
+static_assert(g_headers.ok(), "no perfect hash seed for header names");
+
+// 方法名的顺序与http_conn::METHOD一致
+static constexpr const char *g_method_names[] = {
+    "GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT", "PATCH"};
+static constexpr perfect_hash::table<9, 16> g_methods(g_method_names);
+static_assert(g_methods.ok(), "no perfect hash seed for method names");
+
+HEADER match_header(const char *name, size_t len)
+{
+    int idx = g_headers.find(name, len);
+    return idx < 0 ? HEADER_UNKNOWN : (HEADER)(idx + 1);
+}
+
+int match_method(const char *name, size_t len)
+{
+    return g_methods.find(name, len);
+}
+
+const char *impl_name()
+{
+    get_impl();
+    return g_impl_name;
+}
+
+}
@@ -0,0 +1,40 @@
+#ifndef HTTP_SCANNER_H
+#define HTTP_SCANNER_H
+
+#include <stddef.h>
+
+// 请求行和请求头的向量化扫描
+// 运行时检测CPU，依次选择AVX2、SSE4.2或逐字节的实现
+namespace http_scanner
+{
+    // 已知的请求头
+    enum HEADER
+    {
+        HEADER_UNKNOWN = 0,
+        HEADER_CONNECTION,
+        HEADER_CONTENT_LENGTH,
+        HEADER_HOST,
+        HEADER_ACCEPT_ENCODING,
+        HEADER_IF_NONE_MATCH,
+        HEADER_RANGE,
+        HEADER_TRANSFER_ENCODING,
+        HEADER_IF_MODIFIED_SINCE,
+        HEADER_IF_RANGE,
+        HEADER_COUNT
+    };
+
+    // 从begin开始查找第一个'\r'或'\n'，找不到返回end
+    // 同时在*colon中记录行结束之前第一个':'的位置，没有则不修改*colon
+    const char *scan_line(const char *begin, const char *end, const char **colon);
+
+    // 根据字段名（不含':'）识别已知的请求头，大小写不敏感
+    HEADER match_header(const char *name, size_t len);
+
+    // 识别请求方法，返回值与http_conn::METHOD的顺序一致，不认识的方法返回-1
+    int match_method(const char *name, size_t len);
+
+    // 当前使用的实现："avx2"、"sse4.2"或"scalar"
+    const char *impl_name();
+}
+
+#endif
@@ -0,0 +1,282 @@
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include "page_cache.h"
+#include "cache_control.h"
+
+// 与http_conn.cpp中保持一致的错误页面内容
+static const char *error_titles[][3] = {
+    {"403", "Forbidden", "You do not have permission to get file form this server.\n"},
+    {"404", "Not Found", "The requested file was not found on this server.\n"},
+    {"500", "Internal Error", "There was an unusual problem serving the request file.\n"},
+};
+
+// 生成完整响应，validators为ETag、Last-Modified等附加的响应头
+// validators的长度取决于配置的Cache-Control，不能放进固定大小的缓冲区，与make_not_modified一样拼接string
+static string make_response(const char *status, const char *title, const string &body, bool linger,
+                            const string &validators = "")
+{
+    char length[64];
+    snprintf(length, sizeof(length), "Content-Length:%lld\r\n", (long long)body.size());
+    string response = string("HTTP/1.1 ") + status + " " + title + "\r\n" + validators + length +
+                      "Connection: " + (linger ? "keep-alive" : "close") + "\r\n\r\n";
+    response += body;
+    return response;
+}
+
+// 304响应没有内容，也不带Content-Length
+static string make_not_modified(bool linger, const string &validators)
+{
+    return "HTTP/1.1 304 Not Modified\r\n" + validators +
+           "Connection: " + (linger ? "keep-alive" : "close") + "\r\n\r\n";
+}
+
+const page_variant *cached_page::select(int accepted) const
+{
+    if ((accepted & (1 << ENC_BR)) && variants[ENC_BR].present)
+        return &variants[ENC_BR];
+    if ((accepted & (1 << ENC_GZIP)) && variants[ENC_GZIP].present)
+        return &variants[ENC_GZIP];
+    return &variants[ENC_IDENTITY];
+}
+
+// 读取整个文件
+static bool read_file(const string &path, string *body)
+{
+    struct stat st;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return false;
+    }
+    body->assign(st.st_size, '\0');
+    ssize_t total = 0;
+    while (total < st.st_size)
+    {
+        ssize_t n = read(fd, &(*body)[total], st.st_size - total);
+        if (n <= 0)
+            break;
+        total += n;
+    }
+    close(fd);
+    return total == st.st_size;
+}
+
+const cached_page *page_snapshot::find(const char *real_file) const
+{
+    auto it = pages.find(real_file);
+    if (it == pages.end())
+        return nullptr;
+    return &it->second;
+}
+
+const string *page_snapshot::error_page(int status, bool linger) const
+{
+    auto it = errors[linger].find(status);
+    if (it == errors[linger].end())
+        return nullptr;
+    return &it->second;
+}
+
+page_cache::page_cache()
+{
+    m_max_page_size = 0;
+    m_inotify_fd = -1;
+    m_current = nullptr;
+    m_readers = 0;
+}
+
+page_cache::~page_cache()
+{
+    if (m_inotify_fd != -1)
+        close(m_inotify_fd);
+}
+
+bool page_cache::init(const char *doc_root, const vector<string> &pages, size_t max_page_size)
+{
+    m_doc_root = doc_root;
+    m_page_names = pages;
+    m_max_page_size = max_page_size;
+
+    swap_snapshot(build());
+
+    // 监听doc_root目录下的写入、移动和删除事件
+    m_inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (m_inotify_fd < 0)
+        return false;
+    if (inotify_add_watch(m_inotify_fd, doc_root,
+                          IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_ATTRIB) < 0)
+        return false;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, watch_thread, this) != 0)
+        return false;
+    pthread_detach(tid);
+    return true;
+}
+
+page_snapshot *page_cache::build()
+{
+    page_snapshot *snapshot = new page_snapshot;
+    snapshot->refs = 1;
+
+    for (const string &name : m_page_names)
+    {
+        string real_file = m_doc_root + name;
+        struct stat st;
+        if (stat(real_file.c_str(), &st) < 0 || !S_ISREG(st.st_mode) ||
+            !(st.st_mode & S_IROTH) || (size_t)st.st_size > m_max_page_size)
+            continue;
+
+        string body;
+        if (!read_file(real_file, &body) || (off_t)body.size() != st.st_size)
+            continue;
+
+        cached_page &page = snapshot->pages[real_file];
+        page.mtime = st.st_mtime;
+        bool text = is_compressible(real_file.c_str());
+
+        // 各编码版本的内容：与http_conn::negotiate_encoding一致，优先使用不比原文件旧的预压缩文件，
+        // 没有.gz文件时现场做gzip压缩，br只使用预压缩文件
+        string bodies[ENC_COUNT];
+        struct stat stats[ENC_COUNT];
+        bodies[ENC_IDENTITY] = body;
+        stats[ENC_IDENTITY] = st;
+        for (int enc = ENC_IDENTITY + 1; text && !body.empty() && enc < ENC_COUNT; enc++)
+        {
+            string file = real_file + encoding_suffixes[enc];
+            if (stat(file.c_str(), &stats[enc]) == 0 && S_ISREG(stats[enc].st_mode) &&
+                (stats[enc].st_mode & S_IROTH) && stats[enc].st_mtime >= st.st_mtime &&
+                read_file(file, &bodies[enc]))
+                continue;
+            bodies[enc].clear();
+            if (enc != ENC_GZIP)
+                continue;
+            stats[enc] = st;
+            if (gzip_compress(body.data(), body.size(), &bodies[enc], 9) &&
+                bodies[enc].size() * 10 > body.size() * 9)
+                bodies[enc].clear();
+        }
+
+        for (int enc = 0; enc < ENC_COUNT; enc++)
+        {
+            page_variant &variant = page.variants[enc];
+            variant.present = (enc == ENC_IDENTITY) || !bodies[enc].empty();
+            if (!variant.present)
+                continue;
+
+            // 与http_conn::add_validators生成相同的Content-Encoding、Vary、ETag、Last-Modified和Cache-Control
+            char etag[cache_control::ETAG_LEN], date[cache_control::DATE_LEN];
+            cache_control::make_etag(stats[enc], etag, sizeof(etag), encoding_names[enc]);
+            cache_control::format_date(stats[enc].st_mtime, date, sizeof(date));
+            variant.etag = etag;
+            string validators;
+            if (enc != ENC_IDENTITY)
+                validators += string("Content-Encoding: ") + encoding_names[enc] + "\r\n";
+            if (text)
+                validators += "Vary: Accept-Encoding\r\n";
+            validators += string("ETag: ") + etag + "\r\nLast-Modified: " + date + "\r\nAccept-Ranges: bytes\r\n";
+            const char *policy = cache_control::get_instance()->lookup(name.c_str());
+            if (policy)
+                validators += string("Cache-Control: ") + policy + "\r\n";
+
+            // 空文件与http_conn中的处理一致，返回一个空页面
+            string &content = bodies[enc];
+            if (content.empty())
+                content = "<html><body></body></html>";
+            for (int linger = 0; linger < 2; linger++)
+            {
+                variant.responses[linger] = make_response("200", "OK", content, linger, validators);
+                variant.not_modified[linger] = make_not_modified(linger, validators);
+            }
+        }
+    }
+
+    for (auto &e : error_titles)
+    {
+        for (int linger = 0; linger < 2; linger++)
+            snapshot->errors[linger][atoi(e[0])] = make_response(e[0], e[1], e[2], linger);
+    }
+    return snapshot;
+}
+
+page_snapshot *page_cache::acquire()
+{
+    // 先登记为读者，保证替换快照的线程在我们增加引用计数之前不会释放它
+    m_readers.fetch_add(1, memory_order_seq_cst);
+    page_snapshot *snapshot = m_current.load(memory_order_seq_cst);
+    if (snapshot)
+        snapshot->refs.fetch_add(1, memory_order_relaxed);
+    m_readers.fetch_sub(1, memory_order_release);
+    return snapshot;
+}
+
+void page_cache::release(page_snapshot *snapshot)
+{
+    if (snapshot && snapshot->refs.fetch_sub(1, memory_order_acq_rel) == 1)
+        delete snapshot;
+}
+
+void page_cache::swap_snapshot(page_snapshot *snapshot)
+{
+    page_snapshot *old = m_current.exchange(snapshot, memory_order_seq_cst);
+    if (!old)
+        return;
+    // 等待所有可能读到旧指针的读者完成引用计数，之后再放弃缓存自身持有的引用
+    while (m_readers.load(memory_order_acquire) != 0)
+        sched_yield();
+    release(old);
+}
+
+void *page_cache::watch_thread(void *args)
+{
+    ((page_cache *)args)->watch();
+    return nullptr;
+}
+
+void page_cache::watch()
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (true)
+    {
+        ssize_t len = read(m_inotify_fd, buf, sizeof(buf));
+        if (len <= 0)
+        {
+            if (len < 0 && errno == EINTR)
+                continue;
+            break;
+        }
+
+        // 只有缓存的页面发生变化时才重新生成，一次read中的多个事件只重建一次
+        bool changed = false;
+        for (char *p = buf; p < buf + len;)
+        {
+            struct inotify_event *event = (struct inotify_event *)p;
+            if (event->len > 0)
+            {
+                string name = string("/") + event->name;
+                // 预压缩的.gz、.br文件变化时也要重新生成
+                for (const string &page : m_page_names)
+                {
+                    for (int enc = 0; enc < ENC_COUNT; enc++)
+                    {
+                        if (page + encoding_suffixes[enc] == name)
+                            changed = true;
+                    }
+                }
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+        if (changed)
+            swap_snapshot(build());
+    }
+}
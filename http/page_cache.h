@@ -0,0 +1,82 @@
+#ifndef PAGE_CACHE_H
+#define PAGE_CACHE_H
+
+#include <pthread.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "compress_cache.h"
+
+using namespace std;
+
+// 页面的一种编码版本，200和304响应分别保存Connection为close和keep-alive两个版本（下标为m_linger）
+struct page_variant
+{
+    bool present;
+    string responses[2];     // 状态行+响应头+内容
+    string not_modified[2];  // 条件请求命中时的304响应，只有响应头
+    string etag;
+};
+
+// 缓存的一个页面，文本页面另外预先生成gzip版本，存在预压缩的.br文件时也一并缓存
+struct cached_page
+{
+    page_variant variants[ENC_COUNT]; // 下标为ENCODING，未压缩的版本总是存在
+    time_t mtime;
+
+    // accepted为accept_encodings的结果，依次优先br、gzip、未压缩
+    const page_variant *select(int accepted) const;
+};
+
+// 一份不可变的完整响应快照，可以直接一次writev发出
+struct page_snapshot
+{
+    unordered_map<string, cached_page> pages; // 以m_real_file为键
+    unordered_map<int, string> errors[2];     // 以状态码为键的错误页面
+    atomic<int> refs;                         // 页面缓存本身持有一个引用，其余为正在发送的连接
+
+    const cached_page *find(const char *real_file) const;
+    const string *error_page(int status, bool linger) const;
+};
+
+// 热点静态页面的响应缓存
+// 读者通过原子指针获取当前快照并增加引用计数，全程不加锁；
+// inotify发现doc_root下文件变化时重新生成快照，替换指针后等旧快照的引用归零再释放（RCU风格）
+class page_cache
+{
+public:
+    static page_cache *get_instance()
+    {
+        static page_cache instance;
+        return &instance;
+    }
+
+    // pages为需要缓存的页面，如"/judge.html"；超过max_page_size的文件不缓存
+    // 响应中的Cache-Control取自cache_control，需要先初始化cache_control
+    bool init(const char *doc_root, const vector<string> &pages, size_t max_page_size = 1024 * 1024);
+
+    page_snapshot *acquire();               // 获取当前快照，必须与release配对
+    void release(page_snapshot *snapshot);
+
+private:
+    page_cache();
+    ~page_cache();
+
+    page_snapshot *build();                 // 读取doc_root下的页面生成新快照
+    void swap_snapshot(page_snapshot *snapshot);
+    static void *watch_thread(void *args);
+    void watch();
+
+private:
+    string m_doc_root;
+    vector<string> m_page_names;
+    size_t m_max_page_size;
+    int m_inotify_fd;
+
+    atomic<page_snapshot *> m_current;
+    atomic<int> m_readers;                  // 正在读取m_current、还没增加引用计数的读者数
+};
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef PERFECT_HASH_H
+#define PERFECT_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 编译期生成的完美哈希表，用于识别请求方法、请求头字段名等固定的一组关键字
+// 构造函数在编译期搜索一个使所有关键字落在不同槽位的种子，
+// 运行时查找只需要一次哈希加一次比较，不随关键字个数线性增长
+// 哈希和比较都不区分ASCII字母的大小写
+namespace perfect_hash
+{
+    constexpr unsigned char fold(char c)
+    {
+        return (c >= 'A' && c <= 'Z') ? (unsigned char)(c + ('a' - 'A')) : (unsigned char)c;
+    }
+
+    // FNV-1a，先转小写再参与计算
+    // FNV乘法的低位只由低位决定，最后再混合一次，让种子能影响取槽位用的低位
+    constexpr uint32_t hash(const char *s, size_t len, uint32_t seed)
+    {
+        uint32_t h = 2166136261u ^ seed;
+        for (size_t i = 0; i < len; i++)
+        {
+            h ^= fold(s[i]);
+            h *= 16777619u;
+        }
+        h ^= h >> 16;
+        h *= 0x85ebca6bu;
+        h ^= h >> 13;
+        return h;
+    }
+
+    constexpr size_t length(const char *s)
+    {
+        size_t n = 0;
+        while (s[n])
+            n++;
+        return n;
+    }
+
+    // N为关键字个数，SIZE为槽位数（2的幂，不小于N）
+    // find返回关键字在构造时传入数组中的下标，找不到返回-1
+    template <size_t N, size_t SIZE>
+    class table
+    {
+        static_assert(SIZE >= N && (SIZE & (SIZE - 1)) == 0, "SIZE must be a power of two >= N");
+
+    public:
+        constexpr table(const char *const (&names)[N])
+            : m_names(), m_lens(), m_slots(), m_seed(0)
+        {
+            for (size_t i = 0; i < N; i++)
+            {
+                m_names[i] = names[i];
+                m_lens[i] = length(names[i]);
+            }
+            for (uint32_t seed = 1; seed < MAX_SEED; seed++)
+            {
+                if (try_seed(seed))
+                {
+                    m_seed = seed;
+                    break;
+                }
+            }
+        }
+
+        // 找到了无冲突的种子，定义处用static_assert检查
+        constexpr bool ok() const { return m_seed != 0; }
+
+        int find(const char *s, size_t len) const
+        {
+            int idx = m_slots[hash(s, len, m_seed) & (SIZE - 1)];
+            if (idx < 0 || m_lens[idx] != len)
+                return -1;
+            const char *name = m_names[idx];
+            for (size_t i = 0; i < len; i++)
+            {
+                if (fold(s[i]) != fold(name[i]))
+                    return -1;
+            }
+            return idx;
+        }
+
+    private:
+        static const uint32_t MAX_SEED = 1u << 16;
+
+        constexpr bool try_seed(uint32_t seed)
+        {
+            for (size_t i = 0; i < SIZE; i++)
+                m_slots[i] = -1;
+            for (size_t i = 0; i < N; i++)
+            {
+                size_t slot = hash(m_names[i], m_lens[i], seed) & (SIZE - 1);
+                if (m_slots[slot] >= 0)
+                    return false;
+                m_slots[slot] = (int)i;
+            }
+            return true;
+        }
+
+    private:
+        const char *m_names[N];
+        size_t m_lens[N];
+        int m_slots[SIZE];
+        uint32_t m_seed;
+    };
+}
+
+#endif
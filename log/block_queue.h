@@ -56,10 +56,10 @@ public:
         m_mutex.lock();
         if (m_size >= m_max_size)
         {
-            m_mutex.unlock()
+            m_mutex.unlock();
             return true;
         }
-        m_mutex.unlock()
+        m_mutex.unlock();
         return false;
     }
 
@@ -72,7 +72,7 @@ public:
             m_mutex.unlock();
             return true;            
         }
-        m_mutex.unlock()
+        m_mutex.unlock();
         return false;        
     }
 
@@ -143,7 +143,7 @@ public:
         }
 
         m_back = (m_back + 1) % m_max_size; //当m_back到达m_max_size-1时，会回到0,实现循环队列
-        m_array[m_back] == item; //添加新元素
+        m_array[m_back] = item; //添加新元素
 
         m_size++;
 
@@ -184,7 +184,7 @@ public:
         if(m_size<=0)
         {
             t.tv_sec = now.tv_sec+ms_timeout/1000;
-            t.tv_nsec = (ms_timeout % 1000) * 1000; //获取超时的结束时间
+            t.tv_nsec = (ms_timeout % 1000) * 1000000; //获取超时的结束时间
             //等待失败或超时！立刻返回
             //等待成功，继续执行
             if(!m_cond.timewait(m_mutex.get(),t))
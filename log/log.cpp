@@ -2,49 +2,101 @@
 #include <string.h>
 #include <time.h>
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/uio.h>
 #include "log.h"
 
 using namespace std;
 
+// 当前线程的暂存区，第一次写日志时创建
+static thread_local log_stage *t_stage = nullptr;
+
+// 每个线程缓存当前这一秒的日期时间，秒数变化时才调用localtime_r重新格式化，
+// 同一秒内的日志只需拷贝缓存的前缀，再填入微秒
+struct log_clock
+{
+    time_t sec;
+    struct tm tm;
+    char prefix[32]; // "YYYY-MM-DD HH:MM:SS"
+    int prefix_len;
+};
+static thread_local log_clock t_clock = {(time_t)-1, {}, {0}, 0};
+
+static const log_clock &get_clock(time_t sec)
+{
+    if (t_clock.sec != sec)
+    {
+        t_clock.sec = sec;
+        localtime_r(&sec, &t_clock.tm);
+        t_clock.prefix_len = snprintf(t_clock.prefix, sizeof(t_clock.prefix), "%04d-%02d-%02d %02d:%02d:%02d",
+                                      t_clock.tm.tm_year + 1900, t_clock.tm.tm_mon + 1, t_clock.tm.tm_mday,
+                                      t_clock.tm.tm_hour, t_clock.tm.tm_min, t_clock.tm.tm_sec);
+    }
+    return t_clock;
+}
+
+// 日志级别对应的标识符
+static const char *const level_name[] = {"[debug]:", "[info]:", "[warn]:", "[erro]:"};
+static const int level_len[] = {8, 7, 7, 7};
+
 Log::Log()
 {
     m_count=0; //计数器初始化为0
+    m_file_no = 0;
     m_is_async = false; //默认同步传输
+    m_log_queue = nullptr;
+    m_fd = -1;
+    m_stage_size = 0;
+    m_flush_ms = 100;
+    m_clock = CLOCK_REALTIME;
+    m_binary = false;
+    m_formats_written = 0;
+    m_header_pending = false;
+    for (int i = 0; i < LOG_MOD_NUM; i++)
+        m_level[i] = LOG_LEVEL_INFO;
+    log_name[0] = '\0';
+    dir_name[0] = '\0';
 }
 
 Log::~Log()
 {
-    if(m_fp != nullptr)
+    // 关闭队列，刷新线程写完所有暂存区后退出
+    if (m_is_async)
     {
-        fclose(m_fp); //关闭文件夹
+        m_log_queue->close();
+        pthread_join(m_tid, NULL);
+        delete m_log_queue;
     }
-}
-// 异步需要设置阻塞队列的长度，同步不需要设置
-bool Log::init(int max_queue_size = 0, int close_log,
-               int log_buf_size = 8192, int split_lines = 5000000,
-               const char *file_name)
-{
-    // 如果大于等于1，表示需要设置为异步方式进行日志记录
-    // 如果设置了max_queue_size,则设置为异步
-    if (max_queue_size >= 1)
+    for (log_stage *stage : m_stages)
+        delete stage;
+    if(m_fd >= 0)
     {
-        m_is_async = true;
-        m_log_queue = new block_queue<string>(max_queue_size); // 动态分配
-        pthread_t tid;                                         // pthread_t代表POSIX 线程库中表示线程的数据类型
-        // 创建线程并异步写日志，flush_log_thread为线程函数
-        pthread_create(&tid, NULL, flush_log_thread, NULL);
+        close(m_fd); //关闭文件
     }
-
+}
+// 异步需要设置通知队列的长度，同步不需要设置
+bool Log::init(int max_queue_size, int close_log, int log_buf_size, int split_lines,
+               const char *file_name, int flush_ms, bool coarse_clock, bool binary)
+{
     m_close_log = close_log;             // 设置日志开关标志
-    m_log_buf_size = log_buf_size;       // 设置日志缓冲区大小
-    m_buf = new char[m_log_buf_size];    // 分配日志缓冲区内存
-    memset(m_buf, '\0', m_log_buf_size); // 初始化日志缓冲区
+    m_log_buf_size = log_buf_size;       // 设置单条日志的最大长度
     m_split_lines = split_lines;         // 设置日志分割行数
+    m_flush_ms = flush_ms > 0 ? flush_ms : 100;
+    // 粗粒度时钟只读vDSO中上一次时钟中断时的时间，精度为一个tick（通常1~4ms）
+    m_clock = coarse_clock ? CLOCK_REALTIME_COARSE : CLOCK_REALTIME;
+    m_binary = binary;
+    // 暂存区至少能放下几条最长的日志，超过一半时通知刷新线程
+    m_stage_size = 64 * 1024;
+    if (m_stage_size < (size_t)m_log_buf_size * 4)
+        m_stage_size = (size_t)m_log_buf_size * 4;
 
     time_t t = time(NULL); // 获取当前时间
     // 获取本地时间
-    struct tm *sys_tm = localtime(&t); // 将时间转换为本地时间,localtime函数
-    struct tm my_tm = *sys_tm;         // 复制本地时间结构体，即将当前时间信息保存在my_tm中
+    struct tm my_tm;
+    localtime_r(&t, &my_tm); // 将时间转换为本地时间，localtime_r是线程安全的版本
 
     const char *p = strrchr(file_name, '/'); // 寻找文件名中最后一个斜杠，从后往前搜索
     char log_full_name[256] = {0};           // 声明一个空的char数组,用于存放完整的日记名
@@ -52,6 +104,8 @@ bool Log::init(int max_queue_size = 0, int close_log,
     // 如果没有斜杠则表示文件名没有路径，只有一个文件名
     if (p == nullptr)
     {
+        snprintf(log_name, sizeof(log_name), "%s", file_name);
+        dir_name[0] = '\0';
         snprintf(log_full_name, 255, "%d_%02d_%02d_%s",
                  my_tm.tm_year + 1900, my_tm.tm_mon + 1,
                  my_tm.tm_mday, file_name);
@@ -60,6 +114,7 @@ bool Log::init(int max_queue_size = 0, int close_log,
     {
         strcpy(log_name, p + 1);
         strncpy(dir_name, file_name, p - file_name + 1); // 表示只拷贝前p-file_name+1个字符
+        dir_name[p - file_name + 1] = '\0';
         snprintf(log_full_name, 255, "%s%d_%02d_%02d_%s",
                  dir_name, my_tm.tm_year + 1900, my_tm.tm_mon + 1,
                  my_tm.tm_mday, log_name);
@@ -67,126 +122,363 @@ bool Log::init(int max_queue_size = 0, int close_log,
 
     m_today = my_tm.tm_mday; // 记录当天日期
 
-    m_fp = fopen(log_full_name, "a");
-    // 如果路径错误则会返回一个空指针
-    if (m_fp == nullptr)
+    // 以追加方式打开，每次write都写到文件末尾，多个线程同时写入时不会互相覆盖
+    m_fd = open(log_full_name, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    // 如果路径错误则会返回-1
+    if (m_fd < 0)
     {
         return false; // 初始化失败
     }
+    // 二进制日志每个文件以文件头开始，同步时立即写入，异步时由刷新线程写入
+    m_header_pending = m_binary;
+    if (m_binary && max_queue_size < 1)
+    {
+        pending_formats();
+        struct iovec iov = {(void *)m_format_buf.data(), m_format_buf.size()};
+        write_all(&iov, 1);
+    }
+
+    // 如果大于等于1，表示需要设置为异步方式进行日志记录
+    if (max_queue_size >= 1)
+    {
+        m_log_queue = new log_ring<log_stage *>(max_queue_size); // 容量向上取整为2的幂
+        // 创建刷新线程，flush_log_thread为线程函数
+        if (pthread_create(&m_tid, NULL, flush_log_thread, NULL) != 0)
+        {
+            delete m_log_queue;
+            m_log_queue = nullptr;
+            return false;
+        }
+        m_is_async = true;
+    }
     return true;
 }
 
-void Log::write_log(int level, const char *format, ...)
+log_stage *Log::get_stage()
 {
-    // 获取当前时间
-    struct timeval now = {0, 0}; // 初始化
-    gettimeofday(&now, nullptr);
-
-    // 解析时间
-    time_t t = now.tv_sec;             // 获取秒钟
-    struct tm *sys_tm = localtime(&t); // 转化为年月日等信息
-    struct tm my_tm = *sys_tm;         // 解引用,获得具体的值
-
-    // 定义日志级别对应的标识符
-    char s[16] = {0}; // 初始化char数组为0
-    switch (level)
-    {
-    case 0:
-        strcpy(s, "[debug]:");
-        break;
-    case 1:
-        strcpy(s, "[info]:");
-        break;
-    case 2:
-        strcpy(s, "[warn]:");
-        break;
-    case 3:
-        strcpy(s, "[erro]:");
-        break;
-    default:
-        strcpy(s, "[info]:");
-        break;
-    }
-
-    // 对日志进行写入操作，需要加锁确保线程安全
-    m_mutex.lock();
-    m_count++; // 日志行数加1
+    if (!t_stage)
+    {
+        t_stage = new log_stage(m_stage_size);
+        m_mutex.lock();
+        m_stages.push_back(t_stage);
+        m_mutex.unlock();
+    }
+    return t_stage;
+}
+
+// 调用者持有stage->lock，front放不下一条日志时调用
+// 异步时把front交给刷新线程：back还没写完时先等它写完，再交换缓冲区；
+// 同步时以及刷新线程已经退出时直接把front写入文件
+void Log::make_room(log_stage *stage)
+{
+    if (m_is_async && !m_log_queue->closed())
+    {
+        while (stage->back_len != 0)
+        {
+            if (!stage->notified.exchange(true))
+                m_log_queue->push(stage);
+            stage->flushed.wait(stage->lock.get());
+            if (m_log_queue->closed())
+                break;
+        }
+        if (stage->back_len == 0)
+        {
+            swap(stage->front, stage->back);
+            stage->back_len = stage->front_len;
+            stage->front_len = 0;
+            if (!stage->notified.exchange(true))
+                m_log_queue->push(stage);
+            return;
+        }
+    }
+    struct iovec iov = {stage->front, stage->front_len};
+    write_all(&iov, 1);
+    stage->front_len = 0;
+}
+
+// 按天、按行数切换日志文件，调用者持有m_mutex
+// 异步时由刷新线程在每批写入前检查，同一批的日志写入同一个文件，切分的位置以批为单位
+void Log::check_split(const struct tm &my_tm)
+{
+    long long file_no = m_count / m_split_lines;
+    if (m_today == my_tm.tm_mday && file_no == m_file_no)
+        return;
 
-    // 判断是否需要进行日志文件分割，日期不一样进行分割，或者达到最大行数
-    if (m_today != my_tm.tm_mday || m_count % m_split_lines == 0)
+    char new_log[256] = {0};
+    // 创建日志文件名后缀，格式为年月日_，例如：2022_03_15_
+    char tail[16] = {0};
+    snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
+
+    if (m_today != my_tm.tm_mday)
+    {
+        snprintf(new_log, 255, "%s%s%s", dir_name, tail, log_name); // 路径+时间+文件名
+        m_today = my_tm.tm_mday;                                    // 更新时间
+        m_count = 0;                                                // 重置计数器
+        m_file_no = 0;
+    }
+    else
     {
-        char new_log[256] = {0};
-        fflush(m_fp); // 刷新流（清空文件缓冲区），将将流m_fp的输出缓冲区中的数据立刻写入到对应的文件中
-        fclose(m_fp); // 关闭文件
+        // 如果是当天，说明已写入的日志行数达到每个文件最大行数，以序号进行命名
+        // 路径+时间+文件名+.num
+        snprintf(new_log, 255, "%s%s%s.%lld", dir_name, tail, log_name, file_no);
+        m_file_no = file_no;
+    }
 
-        // 创建日志文件名后缀，格式为年月日_，例如：2022_03_15_
-        char tail[16] = {0};
-        snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
+    // 以追加方式打开日志文件，不存在则会自动创建；打开失败时继续写旧文件
+    int fd = open(new_log, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0)
+        return;
+    // 用dup2原子地替换m_fd指向的文件，正在写入的其他线程不会用到已关闭的描述符
+    dup2(fd, m_fd);
+    close(fd);
 
-        if (m_today != my_tm.tm_mday)
+    // 新文件要重新写入文件头和所有格式，解码时每个文件可以单独还原
+    if (m_binary)
+    {
+        m_header_pending = true;
+        m_formats_written = 0;
+        if (!m_is_async)
         {
-            snprintf(new_log, 255, "%s%s%s", dir_name, tail, log_name); // 路径+时间+文件名
-            m_today = my_tm.tm_mday;                                    // 更新时间
-            m_count = 0;                                                // 重置计数器
+            pending_formats();
+            struct iovec iov = {(void *)m_format_buf.data(), m_format_buf.size()};
+            write_all(&iov, 1);
         }
-        else
+    }
+}
+
+// 把当前文件还没有写入的文件头和格式记录放入m_format_buf，调用者持有m_mutex
+void Log::pending_formats()
+{
+    m_format_buf.clear();
+    if (m_header_pending)
+    {
+        uint32_t len = LOG_REC_HEAD_SIZE + sizeof(LOG_BINARY_MAGIC) + 1;
+        m_format_buf += (char)LOG_REC_HEADER;
+        m_format_buf.append((const char *)&len, 4);
+        m_format_buf.append(LOG_BINARY_MAGIC, sizeof(LOG_BINARY_MAGIC));
+        m_format_buf += (char)LOG_BINARY_VERSION;
+        m_header_pending = false;
+    }
+    for (; m_formats_written < m_formats.size(); m_formats_written++)
+    {
+        uint32_t id = (uint32_t)m_formats_written;
+        const char *format = m_formats[m_formats_written].second;
+        uint32_t len = LOG_REC_HEAD_SIZE + 4 + 1 + strlen(format);
+        m_format_buf += (char)LOG_REC_FORMAT;
+        m_format_buf.append((const char *)&len, 4);
+        m_format_buf.append((const char *)&id, 4);
+        m_format_buf += (char)m_formats[m_formats_written].first;
+        m_format_buf += format;
+    }
+}
+
+int Log::register_format(int level, const char *format)
+{
+    m_mutex.lock();
+    int id = (int)m_formats.size();
+    m_formats.push_back(make_pair(level, format));
+    // 同步时格式记录立即写入，保证在使用它的日志之前；异步时由刷新线程在同一批日志之前写入
+    if (!m_is_async)
+    {
+        pending_formats();
+        struct iovec iov = {(void *)m_format_buf.data(), m_format_buf.size()};
+        write_all(&iov, 1);
+    }
+    m_mutex.unlock();
+    return id;
+}
+
+// 一次writev写出多段，被信号中断或只写了一部分时继续写剩余部分
+void Log::write_all(struct iovec *iov, int cnt)
+{
+    while (cnt > 0)
+    {
+        ssize_t n = writev(m_fd, iov, cnt < IOV_MAX ? cnt : IOV_MAX);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return; // 磁盘满等错误，丢弃这一批
+        }
+        while (cnt > 0 && (size_t)n >= iov->iov_len)
         {
-            // 如果是当天，说明已写入的日志行数达到每个文件最大行数，以序号进行命名
-            // 路径+时间+文件名+.num
-            snprintf(new_log, 255, "%s%s%s.%lld", dir_name, tail, log_name, m_count / m_split_lines);
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
         }
+        if (cnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+// 交换所有暂存区的缓冲区，一次writev把它们写入文件
+void Log::flush_stages()
+{
+    vector<log_stage *> ready;
+    vector<struct iovec> iov;
 
-        m_fp = fopen(new_log, "a"); // 以追加方式打开日志文件，不存在则会自动创建
+    m_mutex.lock();
+    for (log_stage *stage : m_stages)
+    {
+        stage->lock.lock();
+        if (stage->back_len == 0 && stage->front_len > 0)
+        {
+            swap(stage->front, stage->back);
+            stage->back_len = stage->front_len;
+            stage->front_len = 0;
+        }
+        m_count += stage->lines;
+        stage->lines = 0;
+        stage->notified = false;
+        if (stage->back_len > 0)
+            ready.push_back(stage);
+        stage->lock.unlock();
     }
+    check_split(get_clock(time(NULL)).tm);
+    // 暂存区中的日志用到的格式都已登记，和交换缓冲区在同一个临界区内取出，写在这一批的最前面
+    if (m_binary)
+        pending_formats();
+    m_mutex.unlock();
 
-    m_mutex.unlock(); // 解锁
+    // back_len不为0时所属线程不会改动back，写文件时不需要加锁
+    if (m_binary && !m_format_buf.empty())
+        iov.push_back({(void *)m_format_buf.data(), m_format_buf.size()});
+    for (log_stage *stage : ready)
+        iov.push_back({stage->back, stage->back_len});
+    if (iov.empty())
+        return;
+    write_all(iov.data(), (int)iov.size());
 
-    // 格式化日志内容
-    va_list valist;           // 存储可变参数列表
-    va_start(valist, format); // 初始化可变参数列表，定位到最后一个显式参数的后面，即可变参数列表的起始位置
+    for (log_stage *stage : ready)
+    {
+        stage->lock.lock();
+        stage->back_len = 0;
+        stage->flushed.signal();
+        stage->lock.unlock();
+    }
+}
 
-    string log_str;
-    m_mutex.lock(); // 上锁
+void *Log::async_write_log()
+{
+    log_stage *stage;
+    while (true)
+    {
+        // 等待暂存区超过阈值的通知，最多等待m_flush_ms毫秒；
+        // 醒来后丢弃队列中其余的通知，一次扫描所有暂存区
+        m_log_queue->pop(stage, m_flush_ms);
+        while (m_log_queue->try_pop(stage))
+            ;
+        // 先检查是否关闭再刷新，关闭前写入暂存区的日志都会写出
+        bool closed = m_log_queue->closed();
+        flush_stages();
+        if (closed)
+            break;
+    }
+    return nullptr;
+}
 
-    // 写入的具体时间内容格式,n为实际写入的字符数
-    // 即使超过47个字符，n也为47，发生错误n为负数
-    // s为信息的声明，如debug、info、warn、error
-    int n = snprintf(m_buf, 48, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s",
-                     my_tm.tm_year + 1990, my_tm.tm_mon + 1, my_tm.tm_mday,
-                     my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec, s);
+// 取当前时间，锁住本线程的暂存区并保证front至少还有reserve字节
+// 同步时写入前判断是否需要进行日志文件分割，并一直持有m_mutex到end_line写完这一行
+log_stage *Log::begin_line(struct timespec &now, size_t reserve)
+{
+    // 获取当前时间，clock_gettime走vDSO，不进入内核
+    clock_gettime(m_clock, &now);
 
-    // 将后面的可变参数变量以format的格式写入m_buf + n开始的地址中，
-    // m_log_buf_size - n -1为最大的写入的字符数，而m是输入字符串的长度，而不是实际写入的长度
-    int m = vsnprintf(m_buf + n, m_log_buf_size - n - 1, format, valist);
-    m_buf[n + m] = '\n';     // 加入换行符
-    m_buf[n + m + 1] = '\0'; // 加入字符串的结束符
-    log_str = m_buf;         // 将格式化后的带有换行符的完整日志内容从m_buf复制到log_str字符串中
+    // 格式化到本线程的暂存区，不同线程之间没有共享的缓冲区和锁
+    // 第一次使用时get_stage要加m_mutex，先于下面加锁
+    log_stage *stage = get_stage();
 
-    m_mutex.unlock(); // 解锁
+    // 异步时行数记在暂存区中，由刷新线程累加并判断是否切换文件
+    if (!m_is_async)
+    {
+        // 同步时每条日志都直接写入文件；切换文件后新文件的文件头和格式记录在check_split中写入，
+        // 持有m_mutex直到这一行写完，其他线程的行不会在切换前计数、切换后才写入而排到文件头前面
+        const log_clock &clock = get_clock(now.tv_sec);
+        m_mutex.lock();
+        m_count++;
+        check_split(clock.tm);
+    }
 
-    // 将日志写入队列或直接写入日志文件
-    // 是异步&&队列没满
-    if (m_is_async && !m_log_queue->full())
+    stage->lock.lock();
+    if (stage->cap - stage->front_len < reserve)
+        make_room(stage);
+    return stage;
+}
+
+// front中追加了len字节，同步时直接写入文件，异步时超过一半通知刷新线程
+void Log::end_line(log_stage *stage, size_t len)
+{
+    stage->front_len += len;
+    stage->lines++;
+    if (!m_is_async)
     {
-        m_log_queue->push(log_str); // 写入堵塞队列
+        make_room(stage);
+        stage->lock.unlock();
+        m_mutex.unlock(); // begin_line中加的锁
+        return;
     }
-    else
+    if (stage->front_len >= stage->cap / 2 && !stage->notified.exchange(true))
     {
-        m_mutex.lock();
-        //将log_str这个C++的字符串以C风格字符串的格式写入到文件指针m_fp所指向的文件中
-        //log_str.c_str()返回一个指向以null结尾的字符数组的指针
-        //以便将C++的字符串转换为C风格字符串
-        fputs(log_str.c_str(),m_fp);
-        m_mutex.unlock();
+        // 队列满时不通知，等定时刷新
+        m_log_queue->push(stage);
     }
+    stage->lock.unlock();
+}
 
+void Log::write_log(int level, const char *format, ...)
+{
+    if (level < 0 || level > 3)
+        level = 1;
+
+    struct timespec now;
+    log_stage *stage = begin_line(now, m_log_buf_size);
+    const log_clock &clock = get_clock(now.tv_sec);
+    char *buf = stage->front + stage->front_len;
+
+    // 写入的具体时间内容格式："YYYY-MM-DD HH:MM:SS.uuuuuu [info]:"，n为写入的字符数
+    // 年月日时分秒从缓存拷贝，微秒逐位转换为字符
+    int n = clock.prefix_len;
+    memcpy(buf, clock.prefix, n);
+    buf[n++] = '.';
+    long usec = now.tv_nsec / 1000;
+    for (int i = n + 5; i >= n; i--)
+    {
+        buf[i] = '0' + usec % 10;
+        usec /= 10;
+    }
+    n += 6;
+    buf[n++] = ' ';
+    memcpy(buf + n, level_name[level], level_len[level]);
+    n += level_len[level];
+
+    // 格式化日志内容
+    va_list valist;           // 存储可变参数列表
+    va_start(valist, format); // 初始化可变参数列表，定位到最后一个显式参数的后面，即可变参数列表的起始位置
+    // 将后面的可变参数变量以format的格式写入buf + n开始的地址中，
+    // m_log_buf_size - n -1为最大的写入的字符数，而m是输入字符串的长度，而不是实际写入的长度，超长时截断
+    int m = vsnprintf(buf + n, m_log_buf_size - n - 1, format, valist);
     va_end(valist); //清理 va_list 变量
+    if (m < 0)
+        m = 0;
+    else if (m > m_log_buf_size - n - 2)
+        m = m_log_buf_size - n - 2;
+    buf[n + m] = '\n'; // 加入换行符
+    end_line(stage, n + m + 1);
+}
+
+void Log::set_level(int module, int level)
+{
+    if (module < 0 || module >= LOG_MOD_NUM)
+        return;
+    m_level[module].store(level, memory_order_relaxed);
 }
 
 void Log::flush(void)
 {
-    m_mutex.lock();
-    //强制刷新写入流缓冲区
-    fflush(m_fp);
-    m_mutex.unlock();
+    // 空指针只用于唤醒刷新线程
+    if (m_is_async)
+        m_log_queue->push(nullptr);
 }
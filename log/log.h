@@ -1,12 +1,78 @@
 #ifndef LOG_H
 #define LOG_H
 
+#include <stddef.h>
+#include <time.h>
 #include <string>
-#include "block_queue.h"
+#include <vector>
+#include <atomic>
+#include "log_ring.h"
+#include "log_binary.h"
 #include "../lock/locker.h"
 
 using namespace std;
 
+// 日志级别，与LOG_DEBUG、LOG_INFO、LOG_WARN、LOG_ERROR对应
+enum LOG_LEVEL
+{
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR
+};
+
+// 日志所属的模块，每个模块可以单独设置运行时的最低级别
+// 源文件在包含任何头文件之前定义LOG_MODULE选择模块，没有定义的属于LOG_MOD_NET
+enum LOG_MOD
+{
+    LOG_MOD_NET = 0, // reactor、线程池等
+    LOG_MOD_HTTP,
+    LOG_MOD_SQL,
+    LOG_MOD_NUM
+};
+
+#ifndef LOG_MODULE
+#define LOG_MODULE LOG_MOD_NET
+#endif
+
+// 编译期的最低级别，低于它的日志在编译时去掉，例如-DLOG_MIN_LEVEL=1去掉所有LOG_DEBUG
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
+// 每个线程一个日志暂存区，双缓冲
+// front由所属线程追加日志，back装着等待刷新线程写入文件的日志
+// 刷新线程在back为空时交换两个缓冲区，写完back后清空；
+// 所属线程只在front写满而back还没写完时才等待刷新线程，同一线程的日志保持先后顺序
+struct log_stage
+{
+    log_stage(size_t size)
+    {
+        cap = size;
+        front = new char[cap];
+        back = new char[cap];
+        front_len = 0;
+        back_len = 0;
+        lines = 0;
+        notified = false;
+    }
+    ~log_stage()
+    {
+        delete[] front;
+        delete[] back;
+    }
+
+    locker lock;            // 追加日志与交换缓冲区时加锁，平时只有所属线程使用，没有竞争
+    cond flushed;           // back写完时通知所属线程
+    char *front;
+    char *back;
+    size_t cap;
+    size_t front_len;
+    size_t back_len;        // 不为0时back正在等待或正在写入文件
+    long long lines;        // 异步时上次刷新以来写入的行数，由刷新线程累加到m_count
+    atomic<bool> notified;  // 本轮已经通知过刷新线程
+};
+
 class Log
 {
 public:
@@ -15,21 +81,66 @@ public:
     {
         static Log instance;
         return &instance;
-    } 
+    }
     //void *为无类型指针,线程函数要求的返回类型,隐式的返回nullptr
-    //void *args 这个参数是为了符合线程库pthread_create的要求，这个参数的存在确保了所有线程的创建和执行接口的一致性 
+    //void *args 这个参数是为了符合线程库pthread_create的要求，这个参数的存在确保了所有线程的创建和执行接口的一致性
     //线程库通常要求传递一个函数指针作为线程的入口函数
     //这个函数的作用就是为了符合线程库所要求的函数签名，本身没有意义，间接调用async_write_log()函数
     static void *flush_log_thread(void *args)
     {
         Log::get_instance()->async_write_log(); //以异步的方式写入log
+        return nullptr;
     }
-    bool init ( int max_queue_size = 0, int close_log, 
-                int log_buf_size = 8192, int split_lines = 5000000,
-                const char *file_name );
-    
+    // max_queue_size大于0时为异步日志：日志先写入本线程的暂存区，由刷新线程批量写入文件
+    // 暂存区超过一半或者距上次刷新flush_ms毫秒时刷新，max_queue_size为通知队列的长度
+    // coarse_clock为true时用CLOCK_REALTIME_COARSE取时间，更快，但微秒部分只精确到时钟中断
+    // binary为true时写二进制日志（格式见log_binary.h），用log_decoder还原为文本
+    bool init(int max_queue_size, int close_log, int log_buf_size, int split_lines,
+              const char *file_name, int flush_ms = 100, bool coarse_clock = false,
+              bool binary = false);
+
     void write_log(int level, const char *format, ...);
 
+    // 运行时的最低级别，默认为LOG_LEVEL_INFO，随时可以修改
+    void set_level(int module, int level);
+    int get_level(int module) const { return m_level[module].load(memory_order_relaxed); }
+    // LOG_*宏在计算参数之前调用
+    bool enabled(int module, int level) const
+    {
+        return level >= m_level[module].load(memory_order_relaxed);
+    }
+
+    bool binary() const { return m_binary; }
+    // 二进制日志：登记格式字符串，返回格式编号；每个调用点只在第一次执行时登记
+    int register_format(int level, const char *format);
+
+    // 二进制日志：只写入格式编号、时间和原始参数，不调用vsnprintf
+    // 字符串参数的内容合计最多m_log_buf_size字节，超出的部分截断
+    template <class... Args>
+    void write_binary(int id, const Args &... args)
+    {
+        static_assert(sizeof...(Args) <= 255, "too many log arguments");
+        struct timespec now;
+        log_stage *stage = begin_line(now, LOG_ENTRY_HEAD_SIZE + LOG_ARG_MAX_SIZE * sizeof...(Args) + m_log_buf_size);
+        char *start = stage->front + stage->front_len;
+        char *p = start + LOG_REC_HEAD_SIZE;
+        uint32_t format_id = (uint32_t)id;
+        uint64_t ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+        uint8_t argc = (uint8_t)sizeof...(Args);
+        log_put(p, &format_id, 4);
+        log_put(p, &ns, 8);
+        log_put(p, &argc, 1);
+        size_t budget = m_log_buf_size;
+        int expand[] = {0, (log_put_arg(p, budget, args), 0)...};
+        (void)expand;
+        (void)budget;
+        uint32_t len = (uint32_t)(p - start);
+        start[0] = (char)LOG_REC_ENTRY;
+        memcpy(start + 1, &len, 4);
+        end_line(stage, len);
+    }
+
+    // 异步时通知刷新线程立即写出暂存区，不等待写完；同步时日志已经直接写入文件
     void flush(void); //显式的表明不接受任何参数，c中有区别，cpp中等价于()
 private:
     Log();//构造函数
@@ -39,39 +150,59 @@ private:
 
     //void *是为了与POSIX线程（pthread）标准兼容
     //任何作为线程入口的函数都必须返回一个 void* 类型指针
-    void *async_write_log()
-    {
-        string single_log; //用来存储从日志队列中取出的单个日志数据
-        while (m_log_queue->pop(single_log)) //一直循环，直到阻塞队列为空
-        {
-            m_mutex.lock();
-            //s.c_str()函数的作用是将c++中的字符串转化为c风格的字符串
-            //返回一个指向存储字符串内容的字符数组的指针，并且保证以 null 结尾
-            //fputs 是一个标准 C 语言中的函数，用于将一个以 null 结尾的字符串写入到指定的文件流中
-            fputs(single_log.c_str(),m_fp);
-            m_mutex.unlock();
-        }
-        
-    }
+    void *async_write_log();
+
+    log_stage *get_stage();
+    log_stage *begin_line(struct timespec &now, size_t reserve);
+    void end_line(log_stage *stage, size_t len);
+    void make_room(log_stage *stage);
+    void pending_formats();
+    void flush_stages();
+    void check_split(const struct tm &my_tm);
+    void write_all(struct iovec *iov, int cnt);
 
 private:
-    block_queue<string> *m_log_queue; //声明一个string类型的阻塞队列
-    locker m_mutex;
-    FILE *m_fp;
+    log_ring<log_stage *> *m_log_queue; //暂存区超过阈值时通知刷新线程，无锁队列
+    pthread_t m_tid; //刷新线程
+    locker m_mutex; //保护m_stages和日志文件的切换；同步时从切分检查到这一行写完都持有它
+    vector<log_stage *> m_stages; //所有线程的暂存区，线程退出后保留，由刷新线程写完
+    int m_fd; //日志文件，切换文件时用dup2替换，其他线程持有的描述符始终有效
     bool m_is_async; //判断是否是异步写入
     int m_close_log; //关闭日志
-    int m_log_buf_size; //日志缓冲区大小
-    char *m_buf; //缓存区地址指针，用于动态分配
+    int m_log_buf_size; //单条日志的最大长度
+    size_t m_stage_size; //每个暂存缓冲区的大小
+    int m_flush_ms; //刷新间隔
+    clockid_t m_clock; //日志时间使用的时钟
     int m_split_lines; //日志最大行数
     char log_name[128]; //用一个128char数组来保存log文件名
     char dir_name[128]; //路径名
     int m_today; //因为按天分类,记录当前时间是哪一天
-    long long m_count; //日志行数记录
+    long long m_count; //日志行数记录，同步时由m_mutex保护，异步时只由刷新线程修改
+    long long m_file_no; //当天的第几个文件
+    bool m_binary; //二进制日志
+    vector<pair<int, const char *>> m_formats; //登记的格式：级别、格式字符串，下标为编号
+    size_t m_formats_written; //当前文件中已经写入了前几个格式
+    bool m_header_pending; //当前文件还没有写入文件头
+    string m_format_buf; //待写入的文件头和格式记录
+    atomic<int> m_level[LOG_MOD_NUM]; //各模块运行时的最低级别
 };
 
-#define LOG_DEBUG(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(0, format, ##__VA_ARGS__); Log::get_instance()->flush();}
-#define LOG_INFO(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(1, format, ##__VA_ARGS__); Log::get_instance()->flush();}
-#define LOG_WARN(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(2, format, ##__VA_ARGS__); Log::get_instance()->flush();}
-#define LOG_ERROR(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(3, format, ##__VA_ARGS__); Log::get_instance()->flush();}
+// 不再逐行flush，异步日志由刷新线程按批写入
+// 级别低于LOG_MIN_LEVEL时条件在编译期为假，整段代码被去掉；
+// 运行时先判断日志开关和所在模块的级别，通过后才计算参数
+// 二进制日志在每个调用点用局部静态变量保存格式编号，之后只写入编号和参数
+#define LOG_BASE(level, format, ...) \
+    if((level) >= LOG_MIN_LEVEL && 0 == m_close_log && Log::get_instance()->enabled(LOG_MODULE, level)) { \
+        if (Log::get_instance()->binary()) { \
+            static const int log_format_id = Log::get_instance()->register_format(level, format); \
+            Log::get_instance()->write_binary(log_format_id, ##__VA_ARGS__); \
+        } else \
+            Log::get_instance()->write_log(level, format, ##__VA_ARGS__); \
+    }
+
+#define LOG_DEBUG(format, ...) LOG_BASE(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...) LOG_BASE(LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...) LOG_BASE(LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...) LOG_BASE(LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
 
 #endif
@@ -0,0 +1,116 @@
+/*************************************************************
+*二进制日志格式，由log_decoder还原为文本
+*文件由记录组成，每条记录以u8类型、u32记录总长度开头：
+*  LOG_REC_HEADER  魔数和版本；进程每次打开日志文件时写入，之前定义的格式编号作废
+*  LOG_REC_FORMAT  u32编号 u8级别 格式字符串（到记录末尾）
+*  LOG_REC_ENTRY   u32编号 u64时间（纳秒） u8参数个数 参数...
+*参数为u8类型加数据：整数、浮点数、指针8字节，字符串为u32长度加内容
+*数值按本机字节序写入，解码要在字节序相同的机器上进行
+**************************************************************/
+#ifndef LOG_BINARY_H
+#define LOG_BINARY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <type_traits>
+
+using namespace std;
+
+enum LOG_RECORD
+{
+    LOG_REC_HEADER = 1,
+    LOG_REC_FORMAT,
+    LOG_REC_ENTRY
+};
+
+enum LOG_ARG
+{
+    LOG_ARG_INT = 1,
+    LOG_ARG_UINT,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_STR,
+    LOG_ARG_PTR
+};
+
+static const char LOG_BINARY_MAGIC[4] = {'W', 'S', 'L', 'G'};
+static const uint8_t LOG_BINARY_VERSION = 1;
+
+// 记录头：u8类型 + u32长度
+static const size_t LOG_REC_HEAD_SIZE = 5;
+// 日志记录中参数之前的部分：记录头 + u32编号 + u64时间 + u8参数个数
+static const size_t LOG_ENTRY_HEAD_SIZE = LOG_REC_HEAD_SIZE + 4 + 8 + 1;
+// 除字符串内容外，每个参数最多占用的字节数
+static const size_t LOG_ARG_MAX_SIZE = 9;
+
+inline void log_put(char *&p, const void *data, size_t len)
+{
+    memcpy(p, data, len);
+    p += len;
+}
+
+inline void log_put_tag(char *&p, uint8_t tag)
+{
+    *p++ = (char)tag;
+}
+
+// 以下按参数类型写入，budget为字符串内容还能使用的字节数，超出的部分截断
+template <class T>
+inline typename enable_if<is_integral<T>::value || is_enum<T>::value>::type
+log_put_arg(char *&p, size_t &, T v)
+{
+    if (is_signed<T>::value)
+    {
+        int64_t x = (int64_t)v;
+        log_put_tag(p, LOG_ARG_INT);
+        log_put(p, &x, 8);
+    }
+    else
+    {
+        uint64_t x = (uint64_t)v;
+        log_put_tag(p, LOG_ARG_UINT);
+        log_put(p, &x, 8);
+    }
+}
+
+template <class T>
+inline typename enable_if<is_floating_point<T>::value>::type
+log_put_arg(char *&p, size_t &, T v)
+{
+    double x = (double)v;
+    log_put_tag(p, LOG_ARG_DOUBLE);
+    log_put(p, &x, 8);
+}
+
+inline void log_put_str(char *&p, size_t &budget, const char *s, size_t len)
+{
+    if (len > budget)
+        len = budget;
+    budget -= len;
+    uint32_t n = (uint32_t)len;
+    log_put_tag(p, LOG_ARG_STR);
+    log_put(p, &n, 4);
+    log_put(p, s, len);
+}
+
+inline void log_put_arg(char *&p, size_t &budget, const char *s)
+{
+    if (!s)
+        s = "(null)";
+    log_put_str(p, budget, s, strlen(s));
+}
+
+inline void log_put_arg(char *&p, size_t &budget, const string &s)
+{
+    log_put_str(p, budget, s.data(), s.size());
+}
+
+inline void log_put_arg(char *&p, size_t &, const void *ptr)
+{
+    uint64_t x = (uint64_t)(uintptr_t)ptr;
+    log_put_tag(p, LOG_ARG_PTR);
+    log_put(p, &x, 8);
+}
+
+#endif
@@ -0,0 +1,314 @@
+/*************************************************************
+*把二进制日志还原为文本，每行的格式与文本日志相同
+*用法：log_decoder 日志文件...，结果写到标准输出
+*单独编译：g++ -O2 log/log_decoder.cpp -o log_decoder
+**************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "log_binary.h"
+
+using namespace std;
+
+struct log_value
+{
+    uint8_t type;
+    int64_t i;
+    uint64_t u;
+    double d;
+    string s;
+};
+
+struct log_format
+{
+    bool defined;
+    int level;
+    string format;
+};
+
+static const char *const level_name[] = {"[debug]:", "[info]:", "[warn]:", "[erro]:"};
+
+static void append(string &out, const char *spec, ...)
+{
+    char buf[256];
+    va_list valist;
+    va_start(valist, spec);
+    int n = vsnprintf(buf, sizeof(buf), spec, valist);
+    va_end(valist);
+    if (n < 0)
+        return;
+    if ((size_t)n < sizeof(buf))
+    {
+        out.append(buf, n);
+        return;
+    }
+    vector<char> big(n + 1);
+    va_start(valist, spec);
+    vsnprintf(big.data(), big.size(), spec, valist);
+    va_end(valist);
+    out.append(big.data(), n);
+}
+
+// 没有对应的转换说明或者类型不匹配时，按参数自己的类型输出
+static void append_value(string &out, const log_value &v)
+{
+    switch (v.type)
+    {
+    case LOG_ARG_INT:
+        append(out, "%lld", (long long)v.i);
+        break;
+    case LOG_ARG_UINT:
+        append(out, "%llu", (unsigned long long)v.u);
+        break;
+    case LOG_ARG_DOUBLE:
+        append(out, "%g", v.d);
+        break;
+    case LOG_ARG_STR:
+        out += v.s;
+        break;
+    case LOG_ARG_PTR:
+        append(out, "%p", (void *)(uintptr_t)v.u);
+        break;
+    }
+}
+
+static long long as_integer(const log_value &v)
+{
+    if (v.type == LOG_ARG_INT)
+        return v.i;
+    if (v.type == LOG_ARG_DOUBLE)
+        return (long long)v.d;
+    return (long long)v.u;
+}
+
+// 按格式字符串逐个处理转换说明，用记录中的参数代替可变参数
+static void render(string &out, const char *format, const vector<log_value> &args)
+{
+    size_t next = 0;
+    const char *p = format;
+    while (*p)
+    {
+        if (*p != '%')
+        {
+            out += *p++;
+            continue;
+        }
+        if (p[1] == '%')
+        {
+            out += '%';
+            p += 2;
+            continue;
+        }
+
+        // %[标志][宽度][.精度][长度]转换，宽度和精度为*时从参数中取
+        string spec = "%";
+        p++;
+        while (*p && strchr("-+ #0'", *p))
+            spec += *p++;
+        for (int part = 0; part < 2; part++)
+        {
+            if (part == 1)
+            {
+                if (*p != '.')
+                    break;
+                spec += *p++;
+            }
+            if (*p == '*')
+            {
+                p++;
+                long long n = next < args.size() ? as_integer(args[next++]) : 0;
+                spec += to_string(n);
+            }
+            while (*p >= '0' && *p <= '9')
+                spec += *p++;
+        }
+        while (*p && strchr("hljztLq", *p))
+            p++;
+        char conv = *p;
+        if (!conv)
+            break;
+        p++;
+
+        if (next >= args.size())
+        {
+            out += "<missing>";
+            continue;
+        }
+        const log_value &v = args[next++];
+        if (strchr("di", conv) && v.type != LOG_ARG_STR)
+            append(out, (spec + "ll" + conv).c_str(), as_integer(v));
+        else if (strchr("ouxX", conv) && v.type != LOG_ARG_STR)
+            append(out, (spec + "ll" + conv).c_str(), (unsigned long long)as_integer(v));
+        else if (conv == 'c' && v.type != LOG_ARG_STR)
+            append(out, (spec + 'c').c_str(), (int)as_integer(v));
+        else if (strchr("feEgGaA", conv) && v.type == LOG_ARG_DOUBLE)
+            append(out, (spec + conv).c_str(), v.d);
+        else if (conv == 's' && v.type == LOG_ARG_STR)
+            append(out, (spec + 's').c_str(), v.s.c_str());
+        else if (conv == 'p' && v.type == LOG_ARG_PTR)
+            append(out, (spec + 'p').c_str(), (void *)(uintptr_t)v.u);
+        else if (conv != 'n')
+            append_value(out, v);
+    }
+    // 多出来的参数附在行尾，不丢弃
+    for (; next < args.size(); next++)
+    {
+        out += ' ';
+        append_value(out, args[next]);
+    }
+}
+
+static bool read_args(const char *p, const char *end, int argc, vector<log_value> &args)
+{
+    args.resize(argc);
+    for (int i = 0; i < argc; i++)
+    {
+        log_value &v = args[i];
+        if (p >= end)
+            return false;
+        v.type = (uint8_t)*p++;
+        if (v.type == LOG_ARG_STR)
+        {
+            uint32_t len;
+            if (end - p < 4)
+                return false;
+            memcpy(&len, p, 4);
+            p += 4;
+            if ((size_t)(end - p) < len)
+                return false;
+            v.s.assign(p, len);
+            p += len;
+        }
+        else
+        {
+            if (end - p < 8)
+                return false;
+            memcpy(&v.i, p, 8);
+            memcpy(&v.u, p, 8);
+            memcpy(&v.d, p, 8);
+            p += 8;
+        }
+    }
+    return true;
+}
+
+static bool decode(const char *name, FILE *out)
+{
+    FILE *fp = fopen(name, "rb");
+    if (!fp)
+    {
+        fprintf(stderr, "log_decoder: cannot open %s\n", name);
+        return false;
+    }
+    vector<char> data;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        data.insert(data.end(), buf, buf + n);
+    fclose(fp);
+
+    vector<log_format> formats;
+    vector<log_value> args;
+    string line;
+    time_t cached_sec = -1;
+    char prefix[64] = {0};
+    size_t pos = 0;
+    while (pos + LOG_REC_HEAD_SIZE <= data.size())
+    {
+        const char *rec = data.data() + pos;
+        uint8_t type = (uint8_t)rec[0];
+        uint32_t len;
+        memcpy(&len, rec + 1, 4);
+        if (len < LOG_REC_HEAD_SIZE || len > data.size() - pos)
+        {
+            fprintf(stderr, "log_decoder: %s: bad record at offset %zu\n", name, pos);
+            return false;
+        }
+        const char *p = rec + LOG_REC_HEAD_SIZE;
+        const char *end = rec + len;
+        pos += len;
+
+        if (type == LOG_REC_HEADER)
+        {
+            if (end - p < (long)sizeof(LOG_BINARY_MAGIC) + 1 || memcmp(p, LOG_BINARY_MAGIC, sizeof(LOG_BINARY_MAGIC)) != 0)
+            {
+                fprintf(stderr, "log_decoder: %s: not a binary log\n", name);
+                return false;
+            }
+            // 新的进程打开了这个文件，格式编号重新开始
+            formats.clear();
+        }
+        else if (type == LOG_REC_FORMAT && end - p >= 5)
+        {
+            uint32_t id;
+            memcpy(&id, p, 4);
+            if (id >= formats.size())
+                formats.resize(id + 1);
+            formats[id].defined = true;
+            formats[id].level = (uint8_t)p[4];
+            formats[id].format.assign(p + 5, end);
+        }
+        else if (type == LOG_REC_ENTRY && end - p >= 13)
+        {
+            uint32_t id;
+            uint64_t ns;
+            memcpy(&id, p, 4);
+            memcpy(&ns, p + 4, 8);
+            int argc = (uint8_t)p[12];
+            if (!read_args(p + 13, end, argc, args))
+            {
+                fprintf(stderr, "log_decoder: %s: bad arguments at offset %zu\n", name, pos - len);
+                continue;
+            }
+
+            time_t sec = (time_t)(ns / 1000000000ULL);
+            if (sec != cached_sec)
+            {
+                struct tm my_tm;
+                localtime_r(&sec, &my_tm);
+                snprintf(prefix, sizeof(prefix), "%04d-%02d-%02d %02d:%02d:%02d",
+                         my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+                         my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec);
+                cached_sec = sec;
+            }
+            line.clear();
+            if (id < formats.size() && formats[id].defined)
+            {
+                int level = formats[id].level <= 3 ? formats[id].level : 1;
+                append(line, "%s.%06ld %s", prefix, (long)(ns % 1000000000ULL / 1000), level_name[level]);
+                render(line, formats[id].format.c_str(), args);
+            }
+            else
+            {
+                append(line, "%s.%06ld <unknown format %u>", prefix, (long)(ns % 1000000000ULL / 1000), id);
+                render(line, "", args);
+            }
+            line += '\n';
+            fwrite(line.data(), 1, line.size(), out);
+        }
+        // 其他类型的记录跳过
+    }
+    if (pos != data.size())
+        fprintf(stderr, "log_decoder: %s: truncated record at offset %zu\n", name, pos);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s logfile...\n", argv[0]);
+        return 1;
+    }
+    int ret = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!decode(argv[i], stdout))
+            ret = 1;
+    }
+    return ret;
+}
@@ -0,0 +1,202 @@
+/*************************************************************
+*有界的无锁多生产者单消费者（MPSC）环形队列，代替block_queue用于异步日志
+*每个格子带一个序号：生产者用CAS抢占队尾位置后写入数据，再发布序号；
+*消费者只有一个，按顺序检查格子的序号取出数据，不需要CAS
+*队首、队尾各自独占缓存行，生产者之间只在队尾上竞争，与消费者互不干扰
+*消费者没有数据可取时才在futex上睡眠，生产者只在消费者睡眠时才调用futex唤醒
+**************************************************************/
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <atomic>
+#include <utility>
+
+using namespace std;
+
+template <class T>
+class log_ring
+{
+public:
+    // 容量向上取整为2的幂
+    log_ring(int max_size = 1024)
+    {
+        if (max_size <= 0)
+        {
+            exit(-1);
+        }
+        size_t size = 2;
+        while (size < (size_t)max_size)
+            size <<= 1;
+        m_mask = size - 1;
+        m_cells = new cell[size];
+        for (size_t i = 0; i < size; i++)
+            m_cells[i].seq.store(i, memory_order_relaxed);
+        m_head = 0;
+        m_tail = 0;
+        m_signal = 0;
+        m_sleeping = false;
+        m_closed = false;
+    }
+
+    ~log_ring()
+    {
+        delete[] m_cells;
+    }
+
+    // 可以在任意线程调用，队列满时返回false，不阻塞
+    bool push(T &&item)
+    {
+        cell *c;
+        uint64_t pos = m_tail.load(memory_order_relaxed);
+        while (true)
+        {
+            c = &m_cells[pos & m_mask];
+            uint64_t seq = c->seq.load(memory_order_acquire);
+            int64_t diff = (int64_t)(seq - pos);
+            // 格子空闲，抢占这个位置
+            if (diff == 0)
+            {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                    break;
+            }
+            // 格子中还是上一圈的数据，消费者没有取走，队列已满
+            else if (diff < 0)
+                return false;
+            // 其他生产者已经抢占了这个位置
+            else
+                pos = m_tail.load(memory_order_relaxed);
+        }
+        c->value = std::move(item);
+        c->seq.store(pos + 1, memory_order_release);
+
+        // 与pop中的屏障配对：要么消费者能看到刚发布的数据，要么这里能看到消费者在睡眠
+        // 消费者睡眠期间可能有很多生产者发布数据，只由清除睡眠标记的那一个调用futex唤醒
+        atomic_thread_fence(memory_order_seq_cst);
+        if (m_sleeping.load(memory_order_relaxed) && m_sleeping.exchange(false, memory_order_relaxed))
+            wake();
+        return true;
+    }
+
+    bool push(const T &item)
+    {
+        T copy(item);
+        return push(std::move(copy));
+    }
+
+    // 只能在消费者线程调用，取不到时返回false
+    bool try_pop(T &item)
+    {
+        uint64_t pos = m_head.load(memory_order_relaxed);
+        cell &c = m_cells[pos & m_mask];
+        if (c.seq.load(memory_order_acquire) != pos + 1)
+            return false;
+        item = std::move(c.value);
+        // 格子留给下一圈的生产者
+        c.seq.store(pos + m_mask + 1, memory_order_release);
+        m_head.store(pos + 1, memory_order_relaxed);
+        return true;
+    }
+
+    // 只能在消费者线程调用，队列为空时睡眠，直到有数据；close之后取完剩余数据返回false
+    bool pop(T &item)
+    {
+        while (true)
+        {
+            if (try_pop(item))
+                return true;
+            if (m_closed.load(memory_order_acquire))
+                return try_pop(item);
+
+            uint32_t signal = m_signal.load(memory_order_acquire);
+            m_sleeping.store(true, memory_order_relaxed);
+            atomic_thread_fence(memory_order_seq_cst);
+            // 声明睡眠之后再检查一次，之前发布的数据不会漏掉
+            if (try_pop(item))
+            {
+                m_sleeping.store(false, memory_order_relaxed);
+                return true;
+            }
+            if (!m_closed.load(memory_order_acquire))
+                syscall(SYS_futex, (uint32_t *)&m_signal, FUTEX_WAIT_PRIVATE, signal, NULL, NULL, 0);
+            m_sleeping.store(false, memory_order_relaxed);
+        }
+    }
+
+    // 同上，但最多睡眠timeout_ms毫秒；超时、被提前唤醒或close之后没有数据时返回false
+    bool pop(T &item, int timeout_ms)
+    {
+        if (try_pop(item))
+            return true;
+        if (m_closed.load(memory_order_acquire))
+            return try_pop(item);
+
+        uint32_t signal = m_signal.load(memory_order_acquire);
+        m_sleeping.store(true, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (try_pop(item))
+        {
+            m_sleeping.store(false, memory_order_relaxed);
+            return true;
+        }
+        if (!m_closed.load(memory_order_acquire))
+        {
+            struct timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+            syscall(SYS_futex, (uint32_t *)&m_signal, FUTEX_WAIT_PRIVATE, signal, &timeout, NULL, 0);
+        }
+        m_sleeping.store(false, memory_order_relaxed);
+        return try_pop(item);
+    }
+
+    // 唤醒消费者，之后pop取完剩余数据后返回false
+    void close()
+    {
+        m_closed.store(true, memory_order_release);
+        wake();
+    }
+
+    bool closed()
+    {
+        return m_closed.load(memory_order_acquire);
+    }
+
+    // 近似值，只用于统计
+    int size()
+    {
+        return (int)(m_tail.load(memory_order_relaxed) - m_head.load(memory_order_relaxed));
+    }
+
+    int max_size()
+    {
+        return (int)(m_mask + 1);
+    }
+
+private:
+    void wake()
+    {
+        m_signal.fetch_add(1, memory_order_release);
+        syscall(SYS_futex, (uint32_t *)&m_signal, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+
+    struct alignas(64) cell
+    {
+        atomic<uint64_t> seq; // 等于位置+1时有数据可取，等于位置时可以写入
+        T value;
+    };
+
+private:
+    cell *m_cells;
+    size_t m_mask;
+    alignas(64) atomic<uint64_t> m_tail;   // 生产者竞争
+    alignas(64) atomic<uint64_t> m_head;   // 只有消费者修改
+    alignas(64) atomic<uint32_t> m_signal; // 消费者在这个地址上futex等待
+    atomic<bool> m_sleeping;
+    atomic<bool> m_closed;
+};
+
+#endif
@@ -0,0 +1,434 @@
+#include <sys/socket.h>
+#include <sched.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "event_loop.h"
+#include "reactor.h"
+
+event_loop::event_loop(int id, const loop_config &config)
+{
+    m_id = id;
+    m_config = config;
+    m_reactor = nullptr;
+    m_epollfd = -1;
+    m_wakeup_fd = -1;
+    m_listenfd = -1;
+    m_listen_trig_mode = 0;
+    m_dispatch = true;
+    m_cpu = -1;
+    m_sql = nullptr;
+    m_started = false;
+    m_stop = false;
+    m_conn_count = 0;
+    m_accept_count = 0;
+    m_request_count = 0;
+    m_close_log = config.close_log;
+}
+
+event_loop::~event_loop()
+{
+    // 先关闭数据库连接，之后不会再有回调访问连接对象
+    delete m_sql;
+    // 关闭仍然存活的连接，再释放所有连接对象
+    for (auto &it : m_users)
+    {
+        it.second->close_conn();
+        delete it.second;
+    }
+    for (http_conn *conn : m_free_conns)
+        delete conn;
+
+    if (m_wakeup_fd != -1)
+        close(m_wakeup_fd);
+    if (m_epollfd != -1)
+        close(m_epollfd);
+}
+
+bool event_loop::init()
+{
+    // 每个循环一个独立的epoll实例
+    m_epollfd = epoll_create(5);
+    if (m_epollfd == -1)
+        return false;
+
+    // eventfd用于跨线程唤醒，只注册读事件，不使用oneshot
+    m_wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wakeup_fd == -1)
+        return false;
+    addfd(m_epollfd, m_wakeup_fd, false, 0);
+
+    // 线程池模式下process在工作线程中执行，不能使用只属于本循环的连接
+    if (m_config.async_sql_num > 0 && !m_config.pool)
+    {
+        m_sql = new async_sql(on_sql_done, this);
+        if (!m_sql->init(m_epollfd, m_config.sql_url, m_config.sql_user, m_config.sql_passwd,
+                         m_config.sql_name, m_config.sql_port, m_config.async_sql_num, m_close_log))
+        {
+            // 退回到通过连接池同步访问
+            LOG_ERROR("loop %d: async sql init failed, use connection pool", m_id);
+            delete m_sql;
+            m_sql = nullptr;
+        }
+    }
+    return true;
+}
+
+void event_loop::set_listen(int listenfd, int listen_trig_mode, bool dispatch)
+{
+    m_listenfd = listenfd;
+    m_listen_trig_mode = listen_trig_mode;
+    m_dispatch = dispatch;
+    // 监听socket不能开启oneshot，否则每次accept后都要重新注册
+    addfd(m_epollfd, m_listenfd, false, m_listen_trig_mode);
+}
+
+// 可以在任意线程调用，新连接先放入待处理队列，再由本循环线程完成注册
+void event_loop::queue_conn(int connfd, const sockaddr_in &addr)
+{
+    m_pending_lock.lock();
+    m_pending.push_back(make_pair(connfd, addr));
+    m_pending_lock.unlock();
+
+    uint64_t one = 1;
+    if (::write(m_wakeup_fd, &one, sizeof(one)) != sizeof(one))
+    {
+        LOG_ERROR("loop %d wakeup failed, errno is:%d", m_id, errno);
+    }
+}
+
+void event_loop::loop()
+{
+    // 绑定CPU，让该循环的连接数据始终留在同一个核心的缓存中
+    if (m_cpu >= 0)
+    {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(m_cpu, &cpuset);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0)
+            LOG_ERROR("loop %d bind cpu %d failed", m_id, m_cpu);
+    }
+
+    // 主reactor需要定时醒来输出统计信息
+    int timeout = (m_reactor && m_id == 0) ? 1000 : -1;
+    while (!m_stop.load())
+    {
+        int number = epoll_wait(m_epollfd, m_events, MAX_EVENT_NUMBER, timeout);
+        if (number < 0 && errno != EINTR)
+        {
+            LOG_ERROR("loop %d epoll failure, errno is:%d", m_id, errno);
+            break;
+        }
+
+        for (int i = 0; i < number; i++)
+        {
+            int sockfd = m_events[i].data.fd;
+
+            if (sockfd == m_listenfd)
+                handle_accept();
+            else if (sockfd == m_wakeup_fd)
+                handle_wakeup();
+            else if (m_sql && m_sql->handle_event(sockfd, m_events[i].events))
+                continue; // 数据库连接的事件，完成的查询通过on_sql_done继续对应的请求
+            else if (m_events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                // 对端关闭连接或者出错，直接关闭
+                auto it = m_users.find(sockfd);
+                if (it != m_users.end())
+                {
+                    http_conn *conn = it->second;
+                    conn->close_conn();
+                    release_conn(sockfd, conn);
+                }
+            }
+            else if (m_events[i].events & EPOLLIN)
+                deal_read(sockfd);
+            else if (m_events[i].events & EPOLLOUT)
+                deal_write(sockfd);
+        }
+
+        if (m_reactor && m_id == 0)
+            m_reactor->tick();
+    }
+}
+
+void *event_loop::worker(void *arg)
+{
+    event_loop *loop = (event_loop *)arg;
+    loop->loop();
+    return nullptr;
+}
+
+bool event_loop::start()
+{
+    if (pthread_create(&m_tid, NULL, worker, this) != 0)
+        return false;
+    m_started = true;
+    return true;
+}
+
+void event_loop::stop()
+{
+    m_stop = true;
+    uint64_t one = 1;
+    if (::write(m_wakeup_fd, &one, sizeof(one)) != sizeof(one))
+    {
+        LOG_ERROR("loop %d wakeup failed, errno is:%d", m_id, errno);
+    }
+}
+
+void event_loop::join()
+{
+    if (m_started)
+    {
+        pthread_join(m_tid, NULL);
+        m_started = false;
+    }
+}
+
+void event_loop::handle_accept()
+{
+    struct sockaddr_in client_address;
+    socklen_t client_addrlength = sizeof(client_address);
+
+    // LT模式每次只accept一个，ET模式需要一直accept到EAGAIN
+    do
+    {
+        int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
+        if (connfd < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                LOG_ERROR("accept error:errno is:%d", errno);
+            break;
+        }
+        if (http_conn::m_user_count >= MAX_FD)
+        {
+            const char *info = "Internal server busy";
+            send(connfd, info, strlen(info), 0);
+            close(connfd);
+            LOG_ERROR("%s", info);
+            break;
+        }
+        m_accept_count++;
+
+        // 由主reactor按策略挑选一个子循环，连接从此固定在该循环
+        event_loop *target = (m_reactor && m_dispatch) ? m_reactor->select_loop() : this;
+        if (target == this)
+            add_conn(connfd, client_address);
+        else
+            target->queue_conn(connfd, client_address);
+    } while (m_listen_trig_mode == 1);
+}
+
+void event_loop::handle_wakeup()
+{
+    uint64_t count = 0;
+    while (read(m_wakeup_fd, &count, sizeof(count)) > 0)
+    {
+    }
+
+    // 交换出待处理队列，尽量缩短持锁时间
+    vector<pair<int, sockaddr_in>> pending;
+    vector<http_conn *> done;
+    vector<register_done> registered;
+    m_pending_lock.lock();
+    pending.swap(m_pending);
+    done.swap(m_done);
+    registered.swap(m_registered);
+    m_pending_lock.unlock();
+
+    for (auto &p : pending)
+        add_conn(p.first, p.second);
+
+    // 线程池处理完的连接：最后一个任务完成后，若连接已被关闭则回收
+    for (http_conn *conn : done)
+    {
+        auto it = m_inflight.find(conn);
+        if (it == m_inflight.end())
+            continue;
+        int sockfd = it->second.first;
+        if (--it->second.second > 0)
+            continue;
+        m_inflight.erase(it);
+        if (conn->get_sockfd() == -1)
+            release_conn(sockfd, conn);
+    }
+
+    // 连接对象在循环销毁前不会释放，票据不一致说明等待期间连接已关闭或被复用
+    for (register_done &r : registered)
+    {
+        http_conn *conn = r.conn;
+        if (conn->sql_ticket() != r.ticket)
+            continue;
+        int sockfd = conn->get_sockfd();
+        // 暂停期间conn->mysql已经还给连接池，继续处理的请求及之后的流水线请求要重新取一个连接
+        if (m_config.conn_pool && !m_sql)
+        {
+            connectionRAII mysqlcon(&conn->mysql, m_config.conn_pool);
+            conn->sql_done(r.err);
+        }
+        else
+            conn->sql_done(r.err);
+        if (conn->get_sockfd() == -1)
+            release_conn(sockfd, conn);
+    }
+}
+
+// 线程池工作线程调用，通知所属循环任务已完成
+void event_loop::on_task_done(http_conn *conn, void *arg)
+{
+    event_loop *loop = (event_loop *)arg;
+    loop->m_pending_lock.lock();
+    loop->m_done.push_back(conn);
+    loop->m_pending_lock.unlock();
+
+    uint64_t one = 1;
+    if (::write(loop->m_wakeup_fd, &one, sizeof(one)) != sizeof(one))
+    {
+        int m_close_log = loop->m_close_log;
+        LOG_ERROR("loop %d wakeup failed, errno is:%d", loop->m_id, errno);
+    }
+}
+
+// 在本循环线程中调用，arg为提交查询的连接
+void event_loop::on_sql_done(void *owner, void *arg, unsigned int err)
+{
+    event_loop *loop = (event_loop *)owner;
+    http_conn *conn = (http_conn *)arg;
+    int sockfd = conn->get_sockfd();
+    conn->sql_done(err);
+    if (conn->get_sockfd() == -1)
+        loop->release_conn(sockfd, conn);
+}
+
+// 在注册写入队列的线程中调用，把结果交给连接所属的循环处理
+void event_loop::on_register_done(void *owner, void *arg, uint64_t ticket, unsigned int err)
+{
+    event_loop *loop = (event_loop *)owner;
+    loop->m_pending_lock.lock();
+    loop->m_registered.push_back(register_done{(http_conn *)arg, ticket, err});
+    loop->m_pending_lock.unlock();
+
+    uint64_t one = 1;
+    if (::write(loop->m_wakeup_fd, &one, sizeof(one)) != sizeof(one))
+    {
+        int m_close_log = loop->m_close_log;
+        LOG_ERROR("loop %d wakeup failed, errno is:%d", loop->m_id, errno);
+    }
+}
+
+void event_loop::add_conn(int connfd, const sockaddr_in &addr)
+{
+    http_conn *conn = nullptr;
+    if (!m_free_conns.empty())
+    {
+        conn = m_free_conns.back();
+        m_free_conns.pop_back();
+    }
+    else
+        conn = new http_conn();
+
+    m_users[connfd] = conn;
+    conn->init(m_epollfd, connfd, addr, m_config.doc_root, m_config.conn_trig_mode,
+               m_config.close_log, m_config.sql_user, m_config.sql_passwd, m_config.sql_name);
+    conn->set_async_sql(m_sql);
+    // 线程池模式下process在工作线程中执行，由工作线程等待注册提交
+    conn->set_register_callback(m_config.pool ? nullptr : on_register_done, this);
+    m_conn_count++;
+}
+
+// 连接已经关闭，回收连接对象以便复用
+// 线程池模式下fd关闭后可能已被新连接复用，所以只在映射仍指向该对象时才删除映射
+void event_loop::release_conn(int sockfd, http_conn *conn)
+{
+    // 仍有任务在线程池中，等最后一个任务完成后再回收
+    if (m_inflight.count(conn))
+        return;
+    auto it = m_users.find(sockfd);
+    if (it != m_users.end() && it->second == conn)
+        m_users.erase(it);
+    m_free_conns.push_back(conn);
+    m_conn_count--;
+}
+
+// 把读写事件交给线程池，EPOLLONESHOT保证同一连接同时只有一个线程在处理
+void event_loop::dispatch(int sockfd, http_conn *conn, int state)
+{
+    pair<int, int> &inflight = m_inflight[conn];
+    inflight.first = sockfd;
+    inflight.second++;
+    if (!m_config.pool->append(conn, state, this))
+    {
+        // 线程池已满，直接关闭连接
+        LOG_ERROR("loop %d: threadpool is full", m_id);
+        if (--inflight.second == 0)
+            m_inflight.erase(conn);
+        conn->close_conn();
+        release_conn(sockfd, conn);
+    }
+}
+
+void event_loop::deal_read(int sockfd)
+{
+    auto it = m_users.find(sockfd);
+    if (it == m_users.end())
+        return;
+    http_conn *conn = it->second;
+
+    if (m_config.pool)
+    {
+        m_request_count++;
+        dispatch(sockfd, conn, 0);
+        return;
+    }
+
+    if (conn->read_once())
+    {
+        m_request_count++;
+        process(conn);
+    }
+    else
+        conn->close_conn();
+
+    if (conn->get_sockfd() == -1)
+        release_conn(sockfd, conn);
+}
+
+void event_loop::deal_write(int sockfd)
+{
+    auto it = m_users.find(sockfd);
+    if (it == m_users.end())
+        return;
+    http_conn *conn = it->second;
+
+    if (m_config.pool)
+    {
+        dispatch(sockfd, conn, 1);
+        return;
+    }
+
+    if (!conn->write())
+        conn->close_conn();
+    else if (conn->pending_request())
+    {
+        // 读缓冲区中还有流水线请求，直接处理，不必等待新的读事件
+        m_request_count++;
+        process(conn);
+    }
+
+    if (conn->get_sockfd() == -1)
+        release_conn(sockfd, conn);
+}
+
+// 在循环线程中处理请求
+// 有非阻塞数据库连接时，注册和user_cache中没有的登录提交语句后就返回，不必为每个请求先从连接池取一个连接
+void event_loop::process(http_conn *conn)
+{
+    if (m_config.conn_pool && !m_sql)
+    {
+        connectionRAII mysqlcon(&conn->mysql, m_config.conn_pool);
+        conn->process();
+    }
+    else
+        conn->process();
+}
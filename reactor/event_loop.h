@@ -0,0 +1,121 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "../http/http_coon.h"
+#include "../lock/locker.h"
+#include "../threadpool/threadpool.h"
+
+using namespace std;
+
+class reactor;
+
+// 每个事件循环创建http_conn时需要的参数
+struct loop_config
+{
+    char *doc_root;             // 网站根目录
+    int conn_trig_mode;         // 连接fd的触发模式，0为LT，1为ET
+    int close_log;              // 日志开关
+    string sql_user;            // 数据库用户名
+    string sql_passwd;          // 数据库密码
+    string sql_name;            // 数据库名
+    string sql_url = "localhost"; // 数据库地址，async_sql_num大于0时使用
+    int sql_port = 3306;
+    int async_sql_num = 0;      // 每个循环的非阻塞数据库连接数，为0或设置了线程池时通过conn_pool同步访问
+    connection_pool *conn_pool; // 数据库连接池，可以为空
+    threadpool<http_conn> *pool; // 不为空时读写和process交给线程池处理，否则在循环线程中处理
+};
+
+// one loop per thread：一个线程只运行一个事件循环
+// 每个事件循环拥有自己的epoll实例，注册到该循环的http_conn只在这个线程中被处理
+class event_loop
+{
+public:
+    event_loop(int id, const loop_config &config);
+    ~event_loop();
+
+    bool init();                                           // 创建epoll实例和唤醒用的eventfd
+    void set_reactor(reactor *owner) { m_reactor = owner; }
+    // 让该循环负责accept，dispatch为false时accept到的连接直接留在本循环
+    void set_listen(int listenfd, int listen_trig_mode, bool dispatch = true);
+    void set_cpu(int cpu) { m_cpu = cpu; }                 // 循环线程绑定的CPU，-1表示不绑定
+    void queue_conn(int connfd, const sockaddr_in &addr);  // 其他线程把新连接交给该循环
+    void loop();                                           // 在当前线程运行事件循环
+    bool start();                                          // 创建新线程运行事件循环
+    void stop();
+    void join();
+
+    int id() const { return m_id; }
+    int epollfd() const { return m_epollfd; }
+    int load() const { return m_conn_count.load(memory_order_relaxed); } // 当前连接数
+    long long accept_count() const { return m_accept_count.load(memory_order_relaxed); }
+    long long request_count() const { return m_request_count.load(memory_order_relaxed); }
+    static void on_task_done(http_conn *conn, void *arg); // 线程池任务完成回调
+    static void on_sql_done(void *owner, void *arg, unsigned int err); // 异步数据库操作完成回调
+    static void on_register_done(void *owner, void *arg, uint64_t ticket, unsigned int err); // 注册写入队列提交回调
+
+private:
+    static void *worker(void *arg);
+    void handle_accept();
+    void handle_wakeup();
+    void add_conn(int connfd, const sockaddr_in &addr);
+    void release_conn(int sockfd, http_conn *conn);
+    void dispatch(int sockfd, http_conn *conn, int state);
+    void deal_read(int sockfd);
+    void deal_write(int sockfd);
+    void process(http_conn *conn);
+
+private:
+    static const int MAX_FD = 65536;           // 最大文件描述符
+    static const int MAX_EVENT_NUMBER = 10000; // 单次epoll_wait返回的最大事件数
+
+    int m_id;
+    loop_config m_config;
+    reactor *m_reactor;
+    int m_epollfd;
+    int m_wakeup_fd;          // eventfd，其他线程投递新连接后用来唤醒epoll_wait
+    int m_listenfd;           // 只有负责accept的循环才有
+    int m_listen_trig_mode;
+    bool m_dispatch;          // accept后是否交给主reactor挑选循环
+    int m_cpu;
+    async_sql *m_sql;         // 本循环的非阻塞数据库连接，可以为空
+    pthread_t m_tid;
+    bool m_started;
+    atomic<bool> m_stop;
+    epoll_event m_events[MAX_EVENT_NUMBER];
+
+    // 其他线程投递过来、尚未注册的新连接
+    locker m_pending_lock;
+    vector<pair<int, sockaddr_in>> m_pending;
+    vector<http_conn *> m_done;   // 线程池处理完成、等待本循环检查的连接
+    // 注册写入队列已经提交、等待本循环继续处理的连接
+    struct register_done
+    {
+        http_conn *conn;
+        uint64_t ticket;
+        unsigned int err;
+    };
+    vector<register_done> m_registered;
+
+    // 只在本线程访问：交给线程池、尚未完成的连接，记录其fd和未完成的任务数
+    unordered_map<http_conn *, pair<int, int>> m_inflight;
+
+    // 只在本线程访问：fd到连接对象的映射，以及可复用的空闲连接对象
+    unordered_map<int, http_conn *> m_users;
+    vector<http_conn *> m_free_conns;
+
+    atomic<int> m_conn_count;
+    atomic<long long> m_accept_count;
+    atomic<long long> m_request_count;
+    int m_close_log;
+};
+
+#endif
@@ -0,0 +1,212 @@
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include "reactor.h"
+
+reactor::reactor()
+{
+    m_dispatch_mode = ROUND_ROBIN;
+    m_next = 0;
+    m_main_loop = nullptr;
+    m_pool = nullptr;
+    m_conn_pool = nullptr;
+    m_stat_interval = 0;
+    m_last_stat = 0;
+    m_close_log = 0;
+}
+
+reactor::~reactor()
+{
+    stop();
+    for (event_loop *loop : m_sub_loops)
+    {
+        loop->join();
+        delete loop;
+    }
+    delete m_main_loop;
+    for (int listenfd : m_listenfds)
+        close(listenfd);
+}
+
+// 创建监听socket
+// reuse_port为true时开启SO_REUSEPORT，多个socket可以绑定同一端口，
+// 内核按四元组哈希把新连接分给其中一个，避免多个线程争抢同一个accept队列
+int reactor::open_listenfd(int port, bool reuse_port)
+{
+    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    if (listenfd < 0)
+        return -1;
+
+    int flag = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    if (reuse_port && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag)) < 0)
+    {
+        close(listenfd);
+        return -1;
+    }
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+
+    // accept队列长度用SOMAXCONN（内核再按net.core.somaxconn截断），
+    // 原来的5在突发连接时很快溢出，被丢弃的SYN要等1秒才重传；REUSE_PORT模式下每个分片各有一个队列
+    if (bind(listenfd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+        listen(listenfd, SOMAXCONN) < 0)
+    {
+        close(listenfd);
+        return -1;
+    }
+    return listenfd;
+}
+
+bool reactor::init(int port, int loop_num, int dispatch_mode, int listen_trig_mode,
+                   const loop_config &config, int stat_interval, bool pin_cpu)
+{
+    m_dispatch_mode = dispatch_mode;
+    m_stat_interval = stat_interval;
+    m_close_log = config.close_log;
+    bool reuse_port = (m_dispatch_mode == REUSE_PORT);
+    m_pool = config.pool;
+    m_conn_pool = config.conn_pool;
+    if (m_pool)
+        m_pool->set_done(event_loop::on_task_done);
+
+    // 主reactor，编号为0
+    m_main_loop = new event_loop(0, config);
+    if (!m_main_loop->init())
+        return false;
+    m_main_loop->set_reactor(this);
+
+    // 子reactor，编号从1开始
+    for (int i = 0; i < loop_num; i++)
+    {
+        event_loop *loop = new event_loop(i + 1, config);
+        if (!loop->init())
+        {
+            delete loop;
+            return false;
+        }
+        loop->set_reactor(this);
+        m_sub_loops.push_back(loop);
+    }
+
+    // 普通模式只有主reactor监听；REUSE_PORT模式下每个循环都有自己的监听socket，
+    // accept到的连接直接留在本循环，不再经过主reactor分发
+    for (size_t i = 0; i <= m_sub_loops.size(); i++)
+    {
+        event_loop *loop = (i == 0) ? m_main_loop : m_sub_loops[i - 1];
+        if (pin_cpu)
+            loop->set_cpu(i % sysconf(_SC_NPROCESSORS_ONLN));
+        if (i > 0 && !reuse_port)
+            continue;
+
+        int listenfd = open_listenfd(port, reuse_port);
+        if (listenfd < 0)
+        {
+            LOG_ERROR("listen on port %d failed", port);
+            return false;
+        }
+        m_listenfds.push_back(listenfd);
+        loop->set_listen(listenfd, listen_trig_mode, !reuse_port);
+    }
+    m_last_accepts.assign(m_sub_loops.size() + 1, 0);
+    m_last_requests.assign(m_sub_loops.size() + 1, 0);
+    m_last_stat = time(NULL);
+    return true;
+}
+
+void reactor::run()
+{
+    for (event_loop *loop : m_sub_loops)
+    {
+        if (!loop->start())
+        {
+            LOG_ERROR("start loop %d failed", loop->id());
+            return;
+        }
+    }
+    m_main_loop->loop();
+}
+
+void reactor::stop()
+{
+    if (m_main_loop)
+        m_main_loop->stop();
+    for (event_loop *loop : m_sub_loops)
+        loop->stop();
+}
+
+event_loop *reactor::select_loop()
+{
+    // 没有子reactor时由主reactor自己处理
+    if (m_sub_loops.empty())
+        return m_main_loop;
+
+    if (m_dispatch_mode == LEAST_LOAD)
+    {
+        event_loop *target = m_sub_loops[0];
+        for (size_t i = 1; i < m_sub_loops.size(); i++)
+        {
+            if (m_sub_loops[i]->load() < target->load())
+                target = m_sub_loops[i];
+        }
+        return target;
+    }
+
+    event_loop *target = m_sub_loops[m_next % m_sub_loops.size()];
+    m_next++;
+    return target;
+}
+
+// 按时间间隔输出每秒新建连接数和每个循环每秒处理的请求数
+// 用于比较单循环和多循环模式下的吞吐
+void reactor::tick()
+{
+    if (m_stat_interval <= 0)
+        return;
+    time_t now = time(NULL);
+    long long elapsed = now - m_last_stat;
+    if (elapsed < m_stat_interval)
+        return;
+
+    LOG_INFO("reactor: %d loops, dispatch mode %d", (int)m_sub_loops.size() + 1, m_dispatch_mode);
+    for (size_t i = 0; i <= m_sub_loops.size(); i++)
+    {
+        event_loop *loop = (i == 0) ? m_main_loop : m_sub_loops[i - 1];
+        long long accepts = loop->accept_count();
+        long long requests = loop->request_count();
+        // REUSE_PORT模式下每个循环的accept速率即每个分片的速率
+        LOG_INFO("loop %d: %d conns, %lld conn/s, %lld req/s", loop->id(), loop->load(),
+                 (accepts - m_last_accepts[i]) / elapsed,
+                 (requests - m_last_requests[i]) / elapsed);
+        m_last_accepts[i] = accepts;
+        m_last_requests[i] = requests;
+    }
+    if (m_pool)
+    {
+        threadpool<http_conn>::stats st = m_pool->get_stats();
+        LOG_INFO("threadpool: %lld tasks, %lld steals, avg wait %lld ns, max wait %lld ns",
+                 st.tasks, st.steals, st.tasks ? st.wait_ns / st.tasks : 0, st.max_wait_ns);
+    }
+    // 数据库连接池的使用率和取连接的等待时间，同时触发空闲连接的回收
+    if (m_conn_pool)
+    {
+        connection_pool::stats ps = m_conn_pool->GetStats();
+        LOG_INFO("sql pool: %d/%d conns, %d busy, %d idle, %lld checkouts, avg wait %lld us, max wait %lld us, "
+                 "%lld timeouts, %lld created, %lld reaped, %lld reconnects",
+                 ps.total, ps.max, ps.busy, ps.idle, ps.checkouts,
+                 ps.checkouts ? ps.wait_us / ps.checkouts : 0, ps.max_wait_us,
+                 ps.timeouts, ps.created, ps.reaped, ps.reconnects);
+    }
+    // 实时压缩节省的流量和耗费的CPU
+    compress_cache::stats cs = compress_cache::get_instance()->get_stats();
+    if (cs.hits + cs.misses > 0)
+        LOG_INFO("compress: %lld hits, %lld misses, %lld over budget, %lld -> %lld bytes, %lld us cpu",
+                 cs.hits, cs.misses, cs.rejected, cs.bytes_in, cs.bytes_out, cs.cpu_us);
+    m_last_stat = now;
+}
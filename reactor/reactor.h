@@ -0,0 +1,58 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <time.h>
+#include <vector>
+
+#include "event_loop.h"
+
+using namespace std;
+
+// 主从reactor：主reactor只负责accept，再把连接分发给N个子reactor
+// 每个子reactor是一个独立线程中的event_loop
+class reactor
+{
+public:
+    // 新连接的分发策略
+    enum DISPATCH_MODE
+    {
+        ROUND_ROBIN = 0, // 轮询
+        LEAST_LOAD,      // 选择当前连接数最少的循环
+        REUSE_PORT       // 每个循环各自用SO_REUSEPORT监听并accept，由内核分发连接
+    };
+
+public:
+    reactor();
+    ~reactor();
+
+    // loop_num为子reactor个数，为0时由主reactor自己处理所有连接（单循环模式）
+    // stat_interval大于0时，每隔stat_interval秒输出一次每个循环的连接数/请求数速率
+    // pin_cpu为true时，第i个循环绑定到第i个CPU核心上
+    bool init(int port, int loop_num, int dispatch_mode, int listen_trig_mode,
+              const loop_config &config, int stat_interval = 0, bool pin_cpu = false);
+    void run();  // 启动子reactor，并在当前线程运行主reactor，直到stop
+    void stop();
+
+    event_loop *select_loop(); // 只在主reactor线程中调用
+    void tick();               // 主reactor每轮循环调用，用于输出统计
+
+private:
+    static int open_listenfd(int port, bool reuse_port);
+
+private:
+    vector<int> m_listenfds; // REUSE_PORT模式下每个循环一个监听socket
+    int m_dispatch_mode;
+    unsigned int m_next; // 轮询下标
+    event_loop *m_main_loop;
+    vector<event_loop *> m_sub_loops;
+    threadpool<http_conn> *m_pool;
+    connection_pool *m_conn_pool;
+
+    int m_stat_interval;
+    time_t m_last_stat;
+    vector<long long> m_last_accepts;
+    vector<long long> m_last_requests;
+    int m_close_log;
+};
+
+#endif
@@ -0,0 +1,411 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <list>
+#include <atomic>
+#include <exception>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "../lock/locker.h"
+#include "../CGlmysql/sql_connection_pool.h"
+
+using namespace std;
+
+// 工作窃取(work-stealing)线程池
+// 每个工作线程有一个自己的双端队列(Chase-Lev deque)：
+// 本线程从底部无锁地push/pop，其他线程空闲时从顶部无锁地窃取
+// 外部线程提交的任务先放入某个工作线程的收件箱(inbox)，由该线程成批转入自己的队列，
+// 这样提交时只在被选中的那个线程的锁上竞争，而不是所有线程争抢同一把锁
+template <typename T>
+class threadpool
+{
+public:
+    // 任务处理完后的回调，arg为append时传入的参数
+    typedef void (*done_func)(T *request, void *arg);
+
+    // 统计信息，用于观察排队等待时间和窃取次数
+    struct stats
+    {
+        long long tasks;        // 已处理的任务数
+        long long steals;       // 从其他线程窃取到的任务数
+        long long wait_ns;      // 所有任务排队等待时间之和（纳秒）
+        long long max_wait_ns;  // 最大排队等待时间（纳秒）
+    };
+
+public:
+    // thread_number是线程池中线程的数量，max_requests是请求队列中最多允许的、等待处理的请求的数量
+    threadpool(connection_pool *connPool, int thread_number = 8, int max_requests = 10000);
+    ~threadpool();
+
+    // state为0表示读事件，为1表示写事件
+    bool append(T *request, int state, void *arg = nullptr);
+    void set_done(done_func done) { m_done = done; }
+    stats get_stats();
+
+private:
+    // 队列中的一个任务
+    struct task
+    {
+        T *request;
+        int state;
+        void *arg;
+        long long enqueue_ns; // 入队时间
+    };
+
+    // 固定容量的Chase-Lev双端队列
+    // 槽位的各字段都用原子变量保存，窃取者读取时不会和拥有者的写入产生数据竞争
+    struct deque_slot
+    {
+        atomic<T *> request;
+        atomic<int> state;
+        atomic<void *> arg;
+        atomic<long long> enqueue_ns;
+    };
+
+    // 每个工作线程的数据，按缓存行对齐避免伪共享
+    struct alignas(64) worker_data
+    {
+        threadpool *pool;
+        int index;
+        pthread_t tid;
+
+        atomic<long long> top;    // 窃取者从这里取
+        atomic<long long> bottom; // 拥有者从这里放和取
+        deque_slot *slots;
+
+        locker inbox_lock;        // 外部提交的任务先放这里
+        list<task> inbox;
+
+        atomic<long long> tasks;
+        atomic<long long> steals;
+        atomic<long long> wait_ns;
+        atomic<long long> max_wait_ns;
+    };
+
+private:
+    static void *worker(void *arg);
+    void run(worker_data *self);
+    bool find_task(worker_data *self, task &t);
+
+    bool push_bottom(worker_data *w, const task &t);
+    bool pop_bottom(worker_data *w, task &t);
+    bool steal_top(worker_data *w, task &t);
+    bool take_inbox(worker_data *w, task &t);
+    void drain_inbox(worker_data *w);
+
+    static long long now_ns()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+
+private:
+    static const int DEQUE_SIZE = 1024; // 每个队列的容量，必须是2的幂
+
+    int m_thread_number;         // 线程池中的线程数
+    int m_max_requests;          // 请求队列中允许的最大请求数
+    worker_data *m_workers;      // 每个工作线程的数据
+    atomic<unsigned int> m_next; // 轮询选择接收任务的线程
+    atomic<int> m_pending;       // 已提交但还没有开始处理的任务数
+    sem m_queuestat;             // 是否有任务需要处理，每个任务对应一个信号
+    atomic<bool> m_stop;
+    done_func m_done;
+    connection_pool *m_connPool; // 数据库连接池
+};
+
+template <typename T>
+threadpool<T>::threadpool(connection_pool *connPool, int thread_number, int max_requests)
+{
+    if (thread_number <= 0 || max_requests <= 0)
+        throw std::exception();
+
+    m_thread_number = thread_number;
+    m_max_requests = max_requests;
+    m_next = 0;
+    m_pending = 0;
+    m_stop = false;
+    m_done = nullptr;
+    m_connPool = connPool;
+
+    m_workers = new worker_data[m_thread_number];
+    for (int i = 0; i < m_thread_number; ++i)
+    {
+        worker_data *w = &m_workers[i];
+        w->pool = this;
+        w->index = i;
+        w->top = 0;
+        w->bottom = 0;
+        w->slots = new deque_slot[DEQUE_SIZE];
+        w->tasks = 0;
+        w->steals = 0;
+        w->wait_ns = 0;
+        w->max_wait_ns = 0;
+    }
+
+    for (int i = 0; i < m_thread_number; ++i)
+    {
+        if (pthread_create(&m_workers[i].tid, NULL, worker, &m_workers[i]) != 0)
+        {
+            m_stop = true;
+            for (int j = 0; j < i; ++j)
+                m_queuestat.post();
+            for (int j = 0; j < i; ++j)
+                pthread_join(m_workers[j].tid, NULL);
+            for (int j = 0; j < m_thread_number; ++j)
+                delete[] m_workers[j].slots;
+            delete[] m_workers;
+            throw std::exception();
+        }
+    }
+}
+
+template <typename T>
+threadpool<T>::~threadpool()
+{
+    m_stop = true;
+    for (int i = 0; i < m_thread_number; ++i)
+        m_queuestat.post();
+    for (int i = 0; i < m_thread_number; ++i)
+        pthread_join(m_workers[i].tid, NULL);
+    for (int i = 0; i < m_thread_number; ++i)
+        delete[] m_workers[i].slots;
+    delete[] m_workers;
+}
+
+template <typename T>
+bool threadpool<T>::append(T *request, int state, void *arg)
+{
+    if (m_pending.fetch_add(1) >= m_max_requests)
+    {
+        m_pending--;
+        return false;
+    }
+
+    task t;
+    t.request = request;
+    t.state = state;
+    t.arg = arg;
+    t.enqueue_ns = now_ns();
+
+    // 轮询选择一个工作线程，只占用它的收件箱锁
+    worker_data *w = &m_workers[m_next.fetch_add(1, memory_order_relaxed) % m_thread_number];
+    w->inbox_lock.lock();
+    w->inbox.push_back(t);
+    w->inbox_lock.unlock();
+
+    m_queuestat.post();
+    return true;
+}
+
+template <typename T>
+typename threadpool<T>::stats threadpool<T>::get_stats()
+{
+    stats s = {0, 0, 0, 0};
+    for (int i = 0; i < m_thread_number; ++i)
+    {
+        s.tasks += m_workers[i].tasks.load(memory_order_relaxed);
+        s.steals += m_workers[i].steals.load(memory_order_relaxed);
+        s.wait_ns += m_workers[i].wait_ns.load(memory_order_relaxed);
+        long long w = m_workers[i].max_wait_ns.load(memory_order_relaxed);
+        if (w > s.max_wait_ns)
+            s.max_wait_ns = w;
+    }
+    return s;
+}
+
+// 拥有者从底部放入任务，队列满时返回false
+template <typename T>
+bool threadpool<T>::push_bottom(worker_data *w, const task &t)
+{
+    long long b = w->bottom.load(memory_order_relaxed);
+    long long top = w->top.load(memory_order_acquire);
+    if (b - top >= DEQUE_SIZE)
+        return false;
+
+    deque_slot &slot = w->slots[b & (DEQUE_SIZE - 1)];
+    slot.request.store(t.request, memory_order_relaxed);
+    slot.state.store(t.state, memory_order_relaxed);
+    slot.arg.store(t.arg, memory_order_relaxed);
+    slot.enqueue_ns.store(t.enqueue_ns, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    w->bottom.store(b + 1, memory_order_relaxed);
+    return true;
+}
+
+// 拥有者从底部取任务，只剩一个任务时和窃取者用CAS竞争
+template <typename T>
+bool threadpool<T>::pop_bottom(worker_data *w, task &t)
+{
+    long long b = w->bottom.load(memory_order_relaxed) - 1;
+    w->bottom.store(b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long long top = w->top.load(memory_order_relaxed);
+
+    if (top > b)
+    {
+        // 队列为空
+        w->bottom.store(b + 1, memory_order_relaxed);
+        return false;
+    }
+
+    deque_slot &slot = w->slots[b & (DEQUE_SIZE - 1)];
+    t.request = slot.request.load(memory_order_relaxed);
+    t.state = slot.state.load(memory_order_relaxed);
+    t.arg = slot.arg.load(memory_order_relaxed);
+    t.enqueue_ns = slot.enqueue_ns.load(memory_order_relaxed);
+
+    if (top == b)
+    {
+        bool won = w->top.compare_exchange_strong(top, top + 1, memory_order_seq_cst, memory_order_relaxed);
+        w->bottom.store(b + 1, memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+// 其他线程从顶部窃取任务
+template <typename T>
+bool threadpool<T>::steal_top(worker_data *w, task &t)
+{
+    long long top = w->top.load(memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long long b = w->bottom.load(memory_order_acquire);
+    if (top >= b)
+        return false;
+
+    deque_slot &slot = w->slots[top & (DEQUE_SIZE - 1)];
+    t.request = slot.request.load(memory_order_relaxed);
+    t.state = slot.state.load(memory_order_relaxed);
+    t.arg = slot.arg.load(memory_order_relaxed);
+    t.enqueue_ns = slot.enqueue_ns.load(memory_order_relaxed);
+
+    return w->top.compare_exchange_strong(top, top + 1, memory_order_seq_cst, memory_order_relaxed);
+}
+
+// 把收件箱中的任务成批转入自己的队列，队列满时剩下的留在收件箱
+template <typename T>
+void threadpool<T>::drain_inbox(worker_data *w)
+{
+    w->inbox_lock.lock();
+    while (!w->inbox.empty())
+    {
+        if (!push_bottom(w, w->inbox.front()))
+            break;
+        w->inbox.pop_front();
+    }
+    w->inbox_lock.unlock();
+}
+
+// 直接从某个线程的收件箱中取一个任务
+template <typename T>
+bool threadpool<T>::take_inbox(worker_data *w, task &t)
+{
+    bool found = false;
+    w->inbox_lock.lock();
+    if (!w->inbox.empty())
+    {
+        t = w->inbox.front();
+        w->inbox.pop_front();
+        found = true;
+    }
+    w->inbox_lock.unlock();
+    return found;
+}
+
+template <typename T>
+bool threadpool<T>::find_task(worker_data *self, task &t)
+{
+    // 1.先取自己队列中的任务
+    if (pop_bottom(self, t))
+        return true;
+
+    // 2.把自己收件箱中的任务转入队列后再取
+    drain_inbox(self);
+    if (pop_bottom(self, t))
+        return true;
+
+    // 3.自己没有任务了，从其他线程的队列中窃取，再看其他线程的收件箱
+    for (int i = 1; i < m_thread_number; ++i)
+    {
+        worker_data *victim = &m_workers[(self->index + i) % m_thread_number];
+        if (steal_top(victim, t) || take_inbox(victim, t))
+        {
+            self->steals.fetch_add(1, memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename T>
+void *threadpool<T>::worker(void *arg)
+{
+    worker_data *self = (worker_data *)arg;
+    self->pool->run(self);
+    return self->pool;
+}
+
+template <typename T>
+void threadpool<T>::run(worker_data *self)
+{
+    while (true)
+    {
+        // 每个信号对应一个已提交的任务，拿到信号说明一定有任务可取，
+        // 只是可能正被其他线程从收件箱转移到队列中，所以取不到时让出CPU再试
+        m_queuestat.wait();
+        if (m_stop)
+            break;
+
+        task t;
+        while (!find_task(self, t))
+            sched_yield();
+        m_pending--;
+
+        long long wait = now_ns() - t.enqueue_ns;
+        self->tasks.fetch_add(1, memory_order_relaxed);
+        self->wait_ns.fetch_add(wait, memory_order_relaxed);
+        if (wait > self->max_wait_ns.load(memory_order_relaxed))
+            self->max_wait_ns.store(wait, memory_order_relaxed);
+
+        T *request = t.request;
+        // 读事件：读取数据并处理请求；写事件：发送响应
+        if (0 == t.state)
+        {
+            if (request->read_once())
+            {
+                if (m_connPool)
+                {
+                    connectionRAII mysqlcon(&request->mysql, m_connPool);
+                    request->process();
+                }
+                else
+                    request->process();
+            }
+            else
+                request->close_conn();
+        }
+        else
+        {
+            if (!request->write())
+                request->close_conn();
+            else if (request->pending_request())
+            {
+                // 读缓冲区中还有流水线请求，接着处理
+                if (m_connPool)
+                {
+                    connectionRAII mysqlcon(&request->mysql, m_connPool);
+                    request->process();
+                }
+                else
+                    request->process();
+            }
+        }
+
+        if (m_done)
+            m_done(request, t.arg);
+    }
+}
+
+#endif